@@ -54,6 +54,33 @@ void arch_enable_interrupts(void);
 void arch_disable_interrupts(void);
 void arch_halt(void);
 
+/* SIMD support (SSE2 on x86, NEON on arm64) - nonzero once enabled */
+int arch_has_simd(void);
+
+/* Microseconds since an arbitrary point, wrapping at 2^32 (about 71
+ * minutes): differences between two readings time an interval */
+unsigned int arch_time_us(void);
+
+/* Sampling timer: from arch_sample_start until arch_sample_stop, a timer
+ * interrupt calls handler about hz times a second with the program
+ * counter it interrupted. handler runs with interrupts off and must not
+ * touch floating-point or SIMD registers. Returns 0, or -1 if the
+ * architecture has no sampling timer. */
+typedef void (*arch_sample_handler)(unsigned long pc);
+int arch_sample_start(unsigned int hz, arch_sample_handler handler);
+void arch_sample_stop(void);
+
+/* Symmetric multiprocessing: arch_smp_start starts the other CPUs, each
+ * of which calls entry with its index (1 up to ARCH_MAX_CPUS - 1) and
+ * never returns; CPUs beyond ARCH_MAX_CPUS stay parked. Returns the
+ * number of CPUs running, the boot CPU (index 0) included: 1 if the
+ * architecture starts no others. */
+#define ARCH_MAX_CPUS 8
+typedef void (*arch_cpu_entry)(unsigned int cpu);
+int arch_smp_start(arch_cpu_entry entry);
+unsigned int arch_cpu_index(void);
+void arch_cpu_relax(void);  /* Spin-wait hint */
+
 /* Boot information */
 typedef struct {
     uint32_t magic;
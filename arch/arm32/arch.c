@@ -2,6 +2,7 @@
 
 #include "../../arch.h"
 #include "../../kernel.h"
+#include "../../bf.h"
 
 static display_info_t display_info;
 static boot_info_t boot_info;
@@ -86,6 +87,69 @@ void arch_halt(void) {
     }
 }
 
+/* SIMD support */
+int arch_has_simd(void) {
+    return 0; /* No NEON kernels for ARM32 */
+}
+
+/* value / divisor by shift and subtract: 64-bit division would need
+ * libgcc, which the kernel does not link */
+static unsigned long long divide(unsigned long long value, unsigned int divisor) {
+    unsigned long long quotient = 0;
+    unsigned long long rest = 0;
+
+    for (int bit = 63; bit >= 0; bit--) {
+        rest = (rest << 1) | ((value >> bit) & 1);
+        if (rest >= divisor) {
+            rest -= divisor;
+            quotient |= 1ULL << bit;
+        }
+    }
+    return quotient;
+}
+
+/* Time - the generic timer's virtual count (CNTVCT), at CNTFRQ ticks per
+ * second */
+unsigned int arch_time_us(void) {
+    unsigned int low;
+    unsigned int high;
+    unsigned int frequency;
+    unsigned long long ticks;
+    unsigned long long seconds;
+
+    __asm__ volatile("isb\n\tmrrc p15, 1, %0, %1, c14" : "=r"(low), "=r"(high));
+    __asm__ volatile("mrc p15, 0, %0, c14, c0, 0" : "=r"(frequency));
+    ticks = ((unsigned long long)high << 32) | low;
+    seconds = divide(ticks, frequency);
+    return (unsigned int)(seconds * 1000000 +
+                          divide((ticks - seconds * frequency) * 1000000, frequency));
+}
+
+/* Sampling timer - not implemented for ARM32 */
+int arch_sample_start(unsigned int hz, arch_sample_handler handler) {
+    (void)hz;
+    (void)handler;
+    return -1;
+}
+
+void arch_sample_stop(void) {
+}
+
+/* Symmetric multiprocessing - not implemented for ARM32: only the boot
+ * CPU runs */
+int arch_smp_start(arch_cpu_entry entry) {
+    (void)entry;
+    return 1;
+}
+
+unsigned int arch_cpu_index(void) {
+    return 0;
+}
+
+void arch_cpu_relax(void) {
+    __asm__ volatile("nop");
+}
+
 /* Boot information */
 boot_info_t* arch_get_boot_info(void) {
     return &boot_info;
@@ -111,3 +175,16 @@ char arch_input_read(void) {
     return uart_read_char();
 }
 
+
+/* No native code generator on this architecture - programs are interpreted */
+size_t arch_jit_compile(const bf_program* program, uint8_t* code, size_t capacity) {
+    (void)program;
+    (void)code;
+    (void)capacity;
+    return 0;
+}
+
+void arch_jit_sync(uint8_t* code, size_t size) {
+    (void)code;
+    (void)size;
+}
@@ -9,6 +9,12 @@ static boot_info_t boot_info;
 /* Early architecture initialization */
 void arch_early_init(void) {
     /* ARM64-specific early init */
+    
+    /* Allow FP/SIMD (NEON) at EL1: CPACR_EL1.FPEN = 0b11 */
+    unsigned long cpacr;
+    __asm__ volatile("mrs %0, cpacr_el1" : "=r"(cpacr));
+    cpacr |= (3UL << 20);
+    __asm__ volatile("msr cpacr_el1, %0\n\tisb" : : "r"(cpacr));
 }
 
 /* Architecture initialization */
@@ -83,6 +89,162 @@ void arch_halt(void) {
     }
 }
 
+/* SIMD support */
+int arch_has_simd(void) {
+    return 1; /* NEON is mandatory on ARMv8-A, enabled by arch_early_init */
+}
+
+/* Time - the generic timer's virtual count, at CNTFRQ ticks per second */
+unsigned int arch_time_us(void) {
+    unsigned long ticks;
+    unsigned long frequency;
+
+    __asm__ volatile("isb\n\tmrs %0, cntvct_el0" : "=r"(ticks));
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+    return (unsigned int)((ticks / frequency) * 1000000 + (ticks % frequency) * 1000000 / frequency);
+}
+
+/* Sampling timer - the generic timer's virtual timer, PPI 27, through
+ * the GICv2 of the QEMU virt machine. Only the IRQ vector at EL1 is
+ * handled; the kernel otherwise runs with IRQs masked. */
+#define GICD_BASE 0x08000000UL
+#define GICC_BASE 0x08010000UL
+#define TIMER_IRQ 27
+
+#define GICD_CTLR       0x000
+#define GICD_ISENABLER0 0x100
+#define GICD_ICENABLER0 0x180
+#define GICD_IPRIORITYR 0x400
+#define GICC_CTLR       0x000
+#define GICC_PMR        0x004
+#define GICC_IAR        0x00C
+#define GICC_EOIR       0x010
+
+static arch_sample_handler sample_handler;
+static unsigned long sample_interval;  /* Timer ticks between samples */
+static int interrupts_ready = 0;
+
+static inline void mmio_write32(unsigned long address, uint32_t value) {
+    *(volatile uint32_t*)address = value;
+}
+
+static inline uint32_t mmio_read32(unsigned long address) {
+    return *(volatile uint32_t*)address;
+}
+
+/* Called from irq_entry with the interrupted pc */
+static void __attribute__((used)) irq_tick(unsigned long pc) {
+    uint32_t iar = mmio_read32(GICC_BASE + GICC_IAR);
+
+    if ((iar & 0x3FF) == TIMER_IRQ) {
+        __asm__ volatile("msr cntv_tval_el0, %0" : : "r"(sample_interval));
+        sample_handler(pc);
+    }
+    if ((iar & 0x3FF) < 1020) {
+        mmio_write32(GICC_BASE + GICC_EOIR, iar);
+    }
+}
+
+/* Exception vectors: 16 entries of 0x80 bytes. IRQs taken at EL1 on
+ * SP_EL1 (offset 0x280) save the registers C may clobber and pass ELR to
+ * irq_tick; anything else stops the machine. */
+__asm__(
+    ".text\n"
+    ".balign 2048\n"
+    "exception_vectors:\n"
+    ".rept 5\n"
+    "    b arch_halt\n"
+    "    .balign 128\n"
+    ".endr\n"
+    "    b irq_entry\n"
+    "    .balign 128\n"
+    ".rept 10\n"
+    "    b arch_halt\n"
+    "    .balign 128\n"
+    ".endr\n"
+    "irq_entry:\n"
+    "    sub sp, sp, #176\n"
+    "    stp x0, x1, [sp, #0]\n"
+    "    stp x2, x3, [sp, #16]\n"
+    "    stp x4, x5, [sp, #32]\n"
+    "    stp x6, x7, [sp, #48]\n"
+    "    stp x8, x9, [sp, #64]\n"
+    "    stp x10, x11, [sp, #80]\n"
+    "    stp x12, x13, [sp, #96]\n"
+    "    stp x14, x15, [sp, #112]\n"
+    "    stp x16, x17, [sp, #128]\n"
+    "    stp x18, x29, [sp, #144]\n"
+    "    str x30, [sp, #160]\n"
+    "    mrs x0, elr_el1\n"
+    "    bl irq_tick\n"
+    "    ldp x0, x1, [sp, #0]\n"
+    "    ldp x2, x3, [sp, #16]\n"
+    "    ldp x4, x5, [sp, #32]\n"
+    "    ldp x6, x7, [sp, #48]\n"
+    "    ldp x8, x9, [sp, #64]\n"
+    "    ldp x10, x11, [sp, #80]\n"
+    "    ldp x12, x13, [sp, #96]\n"
+    "    ldp x14, x15, [sp, #112]\n"
+    "    ldp x16, x17, [sp, #128]\n"
+    "    ldp x18, x29, [sp, #144]\n"
+    "    ldr x30, [sp, #160]\n"
+    "    add sp, sp, #176\n"
+    "    eret\n");
+
+extern char exception_vectors[];
+
+/* Install the vectors and route the timer PPI through the GIC */
+static void interrupts_init(void) {
+    __asm__ volatile("msr vbar_el1, %0\n\tisb" : : "r"(exception_vectors));
+
+    mmio_write32(GICD_BASE + GICD_CTLR, 1);
+    *(volatile uint8_t*)(GICD_BASE + GICD_IPRIORITYR + TIMER_IRQ) = 0x80;
+    mmio_write32(GICC_BASE + GICC_PMR, 0xF0);
+    mmio_write32(GICC_BASE + GICC_CTLR, 1);
+    interrupts_ready = 1;
+}
+
+int arch_sample_start(unsigned int hz, arch_sample_handler handler) {
+    unsigned long frequency;
+
+    if (!interrupts_ready) {
+        interrupts_init();
+    }
+    __asm__ volatile("mrs %0, cntfrq_el0" : "=r"(frequency));
+    if (hz == 0 || frequency / hz == 0) {
+        return -1;
+    }
+    sample_handler = handler;
+    sample_interval = frequency / hz;
+
+    __asm__ volatile("msr cntv_tval_el0, %0" : : "r"(sample_interval));
+    __asm__ volatile("msr cntv_ctl_el0, %0\n\tisb" : : "r"(1UL));  /* Enabled, unmasked */
+    mmio_write32(GICD_BASE + GICD_ISENABLER0, 1U << TIMER_IRQ);
+    arch_enable_interrupts();
+    return 0;
+}
+
+void arch_sample_stop(void) {
+    arch_disable_interrupts();
+    __asm__ volatile("msr cntv_ctl_el0, %0\n\tisb" : : "r"(0UL));
+    mmio_write32(GICD_BASE + GICD_ICENABLER0, 1U << TIMER_IRQ);
+}
+
+/* Symmetric multiprocessing - not implemented for ARM64: only the boot
+ * CPU runs */
+int arch_smp_start(arch_cpu_entry entry) {
+    (void)entry;
+    return 1;
+}
+
+unsigned int arch_cpu_index(void) {
+    return 0;
+}
+
+void arch_cpu_relax(void) {
+    __asm__ volatile("yield");
+}
+
 /* Boot information */
 boot_info_t* arch_get_boot_info(void) {
     return &boot_info;
@@ -107,4 +269,3 @@ char arch_input_read(void) {
     extern char uart_read_char(void);
     return uart_read_char();
 }
-
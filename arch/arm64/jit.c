@@ -0,0 +1,283 @@
+/* AArch64 Brainfuck JIT Backend
+ * Emits A64 machine code for a compiled Brainfuck program.
+ *
+ * Register use inside generated code:
+ *   x19 - tape pointer (address of the current cell)
+ *   x20 - first cell of the dirty window
+ *   x21 - last cell of the dirty window
+ *   w9-w11, x16 - scratch
+ * x19-x21 are callee-saved, so they survive runtime helper calls.
+ */
+
+#include "../../kernel.h"
+#include "../../bf.h"
+
+/* Worst-case bytes emitted for one IR instruction */
+#define JIT_MAX_INSN_BYTES 96
+
+/* Register numbers */
+#define REG_X0  0
+#define REG_X1  1
+#define REG_W9  9
+#define REG_W10 10
+#define REG_W11 11
+#define REG_X16 16
+#define REG_PTR 19
+#define REG_FIRST 20
+#define REG_LAST 21
+#define REG_SP  31
+
+/* Condition codes */
+#define COND_HS 2
+#define COND_LO 3
+#define COND_HI 8
+#define COND_LS 9
+
+/* Native code offset of each IR instruction */
+static size_t jit_insn_offset[BF_MAX_INSNS];
+
+/* Output buffer state */
+static uint8_t* jit_code;
+static size_t jit_size;
+
+/* Append one 32-bit instruction (little-endian) */
+static void emit(unsigned int insn) {
+    jit_code[jit_size++] = (uint8_t)insn;
+    jit_code[jit_size++] = (uint8_t)(insn >> 8);
+    jit_code[jit_size++] = (uint8_t)(insn >> 16);
+    jit_code[jit_size++] = (uint8_t)(insn >> 24);
+}
+
+/* Overwrite the instruction at a code offset */
+static void patch(size_t at, unsigned int insn) {
+    jit_code[at] = (uint8_t)insn;
+    jit_code[at + 1] = (uint8_t)(insn >> 8);
+    jit_code[at + 2] = (uint8_t)(insn >> 16);
+    jit_code[at + 3] = (uint8_t)(insn >> 24);
+}
+
+/* ldrb/strb wt, [x19, #offset] - offsets stay within the tape guard */
+static void emit_cell_access(unsigned int load, int offset, unsigned int rt) {
+    if (offset >= 0 && offset < 4096) {
+        /* Unsigned scaled immediate: ldrb 0x39400000, strb 0x39000000 */
+        emit((load ? 0x39400000u : 0x39000000u) | ((unsigned int)offset << 10) | (REG_PTR << 5) | rt);
+    } else {
+        /* Unscaled signed immediate: ldurb 0x38400000, sturb 0x38000000 */
+        emit((load ? 0x38400000u : 0x38000000u) | (((unsigned int)offset & 0x1FF) << 12) | (REG_PTR << 5) | rt);
+    }
+}
+
+/* mov wd, #value for any 32-bit value (movz + movk) */
+static void emit_mov32(unsigned int rd, unsigned int value) {
+    emit(0x52800000u | ((value & 0xFFFF) << 5) | rd);                 /* movz wd, #lo */
+    if ((value >> 16) != 0) {
+        emit(0x72A00000u | ((value >> 16) << 5) | rd);                /* movk wd, #hi, lsl 16 */
+    }
+}
+
+/* Call an absolute address: movz/movk x16, then blr x16 */
+static void emit_call(void* function) {
+    unsigned long address = (unsigned long)function;
+    emit(0xD2800000u | ((unsigned int)(address & 0xFFFF) << 5) | REG_X16);          /* movz */
+    emit(0xF2A00000u | ((unsigned int)((address >> 16) & 0xFFFF) << 5) | REG_X16);  /* movk lsl 16 */
+    emit(0xF2C00000u | ((unsigned int)((address >> 32) & 0xFFFF) << 5) | REG_X16);  /* movk lsl 32 */
+    emit(0xF2E00000u | ((unsigned int)((address >> 48) & 0xFFFF) << 5) | REG_X16);  /* movk lsl 48 */
+    emit(0xD63F0000u | (REG_X16 << 5));                                           /* blr x16 */
+}
+
+/* Keep x19 inside the window [x20, x21]. If it moved past x21, widen the
+ * window with bf_native_grow_last and clamp to the new edge (past x20
+ * likewise with bf_native_grow_first). */
+static void emit_window_check(int upward) {
+    unsigned int edge = upward ? REG_LAST : REG_FIRST;
+    unsigned int outside = upward ? COND_HI : COND_LO;
+    size_t skip;
+
+    emit(0xEB00001Fu | (edge << 16) | (REG_PTR << 5));             /* cmp x19, edge */
+    skip = jit_size;
+    emit(0);                                                        /* b.ls/b.hs done, patched below */
+
+    emit(0xAA1303E0u);                                              /* mov x0, x19 */
+    emit_call(upward ? (void*)bf_native_grow_last : (void*)bf_native_grow_first);
+    emit(0xAA0003E0u | edge);                                       /* mov edge, x0 */
+    emit(0xEB00001Fu | (edge << 16) | (REG_PTR << 5));             /* cmp x19, edge */
+    emit(0x9A800000u | (REG_PTR << 16) | (outside << 12) | (edge << 5) | REG_PTR);  /* csel x19, edge, x19, outside */
+
+    patch(skip, 0x54000000u | ((((unsigned int)(jit_size - skip) >> 2) & 0x7FFFF) << 5) |
+                (upward ? COND_LS : COND_HS));
+}
+
+/* x19 += distance, then keep x19 inside the window like '>' and '<' */
+static void emit_move(int distance) {
+    unsigned int magnitude = (distance < 0) ? (unsigned int)-distance : (unsigned int)distance;
+
+    if (magnitude < 4096) {
+        /* add/sub x19, x19, #magnitude */
+        emit((distance < 0 ? 0xD1000000u : 0x91000000u) | (magnitude << 10) | (REG_PTR << 5) | REG_PTR);
+    } else {
+        emit_mov32(REG_W9, magnitude);                  /* zero-extends into x9 */
+        /* add/sub x19, x19, x9 */
+        emit((distance < 0 ? 0xCB000000u : 0x8B000000u) | (REG_W9 << 16) | (REG_PTR << 5) | REG_PTR);
+    }
+    emit_window_check(distance > 0);
+}
+
+/* Point the branch that ends each FITS past the instructions it guards,
+ * once every instruction has its offset */
+static void patch_guards(const bf_program* program) {
+    for (size_t i = 0; i < program->length; i++) {
+        if (program->code[i].op == BF_OP_FITS) {
+            size_t branch = jit_insn_offset[i + 1] - 4;
+            size_t target = jit_insn_offset[program->code[i].arg + 1];
+            /* cbz w0, target */
+            patch(branch, 0x34000000u | ((((unsigned int)(target - branch) >> 2) & 0x7FFFF) << 5) | REG_X0);
+        }
+    }
+}
+
+/* Native code offset of IR instruction index in the code last emitted */
+size_t arch_jit_offset(size_t index) {
+    return jit_insn_offset[index];
+}
+
+/* Make freshly written code visible to instruction fetch: clean the data
+ * cache and invalidate the instruction cache to the point of unification */
+void arch_jit_sync(uint8_t* start, size_t size) {
+    unsigned long ctr;
+    unsigned long dline, iline, address;
+    unsigned long end = (unsigned long)start + size;
+
+    __asm__ volatile("mrs %0, ctr_el0" : "=r"(ctr));
+    dline = 4UL << ((ctr >> 16) & 0xF);
+    iline = 4UL << (ctr & 0xF);
+
+    for (address = (unsigned long)start & ~(dline - 1); address < end; address += dline) {
+        __asm__ volatile("dc cvau, %0" : : "r"(address) : "memory");
+    }
+    __asm__ volatile("dsb ish" : : : "memory");
+
+    for (address = (unsigned long)start & ~(iline - 1); address < end; address += iline) {
+        __asm__ volatile("ic ivau, %0" : : "r"(address) : "memory");
+    }
+    __asm__ volatile("dsb ish\n\tisb" : : : "memory");
+}
+
+/* Compile a program into code. Generated code is called as
+ *   uint8_t* entry(uint8_t* pointer, uint8_t* first, uint8_t* last)
+ * and returns the final tape pointer.
+ * Returns the number of bytes emitted, or 0 if the program does not fit. */
+size_t arch_jit_compile(const bf_program* program, uint8_t* code, size_t capacity) {
+    jit_code = code;
+    jit_size = 0;
+
+    if (capacity < 2 * JIT_MAX_INSN_BYTES) {
+        return 0;
+    }
+
+    /* Prologue: save frame and callee-saved registers, load the arguments */
+    emit(0xA9BD7BFDu);                  /* stp x29, x30, [sp, #-48]! */
+    emit(0x910003FDu);                  /* mov x29, sp */
+    emit(0xA90153F3u);                  /* stp x19, x20, [sp, #16] */
+    emit(0xF90013F5u);                  /* str x21, [sp, #32] */
+    emit(0xAA0003F3u);                  /* mov x19, x0 */
+    emit(0xAA0103F4u);                  /* mov x20, x1 */
+    emit(0xAA0203F5u);                  /* mov x21, x2 */
+
+    for (size_t i = 0; i < program->length; i++) {
+        const bf_insn* insn = &program->code[i];
+
+        if (jit_size + JIT_MAX_INSN_BYTES > capacity) {
+            return 0;
+        }
+        jit_insn_offset[i] = jit_size;
+
+        switch (insn->op) {
+            case BF_OP_ADD:
+                emit_cell_access(1, insn->offset, REG_W9);
+                emit(0x11000000u | (((unsigned int)insn->arg & 0xFF) << 10) | (REG_W9 << 5) | REG_W9);  /* add w9, w9, #arg */
+                emit_cell_access(0, insn->offset, REG_W9);
+                break;
+
+            case BF_OP_SET:
+                emit_mov32(REG_W9, (unsigned int)insn->arg & 0xFF);
+                emit_cell_access(0, insn->offset, REG_W9);
+                break;
+
+            case BF_OP_MOVE:
+                emit_move(insn->arg);
+                break;
+
+            case BF_OP_MULADD:
+                emit_cell_access(1, 0, REG_W9);
+                emit_cell_access(1, insn->offset, REG_W10);
+                if (((unsigned int)insn->arg & 0xFF) == 1) {
+                    emit(0x0B000000u | (REG_W9 << 16) | (REG_W10 << 5) | REG_W10);          /* add w10, w10, w9 */
+                } else if (((unsigned int)insn->arg & 0xFF) == 0xFF) {
+                    emit(0x4B000000u | (REG_W9 << 16) | (REG_W10 << 5) | REG_W10);          /* sub w10, w10, w9 */
+                } else {
+                    emit_mov32(REG_W11, (unsigned int)insn->arg & 0xFF);
+                    emit(0x1B000000u | (REG_W11 << 16) | (REG_W10 << 10) | (REG_W9 << 5) | REG_W10);  /* madd w10, w9, w11, w10 */
+                }
+                emit_cell_access(0, insn->offset, REG_W10);
+                break;
+
+            case BF_OP_SCAN:
+            case BF_OP_PRINT:
+            case BF_OP_DIVMOD:
+            case BF_OP_COMPARE:
+                emit(0xAA1303E0u);              /* mov x0, x19 */
+                emit_mov32(REG_X1, (unsigned int)insn->arg);
+                emit_call(bf_jit_helper(insn->op));
+                emit(0xAA0003F3u);              /* mov x19, x0 */
+                emit_window_check(insn->arg > 0);
+                break;
+
+            case BF_OP_FITS:
+                emit(0xAA1303E0u);              /* mov x0, x19 */
+                emit_mov32(REG_X1, (unsigned int)insn->offset);
+                emit_call((void*)bf_jit_fits);
+                emit(0);                        /* cbz w0, patched by patch_guards */
+                break;
+
+            case BF_OP_OUT:
+                emit_cell_access(1, insn->offset, REG_X0);
+                emit_call((void*)bf_putchar);
+                break;
+
+            case BF_OP_IN:
+                emit_call((void*)bf_getchar);
+                emit_cell_access(0, insn->offset, REG_X0);
+                break;
+
+            case BF_OP_JZ:
+                emit_cell_access(1, 0, REG_W9);
+                emit(0x34000000u | REG_W9);     /* cbz w9, patched at the JNZ */
+                break;
+
+            case BF_OP_JNZ: {
+                size_t open = (size_t)insn->arg;
+                size_t open_branch = jit_insn_offset[open] + 4;
+                size_t back = jit_insn_offset[open + 1];
+                emit_cell_access(1, 0, REG_W9);
+                /* cbnz w9, back past the JZ */
+                emit(0x35000000u | ((((unsigned int)(back - jit_size) >> 2) & 0x7FFFF) << 5) | REG_W9);
+                /* cbz w9, forward past this JNZ */
+                patch(open_branch, 0x34000000u | ((((unsigned int)(jit_size - open_branch) >> 2) & 0x7FFFF) << 5) | REG_W9);
+                break;
+            }
+
+            case BF_OP_END:
+            default:
+                emit(0xAA1303E0u);              /* mov x0, x19 */
+                emit(0xF94013F5u);              /* ldr x21, [sp, #32] */
+                emit(0xA94153F3u);              /* ldp x19, x20, [sp, #16] */
+                emit(0xA8C37BFDu);              /* ldp x29, x30, [sp], #48 */
+                emit(0xD65F03C0u);              /* ret */
+                patch_guards(program);
+                arch_jit_sync(code, jit_size);
+                return jit_size;
+        }
+    }
+
+    return 0;  /* No END instruction */
+}
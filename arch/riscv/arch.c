@@ -82,6 +82,173 @@ void arch_halt(void) {
     }
 }
 
+/* SIMD support */
+int arch_has_simd(void) {
+    return 0; /* No vector extension support */
+}
+
+/* Time - the time CSR, which counts at 10 MHz on the QEMU virt machine */
+#define RISCV_TIME_PER_US 10
+
+unsigned int arch_time_us(void) {
+#if __riscv_xlen == 64
+    unsigned long ticks;
+    __asm__ volatile("rdtime %0" : "=r"(ticks));
+    return (unsigned int)(ticks / RISCV_TIME_PER_US);
+#else
+    unsigned int low;
+    unsigned int high;
+    unsigned int again;
+    unsigned int upper;
+    unsigned int lower;
+
+    /* Reread if the low half carried into the high half in between */
+    do {
+        __asm__ volatile("rdtimeh %0" : "=r"(high));
+        __asm__ volatile("rdtime %0" : "=r"(low));
+        __asm__ volatile("rdtimeh %0" : "=r"(again));
+    } while (high != again);
+
+    /* Low 32 bits of high:low / 10, dividing 16 bits at a time so no
+     * step needs 64-bit division */
+    upper = ((high % RISCV_TIME_PER_US) << 16) | (low >> 16);
+    lower = ((upper % RISCV_TIME_PER_US) << 16) | (low & 0xFFFF);
+    return ((upper / RISCV_TIME_PER_US) << 16) + lower / RISCV_TIME_PER_US;
+#endif
+}
+
+/* Sampling timer - the CLINT's machine timer for hart 0 on the QEMU virt
+ * machine, taken in machine mode through mtvec. The kernel otherwise
+ * runs with interrupts off. */
+#define CLINT_MTIMECMP 0x02004000UL
+#define CLINT_MTIME    0x0200BFF8UL
+#define MIE_MTIE 0x80
+#define MCAUSE_MACHINE_TIMER 7
+
+#if __riscv_xlen == 64
+#define TRAP_STORE "sd"
+#define TRAP_LOAD  "ld"
+#define TRAP_WORD  "8"
+#else
+#define TRAP_STORE "sw"
+#define TRAP_LOAD  "lw"
+#define TRAP_WORD  "4"
+#endif
+
+static arch_sample_handler sample_handler;
+static unsigned long long sample_interval;  /* mtime ticks between samples */
+
+/* Schedule the next timer interrupt interval ticks from now */
+static void timer_arm(void) {
+    volatile uint32_t* mtime = (volatile uint32_t*)CLINT_MTIME;
+    volatile uint32_t* mtimecmp = (volatile uint32_t*)CLINT_MTIMECMP;
+    unsigned long long next;
+    uint32_t high;
+    uint32_t low;
+
+    /* Reread if the low half carried into the high half in between */
+    do {
+        high = mtime[1];
+        low = mtime[0];
+    } while (high != mtime[1]);
+    next = (((unsigned long long)high << 32) | low) + sample_interval;
+
+    /* Park the high half first so no intermediate value fires early */
+    mtimecmp[1] = 0xFFFFFFFF;
+    mtimecmp[0] = (uint32_t)next;
+    mtimecmp[1] = (uint32_t)(next >> 32);
+}
+
+/* Called from trap_entry with the interrupted pc and the trap cause */
+static void __attribute__((used)) trap_tick(unsigned long pc, unsigned long cause) {
+    if ((long)cause >= 0 || (cause & 0xFF) != MCAUSE_MACHINE_TIMER) {
+        arch_halt();  /* Exceptions have no handler */
+    }
+    timer_arm();
+    sample_handler(pc);
+}
+
+/* Trap entry: save the registers C may clobber, pass mepc and mcause to
+ * trap_tick and return to the interrupted code */
+__asm__(
+    ".text\n"
+    ".balign 4\n"
+    "trap_entry:\n"
+    "    addi sp, sp, -16*" TRAP_WORD "\n"
+    "    " TRAP_STORE " ra, 0*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " t0, 1*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " t1, 2*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " t2, 3*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " t3, 4*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " t4, 5*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " t5, 6*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " t6, 7*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " a0, 8*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " a1, 9*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " a2, 10*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " a3, 11*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " a4, 12*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " a5, 13*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " a6, 14*" TRAP_WORD "(sp)\n"
+    "    " TRAP_STORE " a7, 15*" TRAP_WORD "(sp)\n"
+    "    csrr a0, mepc\n"
+    "    csrr a1, mcause\n"
+    "    call trap_tick\n"
+    "    " TRAP_LOAD " ra, 0*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " t0, 1*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " t1, 2*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " t2, 3*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " t3, 4*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " t4, 5*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " t5, 6*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " t6, 7*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " a0, 8*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " a1, 9*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " a2, 10*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " a3, 11*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " a4, 12*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " a5, 13*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " a6, 14*" TRAP_WORD "(sp)\n"
+    "    " TRAP_LOAD " a7, 15*" TRAP_WORD "(sp)\n"
+    "    addi sp, sp, 16*" TRAP_WORD "\n"
+    "    mret\n");
+
+extern char trap_entry[];
+
+int arch_sample_start(unsigned int hz, arch_sample_handler handler) {
+    if (hz == 0 || hz > RISCV_TIME_PER_US * 1000000) {
+        return -1;
+    }
+    sample_handler = handler;
+    sample_interval = RISCV_TIME_PER_US * 1000000 / hz;
+
+    __asm__ volatile("csrw mtvec, %0" : : "r"(trap_entry));  /* Direct mode */
+    timer_arm();
+    __asm__ volatile("csrs mie, %0" : : "r"(MIE_MTIE));
+    arch_enable_interrupts();
+    return 0;
+}
+
+void arch_sample_stop(void) {
+    arch_disable_interrupts();
+    __asm__ volatile("csrc mie, %0" : : "r"(MIE_MTIE));
+}
+
+/* Symmetric multiprocessing - not implemented for RISC-V: only the boot
+ * CPU runs */
+int arch_smp_start(arch_cpu_entry entry) {
+    (void)entry;
+    return 1;
+}
+
+unsigned int arch_cpu_index(void) {
+    return 0;
+}
+
+void arch_cpu_relax(void) {
+    __asm__ volatile("nop");
+}
+
 /* Boot information */
 boot_info_t* arch_get_boot_info(void) {
     return &boot_info;
@@ -106,4 +273,3 @@ char arch_input_read(void) {
     extern char uart_read_char(void);
     return uart_read_char();
 }
-
@@ -0,0 +1,321 @@
+/* RISC-V Brainfuck JIT Backend
+ * Emits RV64IM machine code for a compiled Brainfuck program.
+ *
+ * Register use inside generated code:
+ *   s1 - tape pointer (address of the current cell)
+ *   s2 - first cell of the dirty window
+ *   s3 - last cell of the dirty window
+ *   t0-t2 - scratch
+ * s1-s3 are callee-saved, so they survive runtime helper calls.
+ */
+
+#include "../../kernel.h"
+#include "../../bf.h"
+
+/* Worst-case bytes emitted for one IR instruction */
+#define JIT_MAX_INSN_BYTES 128
+
+/* Register numbers */
+#define REG_ZERO 0
+#define REG_RA   1
+#define REG_SP   2
+#define REG_T0   5
+#define REG_T1   6
+#define REG_T2   7
+#define REG_PTR  9
+#define REG_A0   10
+#define REG_A1   11
+#define REG_A2   12
+#define REG_FIRST 18
+#define REG_LAST 19
+
+/* Instruction formats */
+#define RV_R(f7, rs2, rs1, f3, rd, op) \
+    (((unsigned int)(f7) << 25) | ((unsigned int)(rs2) << 20) | ((unsigned int)(rs1) << 15) | \
+     ((unsigned int)(f3) << 12) | ((unsigned int)(rd) << 7) | (op))
+#define RV_I(imm, rs1, f3, rd, op) \
+    ((((unsigned int)(imm) & 0xFFF) << 20) | ((unsigned int)(rs1) << 15) | \
+     ((unsigned int)(f3) << 12) | ((unsigned int)(rd) << 7) | (op))
+#define RV_S(imm, rs2, rs1, f3, op) \
+    (((((unsigned int)(imm) >> 5) & 0x7F) << 25) | ((unsigned int)(rs2) << 20) | \
+     ((unsigned int)(rs1) << 15) | ((unsigned int)(f3) << 12) | (((unsigned int)(imm) & 0x1F) << 7) | (op))
+
+/* Opcodes used */
+#define OP_LOAD   0x03
+#define OP_IMM    0x13
+#define OP_IMM32  0x1B
+#define OP_STORE  0x23
+#define OP_REG    0x33
+#define OP_LUI    0x37
+#define OP_BRANCH 0x63
+#define OP_JALR   0x67
+#define OP_JAL    0x6F
+
+/* Native code offset of each IR instruction */
+static size_t jit_insn_offset[BF_MAX_INSNS];
+
+/* Output buffer state */
+static uint8_t* jit_code;
+static size_t jit_size;
+
+/* Append one 32-bit instruction (little-endian) */
+static void emit(unsigned int insn) {
+    jit_code[jit_size++] = (uint8_t)insn;
+    jit_code[jit_size++] = (uint8_t)(insn >> 8);
+    jit_code[jit_size++] = (uint8_t)(insn >> 16);
+    jit_code[jit_size++] = (uint8_t)(insn >> 24);
+}
+
+/* Overwrite the instruction at a code offset */
+static void patch(size_t at, unsigned int insn) {
+    jit_code[at] = (uint8_t)insn;
+    jit_code[at + 1] = (uint8_t)(insn >> 8);
+    jit_code[at + 2] = (uint8_t)(insn >> 16);
+    jit_code[at + 3] = (uint8_t)(insn >> 24);
+}
+
+/* jal zero, distance (bytes, +-1MB) */
+static unsigned int rv_jump(int distance) {
+    unsigned int imm = (unsigned int)distance;
+    return (((imm >> 20) & 1) << 31) | (((imm >> 1) & 0x3FF) << 21) |
+           (((imm >> 11) & 1) << 20) | (((imm >> 12) & 0xFF) << 12) | (REG_ZERO << 7) | OP_JAL;
+}
+
+/* b<f3> rs1, rs2, distance (bytes, +-4KB) */
+static unsigned int rv_branch(unsigned int f3, unsigned int rs1, unsigned int rs2, int distance) {
+    unsigned int imm = (unsigned int)distance;
+    return (((imm >> 12) & 1) << 31) | (((imm >> 5) & 0x3F) << 25) | (rs2 << 20) | (rs1 << 15) |
+           (f3 << 12) | (((imm >> 1) & 0xF) << 8) | (((imm >> 11) & 1) << 7) | OP_BRANCH;
+}
+
+/* Branch over the next instruction: b<f3> rs1, rs2, +8 */
+static void emit_skip(unsigned int f3, unsigned int rs1, unsigned int rs2) {
+    emit(rv_branch(f3, rs1, rs2, 8));
+}
+
+/* li rd, value for any 64-bit value (lui/addiw, then shift-and-add) */
+static void emit_li(unsigned int rd, long value) {
+    long low = ((value & 0xFFF) ^ 0x800) - 0x800;  /* Sign-extended low 12 bits */
+
+    if (value >= -2048 && value < 2048) {
+        emit(RV_I(value, REG_ZERO, 0, rd, OP_IMM));                 /* addi rd, zero, value */
+    } else if (value == (long)(int)value) {
+        emit((((unsigned int)((value + 0x800) >> 12) & 0xFFFFF) << 12) | (rd << 7) | OP_LUI);
+        if (low != 0) {
+            emit(RV_I(low, rd, 0, rd, OP_IMM32));                   /* addiw rd, rd, low */
+        }
+    } else {
+        emit_li(rd, (value - low) >> 12);
+        emit(RV_I(12, rd, 1, rd, OP_IMM));                          /* slli rd, rd, 12 */
+        if (low != 0) {
+            emit(RV_I(low, rd, 0, rd, OP_IMM));                     /* addi rd, rd, low */
+        }
+    }
+}
+
+/* Call an absolute address through t0 */
+static void emit_call(void* function) {
+    emit_li(REG_T0, (long)function);
+    emit(RV_I(0, REG_T0, 0, REG_RA, OP_JALR));                      /* jalr ra, 0(t0) */
+}
+
+/* lbu/sb on the cell at s1 + offset - offsets stay within the tape guard */
+static void emit_load_cell(unsigned int rd, int offset) {
+    emit(RV_I(offset, REG_PTR, 4, rd, OP_LOAD));                    /* lbu rd, offset(s1) */
+}
+
+static void emit_store_cell(unsigned int rs, int offset) {
+    emit(RV_S(offset, rs, REG_PTR, 0, OP_STORE));                   /* sb rs, offset(s1) */
+}
+
+/* Keep s1 inside the window [s2, s3]. If it moved past s3, widen the
+ * window with bf_native_grow_last and clamp to the new edge (past s2
+ * likewise with bf_native_grow_first). */
+static void emit_window_check(int upward) {
+    unsigned int edge = upward ? REG_LAST : REG_FIRST;
+    size_t skip = jit_size;
+
+    emit(0);                                                        /* bgeu done, patched below */
+    emit(RV_I(0, REG_PTR, 0, REG_A0, OP_IMM));                      /* mv a0, s1 */
+    emit_call(upward ? (void*)bf_native_grow_last : (void*)bf_native_grow_first);
+    emit(RV_I(0, REG_A0, 0, edge, OP_IMM));                         /* mv edge, a0 */
+    if (upward) {
+        emit_skip(7, REG_LAST, REG_PTR);                            /* bgeu s3, s1, +8 */
+    } else {
+        emit_skip(7, REG_PTR, REG_FIRST);                           /* bgeu s1, s2, +8 */
+    }
+    emit(RV_I(0, edge, 0, REG_PTR, OP_IMM));                        /* mv s1, edge */
+
+    if (upward) {
+        patch(skip, rv_branch(7, REG_LAST, REG_PTR, (int)(jit_size - skip)));   /* bgeu s3, s1, done */
+    } else {
+        patch(skip, rv_branch(7, REG_PTR, REG_FIRST, (int)(jit_size - skip))); /* bgeu s1, s2, done */
+    }
+}
+
+/* s1 += distance, then keep s1 inside the window like '>' and '<' */
+static void emit_move(int distance) {
+    if (distance >= -2048 && distance < 2048) {
+        emit(RV_I(distance, REG_PTR, 0, REG_PTR, OP_IMM));          /* addi s1, s1, distance */
+    } else {
+        emit_li(REG_T0, distance);
+        emit(RV_R(0, REG_T0, REG_PTR, 0, REG_PTR, OP_REG));         /* add s1, s1, t0 */
+    }
+    emit_window_check(distance > 0);
+}
+
+/* Point the jump that ends each FITS past the instructions it guards,
+ * once every instruction has its offset */
+static void patch_guards(const bf_program* program) {
+    for (size_t i = 0; i < program->length; i++) {
+        if (program->code[i].op == BF_OP_FITS) {
+            size_t jump = jit_insn_offset[i + 1] - 4;
+            size_t target = jit_insn_offset[program->code[i].arg + 1];
+            patch(jump, rv_jump((int)target - (int)jump));
+        }
+    }
+}
+
+/* Native code offset of IR instruction index in the code last emitted */
+size_t arch_jit_offset(size_t index) {
+    return jit_insn_offset[index];
+}
+
+/* Order stores to the code buffer before later instruction fetches */
+void arch_jit_sync(uint8_t* code, size_t size) {
+    (void)code;
+    (void)size;
+    __asm__ volatile("fence.i" : : : "memory");
+}
+
+/* Compile a program into code. Generated code is called as
+ *   uint8_t* entry(uint8_t* pointer, uint8_t* first, uint8_t* last)
+ * and returns the final tape pointer.
+ * Returns the number of bytes emitted, or 0 if the program does not fit. */
+size_t arch_jit_compile(const bf_program* program, uint8_t* code, size_t capacity) {
+#if __riscv_xlen != 64
+    (void)program;
+    (void)code;
+    (void)capacity;
+    return 0;  /* Only RV64 code generation is implemented */
+#else
+    jit_code = code;
+    jit_size = 0;
+
+    if (capacity < 2 * JIT_MAX_INSN_BYTES) {
+        return 0;
+    }
+
+    /* Prologue: save ra and callee-saved registers, load the arguments */
+    emit(RV_I(-32, REG_SP, 0, REG_SP, OP_IMM));                     /* addi sp, sp, -32 */
+    emit(RV_S(24, REG_RA, REG_SP, 3, OP_STORE));                    /* sd ra, 24(sp) */
+    emit(RV_S(16, REG_PTR, REG_SP, 3, OP_STORE));                   /* sd s1, 16(sp) */
+    emit(RV_S(8, REG_FIRST, REG_SP, 3, OP_STORE));                  /* sd s2, 8(sp) */
+    emit(RV_S(0, REG_LAST, REG_SP, 3, OP_STORE));                   /* sd s3, 0(sp) */
+    emit(RV_I(0, REG_A0, 0, REG_PTR, OP_IMM));                      /* mv s1, a0 */
+    emit(RV_I(0, REG_A1, 0, REG_FIRST, OP_IMM));                    /* mv s2, a1 */
+    emit(RV_I(0, REG_A2, 0, REG_LAST, OP_IMM));                     /* mv s3, a2 */
+
+    for (size_t i = 0; i < program->length; i++) {
+        const bf_insn* insn = &program->code[i];
+
+        if (jit_size + JIT_MAX_INSN_BYTES > capacity) {
+            return 0;
+        }
+        jit_insn_offset[i] = jit_size;
+
+        switch (insn->op) {
+            case BF_OP_ADD:
+                emit_load_cell(REG_T0, insn->offset);
+                emit(RV_I((uint8_t)insn->arg, REG_T0, 0, REG_T0, OP_IMM));  /* addi t0, t0, arg */
+                emit_store_cell(REG_T0, insn->offset);
+                break;
+
+            case BF_OP_SET:
+                emit(RV_I((uint8_t)insn->arg, REG_ZERO, 0, REG_T0, OP_IMM));  /* li t0, arg */
+                emit_store_cell(REG_T0, insn->offset);
+                break;
+
+            case BF_OP_MOVE:
+                emit_move(insn->arg);
+                break;
+
+            case BF_OP_MULADD:
+                emit_load_cell(REG_T0, 0);
+                emit_load_cell(REG_T1, insn->offset);
+                if ((uint8_t)insn->arg == 0xFF) {
+                    emit(RV_R(0x20, REG_T0, REG_T1, 0, REG_T1, OP_REG));  /* sub t1, t1, t0 */
+                } else {
+                    if ((uint8_t)insn->arg != 1) {
+                        emit(RV_I((uint8_t)insn->arg, REG_ZERO, 0, REG_T2, OP_IMM));  /* li t2, arg */
+                        emit(RV_R(1, REG_T2, REG_T0, 0, REG_T0, OP_REG));  /* mul t0, t0, t2 */
+                    }
+                    emit(RV_R(0, REG_T0, REG_T1, 0, REG_T1, OP_REG));  /* add t1, t1, t0 */
+                }
+                emit_store_cell(REG_T1, insn->offset);
+                break;
+
+            case BF_OP_SCAN:
+            case BF_OP_PRINT:
+            case BF_OP_DIVMOD:
+            case BF_OP_COMPARE:
+                emit(RV_I(0, REG_PTR, 0, REG_A0, OP_IMM));          /* mv a0, s1 */
+                emit_li(REG_A1, insn->arg);
+                emit_call(bf_jit_helper(insn->op));
+                emit(RV_I(0, REG_A0, 0, REG_PTR, OP_IMM));          /* mv s1, a0 */
+                emit_window_check(insn->arg > 0);
+                break;
+
+            case BF_OP_FITS:
+                emit(RV_I(0, REG_PTR, 0, REG_A0, OP_IMM));          /* mv a0, s1 */
+                emit_li(REG_A1, insn->offset);
+                emit_call((void*)bf_jit_fits);
+                emit_skip(1, REG_A0, REG_ZERO);                     /* bnez a0, +8 */
+                emit(rv_jump(0));                                   /* j, patched by patch_guards */
+                break;
+
+            case BF_OP_OUT:
+                emit_load_cell(REG_A0, insn->offset);
+                emit_call((void*)bf_putchar);
+                break;
+
+            case BF_OP_IN:
+                emit_call((void*)bf_getchar);
+                emit_store_cell(REG_A0, insn->offset);
+                break;
+
+            case BF_OP_JZ:
+                emit_load_cell(REG_T0, 0);
+                emit_skip(1, REG_T0, REG_ZERO);                     /* bnez t0, +8 */
+                emit(rv_jump(0));                                   /* j, patched at the JNZ */
+                break;
+
+            case BF_OP_JNZ: {
+                size_t open = (size_t)insn->arg;
+                size_t open_jump = jit_insn_offset[open] + 8;
+                size_t back = jit_insn_offset[open + 1];
+                emit_load_cell(REG_T0, 0);
+                emit_skip(0, REG_T0, REG_ZERO);                     /* beqz t0, +8 */
+                emit(rv_jump((int)back - (int)jit_size));           /* j back past the JZ */
+                patch(open_jump, rv_jump((int)jit_size - (int)open_jump));
+                break;
+            }
+
+            case BF_OP_END:
+            default:
+                emit(RV_I(0, REG_PTR, 0, REG_A0, OP_IMM));          /* mv a0, s1 */
+                emit(RV_I(24, REG_SP, 3, REG_RA, OP_LOAD));         /* ld ra, 24(sp) */
+                emit(RV_I(16, REG_SP, 3, REG_PTR, OP_LOAD));        /* ld s1, 16(sp) */
+                emit(RV_I(8, REG_SP, 3, REG_FIRST, OP_LOAD));       /* ld s2, 8(sp) */
+                emit(RV_I(0, REG_SP, 3, REG_LAST, OP_LOAD));        /* ld s3, 0(sp) */
+                emit(RV_I(32, REG_SP, 0, REG_SP, OP_IMM));          /* addi sp, sp, 32 */
+                emit(RV_I(0, REG_RA, 0, REG_ZERO, OP_JALR));        /* ret */
+                patch_guards(program);
+                arch_jit_sync(code, jit_size);
+                return jit_size;
+        }
+    }
+
+    return 0;  /* No END instruction */
+#endif
+}
@@ -2,14 +2,33 @@
 
 #include "../../arch.h"
 #include "../../kernel.h"
+#include "../../bf.h"
 
 static display_info_t display_info;
 static boot_info_t boot_info;
+static int simd_enabled = 0;
+
+/* Enable SSE if the CPU supports SSE2 (CPUID.1:EDX bit 26) */
+static void enable_sse(void) {
+    uint32_t eax = 1, ebx, ecx, edx;
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (edx & (1 << 26)) {
+        uint32_t cr0, cr4;
+        __asm__ volatile("mov %%cr0, %0" : "=r"(cr0));
+        cr0 &= ~(1 << 2);  /* Clear EM: no x87 emulation */
+        cr0 |= (1 << 1);   /* Set MP: monitor coprocessor */
+        __asm__ volatile("mov %0, %%cr0" : : "r"(cr0));
+        __asm__ volatile("mov %%cr4, %0" : "=r"(cr4));
+        cr4 |= (1 << 9) | (1 << 10);  /* OSFXSR | OSXMMEXCPT */
+        __asm__ volatile("mov %0, %%cr4" : : "r"(cr4));
+        simd_enabled = 1;
+    }
+}
 
 /* Early architecture initialization (before C runtime) */
 void arch_early_init(void) {
     /* Stack is already set up by boot.asm */
-    /* Nothing else needed for x86_32 */
+    enable_sse();
 }
 
 /* Architecture initialization */
@@ -78,6 +97,386 @@ void arch_halt(void) {
     }
 }
 
+/* SIMD support */
+int arch_has_simd(void) {
+    return simd_enabled; /* SSE2, enabled by arch_early_init */
+}
+
+/* Time stamp counter ticks per microsecond, measured on first use */
+static unsigned int tsc_per_us = 0;
+
+static unsigned long long read_tsc(void) {
+    unsigned int low, high;
+    __asm__ volatile("rdtsc" : "=a"(low), "=d"(high));
+    return ((unsigned long long)high << 32) | low;
+}
+
+/* Count TSC ticks over 10 ms of PIT channel 2: 11932 ticks of its
+ * 1193182 Hz clock in one-shot mode, gated and read through port 0x61 */
+static void calibrate_tsc(void) {
+    unsigned long long start;
+
+    arch_outb(0x61, (uint8_t)((arch_inb(0x61) & ~0x02) | 0x01));  /* Gate on, speaker off */
+    arch_outb(0x43, 0xB0);  /* Channel 2, low then high byte, mode 0 */
+    arch_outb(0x42, 11932 & 0xFF);
+    arch_outb(0x42, 11932 >> 8);
+    start = read_tsc();
+    while ((arch_inb(0x61) & 0x20) == 0) {
+        /* Output goes high when the count runs out */
+    }
+    tsc_per_us = (unsigned int)(read_tsc() - start) / 10000;
+    if (tsc_per_us == 0) {
+        tsc_per_us = 1;
+    }
+}
+
+/* Time */
+unsigned int arch_time_us(void) {
+    unsigned long long now;
+    unsigned int high;
+    unsigned int quotient;
+    unsigned int rest;
+
+    if (tsc_per_us == 0) {
+        calibrate_tsc();
+    }
+    now = read_tsc();
+
+    /* Low 32 bits of now / tsc_per_us. divl faults unless the high half
+     * is below the divisor, and only its remainder affects the result. */
+    high = (unsigned int)(now >> 32) % tsc_per_us;
+    __asm__("divl %4" : "=a"(quotient), "=d"(rest) : "0"((unsigned int)now), "1"(high), "rm"(tsc_per_us));
+    (void)rest;
+    return quotient;
+}
+
+/* Sampling timer - PIT channel 0 on IRQ0, through the 8259 PICs remapped
+ * to vectors 0x20-0x2F. The kernel otherwise runs with interrupts off
+ * and polls its devices, so only IRQ0 is ever unmasked. */
+#define PIT_HZ 1193182
+#define TIMER_VECTOR 0x20
+#define EXCEPTION_VECTORS 32  /* CPU exceptions, 0x00-0x1F */
+#define PIC_VECTORS 16        /* IRQ0-15 at TIMER_VECTOR onwards */
+#define LAPIC_SPURIOUS_VECTOR 0xFF  /* See lapic_enable */
+
+/* Flat code and data segments. Multiboot leaves GDTR unspecified, so the
+ * interrupt gates need a GDT of our own to name their code segment. */
+#define KERNEL_CS 0x08
+#define KERNEL_DS 0x10
+
+static const unsigned long long gdt[3] __attribute__((aligned(8))) = {
+    0,
+    0x00CF9A000000FFFFULL,  /* 0x08: code, base 0, limit 4 GB */
+    0x00CF92000000FFFFULL,  /* 0x10: data, base 0, limit 4 GB */
+};
+
+typedef struct {
+    uint16_t offset_low;
+    uint16_t selector;
+    uint8_t zero;
+    uint8_t type;
+    uint16_t offset_high;
+} __attribute__((packed)) idt_gate;
+
+typedef struct {
+    uint16_t limit;
+    uint32_t base;
+} __attribute__((packed)) table_pointer;
+
+static idt_gate idt[256] __attribute__((aligned(8)));
+static int interrupts_ready = 0;
+static arch_sample_handler sample_handler;
+
+/* Called from timer_entry with the interrupted eip */
+static void __attribute__((used)) timer_tick(unsigned long pc) {
+    sample_handler(pc);
+}
+
+/* Called from the exception entries with the vector: nothing can be
+ * resumed, so report it and stop */
+static void __attribute__((used)) exception_report(unsigned int vector) {
+    terminal_writestring("\n[CPU] Exception 0x");
+    terminal_putchar("0123456789ABCDEF"[vector >> 4]);
+    terminal_putchar("0123456789ABCDEF"[vector & 15]);
+    terminal_writestring(", halting\n");
+    arch_halt();
+}
+
+/* Interrupt entry points: save the registers C may clobber, hand the
+ * interrupted eip to timer_tick and acknowledge the PIC. Spurious IRQ7s
+ * must not be acknowledged. */
+__asm__(
+    ".text\n"
+    ".align 16\n"
+    "timer_entry:\n"
+    "    pushal\n"
+    "    cld\n"
+    "    pushl 32(%esp)\n"      /* eip, above the eight saved registers */
+    "    call timer_tick\n"
+    "    addl $4, %esp\n"
+    "    movb $0x20, %al\n"     /* End of interrupt */
+    "    outb %al, $0x20\n"
+    "    popal\n"
+    "    iret\n"
+    ".align 16\n"
+    "spurious_entry:\n"
+    "    iret\n"
+    ".align 16\n"                 /* One 8-byte stub per exception vector */
+    "exception_entries:\n"
+    ".set vector, 0\n"
+    ".rept 32\n"
+    ".align 8\n"
+    "    pushl $vector\n"
+    "    jmp exception_common\n"
+    ".set vector, vector + 1\n"
+    ".endr\n"
+    "exception_common:\n"
+    "    cld\n"
+    "    call exception_report\n");
+
+extern void timer_entry(void);
+extern void spurious_entry(void);
+extern char exception_entries[];
+
+static void set_gate(uint8_t vector, void (*entry)(void)) {
+    uint32_t address = (uint32_t)(unsigned long)entry;
+    idt[vector].offset_low = (uint16_t)address;
+    idt[vector].selector = KERNEL_CS;
+    idt[vector].zero = 0;
+    idt[vector].type = 0x8E;  /* Present, ring 0, 32-bit interrupt gate */
+    idt[vector].offset_high = (uint16_t)(address >> 16);
+}
+
+/* Load the GDT and IDT and remap the PICs with every IRQ masked */
+static void interrupts_init(void) {
+    table_pointer gdtr = { sizeof(gdt) - 1, (uint32_t)(unsigned long)gdt };
+    table_pointer idtr = { sizeof(idt) - 1, (uint32_t)(unsigned long)idt };
+
+    __asm__ volatile("lgdt %0\n\t"
+                     "ljmp %1, $1f\n"
+                     "1:\n\t"
+                     "mov %2, %%ax\n\t"
+                     "mov %%ax, %%ds\n\t"
+                     "mov %%ax, %%es\n\t"
+                     "mov %%ax, %%fs\n\t"
+                     "mov %%ax, %%gs\n\t"
+                     "mov %%ax, %%ss"
+                     : : "m"(gdtr), "i"(KERNEL_CS), "i"(KERNEL_DS) : "eax", "memory");
+
+    /* Every vector that can be raised gets a gate: exceptions stop the
+     * machine with a report, and IRQs other than the timer's can only be
+     * spurious (the rest are masked), like the IRQ7 the master PIC raises
+     * for lost interrupts */
+    for (unsigned int vector = 0; vector < EXCEPTION_VECTORS; vector++) {
+        set_gate((uint8_t)vector, (void (*)(void))(exception_entries + 8 * vector));
+    }
+    for (unsigned int vector = TIMER_VECTOR; vector < TIMER_VECTOR + PIC_VECTORS; vector++) {
+        set_gate((uint8_t)vector, spurious_entry);
+    }
+    set_gate(LAPIC_SPURIOUS_VECTOR, spurious_entry);
+    set_gate(TIMER_VECTOR, timer_entry);
+    __asm__ volatile("lidt %0" : : "m"(idtr));
+
+    arch_outb(0x20, 0x11);  /* ICW1: initialize, ICW4 follows */
+    arch_outb(0xA0, 0x11);
+    arch_outb(0x21, 0x20);  /* ICW2: vector bases */
+    arch_outb(0xA1, 0x28);
+    arch_outb(0x21, 0x04);  /* ICW3: slave on IRQ2 */
+    arch_outb(0xA1, 0x02);
+    arch_outb(0x21, 0x01);  /* ICW4: 8086 mode */
+    arch_outb(0xA1, 0x01);
+    arch_outb(0x21, 0xFF);  /* Mask everything */
+    arch_outb(0xA1, 0xFF);
+    interrupts_ready = 1;
+}
+
+int arch_sample_start(unsigned int hz, arch_sample_handler handler) {
+    unsigned int divisor = PIT_HZ / hz;
+
+    if (!interrupts_ready) {
+        interrupts_init();
+    }
+    if (divisor == 0 || divisor > 0xFFFF) {
+        return -1;
+    }
+    sample_handler = handler;
+
+    arch_outb(0x43, 0x34);  /* Channel 0, low then high byte, rate generator */
+    arch_outb(0x40, (uint8_t)divisor);
+    arch_outb(0x40, (uint8_t)(divisor >> 8));
+    arch_outb(0x21, 0xFE);  /* Unmask IRQ0 only */
+    arch_enable_interrupts();
+    return 0;
+}
+
+void arch_sample_stop(void) {
+    arch_disable_interrupts();
+    arch_outb(0x21, 0xFF);
+}
+
+/* Symmetric multiprocessing - the boot CPU wakes the others with an
+ * INIT-SIPI-SIPI broadcast through its local APIC. The SIPI starts them
+ * in real mode at AP_TRAMPOLINE, where a copy of ap_trampoline switches
+ * to protected mode on the kernel GDT, takes a stack and calls ap_main. */
+#define LAPIC_BASE 0xFEE00000
+#define LAPIC_ID 0x20
+#define LAPIC_SVR 0xF0
+#define LAPIC_ICR_LOW 0x300
+#define LAPIC_ICR_HIGH 0x310
+#define ICR_INIT_ALL 0x000C4500  /* INIT, assert, to all but self */
+#define ICR_SIPI_ALL 0x000C4600  /* Startup, to all but self; low byte is the page */
+#define ICR_PENDING 0x1000
+#define AP_TRAMPOLINE 0x8000     /* Page below 1 MB that the SIPI names */
+#define AP_STACK_SIZE 16384
+
+/* Real-mode entry of the other CPUs, copied to AP_TRAMPOLINE: its own
+ * addresses are taken relative to that copy, and it calls out through
+ * absolute addresses. ap_next hands out CPU indices and stacks. */
+__asm__(
+    ".text\n"
+    ".align 16\n"
+    ".code16\n"
+    "ap_trampoline:\n"
+    "    cli\n"
+    "    cld\n"
+    "    xorw %ax, %ax\n"
+    "    movw %ax, %ds\n"
+    "    lgdtl 0x8000 + ap_gdtr - ap_trampoline\n"
+    "    movl %cr0, %eax\n"
+    "    orl $1, %eax\n"            /* Protection enable */
+    "    movl %eax, %cr0\n"
+    "    ljmpl $0x08, $0x8000 + ap_protected - ap_trampoline\n"
+    ".code32\n"
+    "ap_protected:\n"
+    "    movw $0x10, %ax\n"
+    "    movw %ax, %ds\n"
+    "    movw %ax, %es\n"
+    "    movw %ax, %fs\n"
+    "    movw %ax, %gs\n"
+    "    movw %ax, %ss\n"
+    "    movl $1, %eax\n"
+    "    lock xaddl %eax, ap_next\n"
+    "    cmpl $7, %eax\n"           /* ARCH_MAX_CPUS - 1 stacks */
+    "    jae 2f\n"
+    "    incl %eax\n"               /* CPU index */
+    "    movl %eax, %ecx\n"
+    "    shll $14, %ecx\n"          /* index * AP_STACK_SIZE: the top of stack index - 1 */
+    "    leal ap_stacks(%ecx), %esp\n"
+    "    pushl %eax\n"
+    "    movl $ap_main, %eax\n"
+    "    call *%eax\n"
+    "2:\n"
+    "    cli\n"
+    "    hlt\n"
+    "    jmp 2b\n"
+    ".align 8\n"
+    "ap_gdtr:\n"
+    "    .word 0\n"                 /* Filled in by arch_smp_start */
+    "    .long 0\n"
+    "ap_trampoline_end:\n");
+
+extern const uint8_t ap_trampoline[];
+extern uint8_t ap_gdtr[];
+extern const uint8_t ap_trampoline_end[];
+
+static uint8_t __attribute__((used, aligned(16))) ap_stacks[ARCH_MAX_CPUS - 1][AP_STACK_SIZE];
+static volatile unsigned int __attribute__((used)) ap_next = 0;
+static volatile unsigned int cpus_running = 1;
+static arch_cpu_entry cpu_entry;
+static int smp_started = 0;
+
+/* CPU index of each local APIC id */
+static uint8_t cpu_of_apic[256];
+
+static inline uint32_t lapic_read(unsigned int reg) {
+    return *(volatile uint32_t*)(LAPIC_BASE + reg);
+}
+
+static inline void lapic_write(unsigned int reg, uint32_t value) {
+    *(volatile uint32_t*)(LAPIC_BASE + reg) = value;
+}
+
+/* Software-enable the local APIC, spurious vector 0xFF */
+static void lapic_enable(void) {
+    lapic_write(LAPIC_SVR, lapic_read(LAPIC_SVR) | 0x1FF);
+}
+
+static void lapic_send(uint32_t command) {
+    lapic_write(LAPIC_ICR_HIGH, 0);
+    lapic_write(LAPIC_ICR_LOW, command);
+    while (lapic_read(LAPIC_ICR_LOW) & ICR_PENDING) {
+        arch_cpu_relax();
+    }
+}
+
+static void delay_us(unsigned int us) {
+    unsigned int start = arch_time_us();
+    while (arch_time_us() - start < us) {
+        arch_cpu_relax();
+    }
+}
+
+/* C entry of the other CPUs, on their own stack */
+static void __attribute__((used)) ap_main(unsigned int cpu) {
+    enable_sse();
+    lapic_enable();
+    cpu_of_apic[lapic_read(LAPIC_ID) >> 24] = (uint8_t)cpu;
+    __atomic_add_fetch(&cpus_running, 1, __ATOMIC_RELEASE);
+    cpu_entry(cpu);
+    arch_halt();
+}
+
+int arch_smp_start(arch_cpu_entry entry) {
+    uint32_t eax = 1, ebx, ecx, edx;
+    table_pointer* gdtr = (table_pointer*)(void*)(AP_TRAMPOLINE + (ap_gdtr - ap_trampoline));
+    unsigned int seen;
+
+    if (smp_started) {
+        return (int)cpus_running;
+    }
+    smp_started = 1;
+
+    /* CPUID.1:EDX bit 9: local APIC present */
+    __asm__ volatile("cpuid" : "+a"(eax), "=b"(ebx), "=c"(ecx), "=d"(edx));
+    if (!(edx & (1 << 9))) {
+        return 1;
+    }
+
+    cpu_entry = entry;
+    for (size_t i = 0; i < (size_t)(ap_trampoline_end - ap_trampoline); i++) {
+        ((uint8_t*)AP_TRAMPOLINE)[i] = ap_trampoline[i];
+    }
+    gdtr->limit = sizeof(gdt) - 1;
+    gdtr->base = (uint32_t)(unsigned long)gdt;
+
+    lapic_enable();
+    cpu_of_apic[lapic_read(LAPIC_ID) >> 24] = 0;
+
+    lapic_send(ICR_INIT_ALL);
+    delay_us(10000);
+    lapic_send(ICR_SIPI_ALL | (AP_TRAMPOLINE >> 12));
+    delay_us(200);
+    lapic_send(ICR_SIPI_ALL | (AP_TRAMPOLINE >> 12));
+
+    /* Wait until no CPU has checked in for 20 ms */
+    do {
+        seen = cpus_running;
+        delay_us(20000);
+    } while (cpus_running != seen && cpus_running < ARCH_MAX_CPUS);
+    return (int)cpus_running;
+}
+
+unsigned int arch_cpu_index(void) {
+    if (cpus_running == 1) {
+        return 0;
+    }
+    return cpu_of_apic[lapic_read(LAPIC_ID) >> 24];
+}
+
+void arch_cpu_relax(void) {
+    __asm__ volatile("pause");
+}
+
 /* Boot information */
 boot_info_t* arch_get_boot_info(void) {
     return &boot_info;
@@ -104,3 +503,16 @@ char arch_input_read(void) {
     return (char)arch_inb(0x60);
 }
 
+
+/* No native code generator on this architecture - programs are interpreted */
+size_t arch_jit_compile(const bf_program* program, uint8_t* code, size_t capacity) {
+    (void)program;
+    (void)code;
+    (void)capacity;
+    return 0;
+}
+
+void arch_jit_sync(uint8_t* code, size_t size) {
+    (void)code;
+    (void)size;
+}
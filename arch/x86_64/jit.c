@@ -0,0 +1,271 @@
+/* x86 Brainfuck JIT Backend
+ * Emits 32-bit x86 machine code for a compiled Brainfuck program.
+ *
+ * Register use inside generated code:
+ *   esi - tape pointer (address of the current cell)
+ *   ebx - first cell of the dirty window
+ *   edi - last cell of the dirty window
+ * The current cell is addressed directly as [esi + offset].
+ * eax/ecx/edx are scratch and may be clobbered by runtime helper calls.
+ */
+
+#include "../../kernel.h"
+#include "../../bf.h"
+
+/* Worst-case bytes emitted for one IR instruction */
+#define JIT_MAX_INSN_BYTES 64
+
+/* Register number of eax in ModRM reg fields */
+#define REG_EAX 0
+
+/* Native code offset of each IR instruction */
+static size_t jit_insn_offset[BF_MAX_INSNS];
+
+/* Output buffer state */
+static uint8_t* jit_code;
+static size_t jit_size;
+
+static void emit8(uint8_t byte) {
+    jit_code[jit_size++] = byte;
+}
+
+static void emit32(uint32_t value) {
+    emit8((uint8_t)value);
+    emit8((uint8_t)(value >> 8));
+    emit8((uint8_t)(value >> 16));
+    emit8((uint8_t)(value >> 24));
+}
+
+static void patch32(size_t at, uint32_t value) {
+    jit_code[at] = (uint8_t)value;
+    jit_code[at + 1] = (uint8_t)(value >> 8);
+    jit_code[at + 2] = (uint8_t)(value >> 16);
+    jit_code[at + 3] = (uint8_t)(value >> 24);
+}
+
+/* ModRM (+ displacement) for the memory operand [esi + offset] */
+static void emit_cell(uint8_t reg, int offset) {
+    if (offset == 0) {
+        emit8((uint8_t)(0x06 | (reg << 3)));
+    } else if (offset >= -128 && offset <= 127) {
+        emit8((uint8_t)(0x46 | (reg << 3)));
+        emit8((uint8_t)offset);
+    } else {
+        emit8((uint8_t)(0x86 | (reg << 3)));
+        emit32((uint32_t)offset);
+    }
+}
+
+/* call through eax to an absolute address, so code can be moved freely */
+static void emit_call(void* function) {
+    emit8(0xB8);                        /* mov eax, imm32 */
+    emit32((uint32_t)(unsigned long)function);
+    emit8(0xFF);                        /* call eax */
+    emit8(0xD0);
+}
+
+/* Keep esi inside the window [ebx, edi]. If it moved past edi, widen the
+ * window with bf_native_grow_last and clamp to the new edge (past ebx
+ * likewise with bf_native_grow_first). */
+static void emit_window_check(int upward) {
+    size_t skip;
+
+    if (upward) {
+        emit8(0x39); emit8(0xFE);       /* cmp esi, edi */
+        emit8(0x76);                    /* jbe done */
+    } else {
+        emit8(0x39); emit8(0xDE);       /* cmp esi, ebx */
+        emit8(0x73);                    /* jae done */
+    }
+    skip = jit_size;
+    emit8(0);
+
+    emit8(0x56);                        /* push esi */
+    emit_call(upward ? (void*)bf_native_grow_last : (void*)bf_native_grow_first);
+    emit8(0x83); emit8(0xC4); emit8(0x04);  /* add esp, 4 */
+    if (upward) {
+        emit8(0x89); emit8(0xC7);       /* mov edi, eax */
+        emit8(0x39); emit8(0xFE);       /* cmp esi, edi */
+        emit8(0x76); emit8(0x02);       /* jbe +2 */
+        emit8(0x89); emit8(0xFE);       /* mov esi, edi */
+    } else {
+        emit8(0x89); emit8(0xC3);       /* mov ebx, eax */
+        emit8(0x39); emit8(0xDE);       /* cmp esi, ebx */
+        emit8(0x73); emit8(0x02);       /* jae +2 */
+        emit8(0x89); emit8(0xDE);       /* mov esi, ebx */
+    }
+    jit_code[skip] = (uint8_t)(jit_size - (skip + 1));
+}
+
+/* add esi, distance - then keep esi inside the window like '>' and '<' */
+static void emit_move(int distance) {
+    if (distance >= -128 && distance <= 127) {
+        emit8(0x83);
+        emit8(0xC6);
+        emit8((uint8_t)distance);
+    } else {
+        emit8(0x81);
+        emit8(0xC6);
+        emit32((uint32_t)distance);
+    }
+    emit_window_check(distance > 0);
+}
+
+/* Point the branch that ends each FITS past the instructions it guards,
+ * once every instruction has its offset */
+static void patch_guards(const bf_program* program) {
+    for (size_t i = 0; i < program->length; i++) {
+        if (program->code[i].op == BF_OP_FITS) {
+            size_t branch = jit_insn_offset[i + 1] - 4;  /* rel32 of the je */
+            size_t target = jit_insn_offset[program->code[i].arg + 1];
+            patch32(branch, (uint32_t)(target - (branch + 4)));
+        }
+    }
+}
+
+/* Native code offset of IR instruction index in the code last emitted */
+size_t arch_jit_offset(size_t index) {
+    return jit_insn_offset[index];
+}
+
+/* x86 keeps instruction fetch coherent with stores - nothing to do */
+void arch_jit_sync(uint8_t* code, size_t size) {
+    (void)code;
+    (void)size;
+}
+
+/* Compile a program into code. Generated code is called as
+ *   uint8_t* entry(uint8_t* pointer, uint8_t* first, uint8_t* last)
+ * and returns the final tape pointer.
+ * Returns the number of bytes emitted, or 0 if the program does not fit. */
+size_t arch_jit_compile(const bf_program* program, uint8_t* code, size_t capacity) {
+#if !defined(__i386__)
+    (void)program;
+    (void)code;
+    (void)capacity;
+    return 0;  /* Only 32-bit code generation is implemented */
+#else
+    jit_code = code;
+    jit_size = 0;
+
+    if (capacity < 2 * JIT_MAX_INSN_BYTES) {
+        return 0;
+    }
+
+    /* Prologue: save callee-saved registers and load the arguments */
+    emit8(0x53);                        /* push ebx */
+    emit8(0x56);                        /* push esi */
+    emit8(0x57);                        /* push edi */
+    emit8(0x8B); emit8(0x74); emit8(0x24); emit8(0x10);  /* mov esi, [esp+16] */
+    emit8(0x8B); emit8(0x5C); emit8(0x24); emit8(0x14);  /* mov ebx, [esp+20] */
+    emit8(0x8B); emit8(0x7C); emit8(0x24); emit8(0x18);  /* mov edi, [esp+24] */
+
+    for (size_t i = 0; i < program->length; i++) {
+        const bf_insn* insn = &program->code[i];
+
+        if (jit_size + JIT_MAX_INSN_BYTES > capacity) {
+            return 0;
+        }
+        jit_insn_offset[i] = jit_size;
+
+        switch (insn->op) {
+            case BF_OP_ADD:
+                emit8(0x80);            /* add byte [esi + offset], imm8 */
+                emit_cell(0, insn->offset);
+                emit8((uint8_t)insn->arg);
+                break;
+
+            case BF_OP_SET:
+                emit8(0xC6);            /* mov byte [esi + offset], imm8 */
+                emit_cell(0, insn->offset);
+                emit8((uint8_t)insn->arg);
+                break;
+
+            case BF_OP_MOVE:
+                emit_move(insn->arg);
+                break;
+
+            case BF_OP_MULADD:
+                emit8(0x0F); emit8(0xB6);   /* movzx eax, byte [esi] */
+                emit_cell(REG_EAX, 0);
+                if ((uint8_t)insn->arg == 0xFF) {
+                    emit8(0x28);        /* sub [esi + offset], al */
+                } else {
+                    if ((uint8_t)insn->arg != 1) {
+                        emit8(0x69); emit8(0xC0);   /* imul eax, eax, imm32 */
+                        emit32((uint32_t)(uint8_t)insn->arg);
+                    }
+                    emit8(0x00);        /* add [esi + offset], al */
+                }
+                emit_cell(REG_EAX, insn->offset);
+                break;
+
+            case BF_OP_SCAN:
+            case BF_OP_PRINT:
+            case BF_OP_DIVMOD:
+            case BF_OP_COMPARE:
+                emit8(0x68);            /* push arg */
+                emit32((uint32_t)insn->arg);
+                emit8(0x56);            /* push esi */
+                emit_call(bf_jit_helper(insn->op));
+                emit8(0x83); emit8(0xC4); emit8(0x08);  /* add esp, 8 */
+                emit8(0x89); emit8(0xC6);   /* mov esi, eax */
+                emit_window_check(insn->arg > 0);
+                break;
+
+            case BF_OP_FITS:
+                emit8(0x68);            /* push offset */
+                emit32((uint32_t)insn->offset);
+                emit8(0x56);            /* push esi */
+                emit_call((void*)bf_jit_fits);
+                emit8(0x83); emit8(0xC4); emit8(0x08);  /* add esp, 8 */
+                emit8(0x85); emit8(0xC0);   /* test eax, eax */
+                emit8(0x0F); emit8(0x84);   /* je rel32, patched by patch_guards */
+                emit32(0);
+                break;
+
+            case BF_OP_OUT:
+                emit8(0x0F); emit8(0xB6);   /* movzx eax, byte [esi + offset] */
+                emit_cell(REG_EAX, insn->offset);
+                emit8(0x50);            /* push eax */
+                emit_call((void*)bf_putchar);
+                emit8(0x83); emit8(0xC4); emit8(0x04);  /* add esp, 4 */
+                break;
+
+            case BF_OP_IN:
+                emit_call((void*)bf_getchar);
+                emit8(0x88);            /* mov [esi + offset], al */
+                emit_cell(REG_EAX, insn->offset);
+                break;
+
+            case BF_OP_JZ:
+                emit8(0x80); emit8(0x3E); emit8(0x00);  /* cmp byte [esi], 0 */
+                emit8(0x0F); emit8(0x84);   /* je rel32, patched at the JNZ */
+                emit32(0);
+                break;
+
+            case BF_OP_JNZ: {
+                size_t open = (size_t)insn->arg;
+                size_t open_jump = jit_insn_offset[open] + 5;  /* rel32 of the je */
+                emit8(0x80); emit8(0x3E); emit8(0x00);  /* cmp byte [esi], 0 */
+                emit8(0x0F); emit8(0x85);   /* jne rel32 back past the JZ */
+                emit32((uint32_t)(jit_insn_offset[open + 1] - (jit_size + 4)));
+                patch32(open_jump, (uint32_t)(jit_size - (open_jump + 4)));
+                break;
+            }
+
+            case BF_OP_END:
+            default:
+                emit8(0x89); emit8(0xF0);   /* mov eax, esi */
+                emit8(0x5F);            /* pop edi */
+                emit8(0x5E);            /* pop esi */
+                emit8(0x5B);            /* pop ebx */
+                emit8(0xC3);            /* ret */
+                patch_guards(program);
+                return jit_size;
+        }
+    }
+
+    return 0;  /* No END instruction */
+#endif
+}
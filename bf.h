@@ -0,0 +1,329 @@
+/* Brainfuck Engine Definitions
+ * Intermediate representation shared by the compiler and the interpreter
+ */
+
+#ifndef BF_H
+#define BF_H
+
+#include "kernel.h"
+
+/* Maximum number of IR instructions in one compiled program */
+#define BF_MAX_INSNS 32768
+
+/* Maximum loop nesting depth accepted by the compiler */
+#define BF_MAX_LOOP_DEPTH 1024
+
+/* Cells reserved on each side of the tape. Operations addressed at
+ * pointer + offset never use an offset larger than this, so they stay
+ * inside the tape memory even when the pointer sits on an edge. */
+#define BF_TAPE_GUARD 256
+
+/* Bytes of tape memory shared by every engine variant, guard cells included */
+#define BF_TAPE_MEMORY (1024 * 1024)
+
+/* Tape length in cells unless a program asks for another */
+#define BF_TAPE_CELLS 30000
+
+/* Execution contexts that can exist at once, the default one included */
+#define BF_MAX_CONTEXTS 8
+
+/* Program output a context buffers before writing it out (see bf_flush) */
+#define BF_OUTPUT_SIZE 512
+
+/* Background jobs that can exist at once: one per context but the default */
+#define BF_MAX_JOBS (BF_MAX_CONTEXTS - 1)
+
+/* Instruction budget of one job slice: well under a millisecond of
+ * interpretation, so typing stays responsive with every job busy */
+#define BF_JOB_SLICE 65536
+
+/* Returned by a context's read endpoint when no byte is available yet:
+ * an interpreted program pauses on its ',' and retries it when stepped
+ * again. Endpoints of contexts that may run native code never return it. */
+#define BF_READ_WAIT (-1)
+
+/* Longest tape available with cells of the given width in bits */
+#define BF_TAPE_MAX_CELLS(bits) ((size_t)(BF_TAPE_MEMORY / ((bits) / 8) - 2 * BF_TAPE_GUARD))
+
+/* What a move past either end of the tape does */
+#define BF_BOUNDS_CLAMP 1  /* Stop on the edge cell */
+#define BF_BOUNDS_WRAP  2  /* Continue from the other end */
+
+/* Maximum distinct cells a multiply loop may touch to become MULADDs */
+#define BF_MAX_IDIOM_CELLS 16
+
+/* Largest known iteration count for which a loop is fully unrolled */
+#define BF_MAX_UNROLL 16
+
+/* Instructions the IR may need per source character, END aside.
+ * Unrolling is held to this, so IR storage can be sized from the source. */
+#define BF_INSNS_PER_CHAR 2
+
+/* Most cells whose value constant propagation tracks at once */
+#define BF_MAX_KNOWN_CELLS 32
+
+/* IR opcodes */
+#define BF_OP_END    0  /* Stop execution */
+#define BF_OP_ADD    1  /* cell[offset] += arg */
+#define BF_OP_MOVE   2  /* pointer += arg, clamped to the tape */
+#define BF_OP_OUT    3  /* Write cell[offset] to the terminal */
+#define BF_OP_IN     4  /* Read keyboard into cell[offset] */
+#define BF_OP_JZ     5  /* If cell == 0, continue after the JNZ at index arg */
+#define BF_OP_JNZ    6  /* If cell != 0, continue after the JZ at index arg */
+#define BF_OP_SET    7  /* cell[offset] = arg ("[-]") */
+#define BF_OP_MULADD 8  /* cell[offset] += cell * arg ("[->++<]") */
+#define BF_OP_SCAN   9  /* Move by arg until cell == 0 ("[>]", "[<<]") */
+#define BF_OP_PRINT 10  /* Output cells, moving by arg, until cell == 0 ("[.>]") */
+/* Library routines, placed in front of the canonical loop they replace.
+ * When the routine's preconditions hold they do its work and leave the
+ * pointer on a zero cell, so the loop's JZ skips it; otherwise they do
+ * nothing and the loop runs. arg is the direction, +1 or -1, times: */
+#define BF_OP_DIVMOD  11  /* 1 for n d r q 0 0, 2 for n c d r q 0 0 (c += n):
+                           * q += n / d, r = n % d, n = 0 */
+#define BF_OP_COMPARE 12  /* 1 for 0 a b 0: subtract min(a, b) from both and
+                           * step back onto the 0 if b <= a */
+/* Guard in front of a multiply loop whose moves may stop at an edge: the
+ * MULADDs and SET after it do the loop's work when the cells it visits
+ * are on the tape, and FITS skips them to the loop otherwise */
+#define BF_OP_FITS    13  /* Unless cells 0 .. offset from the pointer are all
+                           * on the tape, continue after index arg */
+
+/* Dispatch codes from here on are superinstructions: one engine case
+ * that runs a common sequence of ops, the first at its instruction
+ * (bf_super.h, generated by build_super.py) */
+#define BF_OP_SUPER 16
+
+/* One IR instruction */
+typedef struct {
+    uint8_t op;
+    uint8_t dispatch;  /* Engine case to run: op, or a superinstruction starting here */
+    int arg;
+    int offset;   /* Cell addressed, relative to the pointer (ADD, SET, OUT, IN, MULADD, FITS) */
+} bf_insn;
+
+/* Engine variant a program runs on. Programs pick one with a directive
+ * on their first line, e.g. "#bf cell=16 tape=65536 wrap"; the default
+ * is 8-bit cells on a clamped 30000-cell tape. In an override, zero
+ * fields keep what the program asked for. */
+typedef struct {
+    uint8_t cell_bits;  /* 8, 16 or 32 */
+    uint8_t bounds;     /* BF_BOUNDS_CLAMP or BF_BOUNDS_WRAP */
+    size_t tape_cells;
+} bf_variant;
+
+/* Compiled program - code points at caller-provided storage */
+typedef struct {
+    bf_insn* code;
+    size_t length;    /* Instructions used, including the END sentinel */
+    size_t capacity;  /* Instructions available in code */
+    uint8_t* native;  /* JIT output for code, or 0 to generate it on each run */
+    size_t native_size;
+    bf_variant variant;
+    size_t* source;   /* Caller storage bf_compile fills with each instruction's
+                       * source offset (bf_profile.c), or 0 */
+} bf_program;
+
+/* Cells a program may have written since the last reset. The pointer has
+ * only visited low..high, and offset-addressed writes reach at most
+ * BF_TAPE_GUARD further, so every other cell is still zero. */
+typedef struct {
+    size_t low;
+    size_t high;
+} bf_dirty;
+
+/* Execution context: everything one program run owns - its tape, pointer
+ * and dirty window, its I/O endpoints, its instruction budget and the
+ * program itself. Contexts come from a fixed pool (bf_context_alloc) and
+ * run independently; bf_run and the other one-shot runners use the
+ * default context. Interpreted contexts may run on several CPUs at once
+ * (bf_smp.c); native code runs on the boot CPU only, and bf_putchar,
+ * bf_getchar and bf_print_tape talk to the context it runs on. */
+typedef struct bf_context {
+    uint8_t* memory;   /* BF_TAPE_MEMORY bytes: the tape and its guard cells */
+    bf_variant variant;
+    size_t pointer;
+    bf_dirty dirty;
+
+    /* Output goes to write in blocks; write returns how much it took, and
+     * a '.' that finds the buffer full of untaken output pauses the
+     * program. ',' reads a byte from read, which may return BF_READ_WAIT
+     * to pause the program on the ','. Endpoints of contexts that may run
+     * native code must take everything. */
+    size_t (*write)(struct bf_context* context, const char* data, size_t length);
+    int (*read)(struct bf_context* context);
+    void* io;          /* Endpoint state, for the endpoints' own use */
+    char output[BF_OUTPUT_SIZE];
+    size_t output_length;
+
+    /* IR instructions one bf_context_step may run, charged a loop body
+     * at a time when a loop repeats; 0 runs the program to its end */
+    unsigned long budget;
+    unsigned long long ops;  /* Budget charged since the program was loaded */
+    const bf_program* program;
+    size_t resume;     /* IR index the next step starts at */
+    const void* threaded;  /* Handlers of the engine that threaded the
+                            * program, or 0 until a threaded engine runs it */
+    int in_use;
+} bf_context;
+
+/* Native code entry point, for JIT output and ahead-of-time translations.
+ * first and last bound the dirty window, not the tape: when a move or scan
+ * takes the pointer past one of them, the code calls bf_native_grow_first
+ * or bf_native_grow_last, uses the result as the new bound and clamps the
+ * pointer to it. Returns the final pointer. */
+typedef uint8_t* (*bf_native_entry)(uint8_t* pointer, uint8_t* first, uint8_t* last);
+
+/* Precompiled program embedded by build_sysfs.py. The script records the
+ * image format it was built for; images whose magic or version differ
+ * from the kernel's are rejected and the source is compiled instead. */
+#define BF_IMAGE_MAGIC   0x42464952  /* "BFIR" */
+#define BF_IMAGE_VERSION 13          /* Bump with the IR or the optimizer */
+
+/* Start of a program evaluated by build_sysfs.py, which runs it on the
+ * interpreter (build_image.c) until its first ',' or its end, or until
+ * its instruction budget or output limit stops it. The program printed
+ * output and left tape_cells cells starting at tape_first (cell_bits / 8
+ * bytes each, little-endian, every other cell zero) with the pointer at
+ * pointer; it continues at IR index resume. */
+typedef struct bf_prefix {
+    const char* output;
+    size_t output_length;
+    const uint8_t* tape;
+    size_t tape_first;
+    size_t tape_cells;
+    size_t pointer;
+    size_t resume;
+} bf_prefix;
+
+typedef struct bf_image {
+    uint32_t magic;
+    uint32_t version;
+    size_t length;        /* Instructions, including the END sentinel */
+    const bf_insn* code;
+    bf_variant variant;
+    bf_native_entry native;  /* C translation (build_sysfs.py --native), or 0 */
+    const bf_prefix* prefix;  /* Evaluated start for variant, or 0 */
+} bf_image;
+
+/* Entry of the map build_sysfs.py keeps in section sysfs_map for the
+ * sampling profiler: native code of image from address on runs IR
+ * instruction insn. Marks sit at block starts and are not sorted. */
+typedef struct {
+    const void* address;
+    const bf_image* image;
+    size_t insn;
+} bf_native_mark;
+
+/* Job states (bf_sched.c) */
+#define BF_JOB_READY   1  /* Gets a slice in every round */
+#define BF_JOB_WAITING 2  /* Paused on ',' until a key is typed for it */
+#define BF_JOB_DONE    3  /* Ended, not reported yet (bf_job_reap) */
+
+/* A background job as bf_job_list reports it */
+typedef struct {
+    int id;
+    int state;
+    const char* name;
+    unsigned long long ops;  /* IR instructions charged to its slices */
+} bf_job_info;
+
+/* Compiled-program cache statistics */
+typedef struct {
+    size_t hits;
+    size_t misses;
+    size_t evictions;
+    size_t entries;
+    size_t bytes_used;
+    size_t bytes_budget;
+} bf_cache_stats;
+
+/* Compiler (bf_compiler.c) */
+int bf_compile(const char* source, bf_program* program);
+int bf_load_image(const bf_image* image, bf_program* program);
+
+/* Tape scanning (bf_scan.c) */
+size_t bf_scan_tape(const uint8_t* tape, size_t size, size_t pointer, int stride);
+
+/* Execution contexts (bf_interpreter.c) */
+bf_context* bf_context_alloc(void);
+void bf_context_free(bf_context* context);
+int bf_context_load(bf_context* context, const bf_program* program, const bf_variant* variant);
+int bf_context_step(bf_context* context);
+int bf_context_profile(bf_context* context, unsigned long long* counts);
+
+/* Interpreter (bf_interpreter.c) */
+void bf_run(const bf_program* program);
+void bf_run_variant(const bf_program* program, const bf_variant* variant);
+void bf_load_and_run(const char* bf_code);
+void bf_run_native(bf_native_entry entry, size_t cells);
+void bf_run_prefix(const bf_program* program, const bf_prefix* prefix, const bf_variant* variant);
+void bf_run_profile(const bf_program* program, unsigned long long* counts);
+void bf_variant_apply(bf_variant* variant, const bf_variant* override);
+int bf_variant_valid(const bf_variant* variant);
+int bf_getchar(void);
+
+/* Program output is buffered and reaches the terminal in blocks: at a
+ * newline, when the buffer fills, before input is read and when the
+ * program ends */
+void bf_putchar(char c);
+void bf_flush(void);
+size_t bf_print_tape(const uint8_t* tape, size_t size, size_t pointer, int stride);
+
+/* Library routine arithmetic on cell values, shared by the engines and
+ * native code. values is n d r q (see BF_OP_DIVMOD) and mask the largest
+ * cell value. Returns 0, leaving values alone, if the loop would not
+ * compute a plain divmod: d is 0, or d + r is below 2 or above mask. */
+int bf_divmod(unsigned int values[4], unsigned int mask);
+
+/* JIT driver (bf_jit.c) - runs program natively on the tape.
+ * Returns 0 when done, -1 if no native code could be generated. */
+int bf_jit_run(const bf_program* program, uint8_t* tape, size_t size, size_t* pointer, bf_dirty* dirty);
+void bf_jit_enter(bf_native_entry entry, uint8_t* tape, size_t size, size_t* pointer, bf_dirty* dirty);
+size_t bf_jit_compile(const bf_program* program, uint8_t** native);
+uint8_t* bf_jit_scan(uint8_t* cell, int stride);
+uint8_t* bf_jit_print(uint8_t* cell, int stride);
+uint8_t* bf_jit_divmod(uint8_t* cell, int offset);
+uint8_t* bf_jit_compare(uint8_t* cell, int stride);
+int bf_jit_fits(uint8_t* cell, int offset);
+void* bf_jit_helper(uint8_t op);
+uint8_t* bf_native_grow_first(uint8_t* pointer);
+uint8_t* bf_native_grow_last(uint8_t* pointer);
+
+/* Native code generation (arch/<arch>/jit.c). Emits a function
+ *   uint8_t* entry(uint8_t* pointer, uint8_t* first, uint8_t* last)
+ * returning the final pointer. Returns the code size, 0 if unsupported.
+ * Generated code is position-independent: it may be copied elsewhere
+ * as long as arch_jit_sync is called on the new location. */
+size_t arch_jit_compile(const bf_program* program, uint8_t* code, size_t capacity);
+size_t arch_jit_offset(size_t index);
+void arch_jit_sync(uint8_t* code, size_t size);
+
+/* Execution profilers (bf_profile.c) */
+void bf_profile(const fs_entry* file);
+void bf_profile_sample(const fs_entry* file);
+
+/* Cooperative scheduler (bf_sched.c). Jobs run interpreted on their own
+ * context, round robin, a budget of BF_JOB_SLICE instructions at a time. */
+int bf_job_start(fs_entry* file, const bf_variant* override);
+int bf_job_schedule(void);
+int bf_job_foreground(int id);
+int bf_job_kill(int id);
+int bf_job_last(void);
+size_t bf_job_list(bf_job_info* info, size_t max);
+void bf_job_reap(void);
+
+/* Multiprocessor batch runs (bf_smp.c) */
+void bf_smp_initialize(void);
+unsigned int bf_smp_cpus(void);
+void bf_batch(fs_entry* files[], size_t count, const bf_variant* override);
+
+/* Shell pipelines (bf_pipe.c). Each stage's output streams into the next
+ * one's input; stages take turns on the boot CPU. */
+void bf_pipeline(fs_entry* files[], size_t count, const bf_variant* override);
+
+/* Compiled-program cache (bf_cache.c) */
+void bf_cache_run(fs_entry* file, const bf_variant* override);
+void bf_cache_clear(void);
+void bf_cache_get_stats(bf_cache_stats* stats);
+
+#endif /* BF_H */
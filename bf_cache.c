@@ -0,0 +1,330 @@
+/* Compiled-Program Cache
+ * Keeps the IR and JIT output of recently run files so repeated commands
+ * skip compilation. Files with a precompiled image skip it altogether.
+ * Entries are keyed by fs_entry and its content version, live back to
+ * back in a fixed arena and are evicted least recently used first when
+ * the arena or the entry table is full.
+ */
+
+#include "kernel.h"
+#include "bf.h"
+
+/* VGA entry helper */
+static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
+    return (uint16_t) uc | (uint16_t) color << 8;
+}
+
+/* Memory budget for cached IR and native code */
+#define BF_CACHE_BUDGET (256 * 1024)
+
+/* Maximum number of cached programs */
+#define BF_CACHE_ENTRIES 16
+
+/* Arena allocations are rounded up to this (keeps code aligned) */
+#define BF_CACHE_ALIGN 16
+
+/* One cached program; its IR and native code sit at arena + offset.
+ * Programs from a precompiled image keep their IR in the image and only
+ * use the arena for native code. */
+typedef struct {
+    const fs_entry* file;
+    size_t version;
+    bf_program program;
+    int from_image;
+    size_t offset;
+    size_t bytes;
+    size_t last_used;
+} bf_cache_entry;
+
+static uint8_t bf_cache_arena[BF_CACHE_BUDGET] __attribute__((aligned(BF_CACHE_ALIGN)));
+
+/* Entries in arena order: entry i + 1 starts where entry i ends */
+static bf_cache_entry bf_cache_entries[BF_CACHE_ENTRIES];
+static size_t bf_cache_count = 0;
+static size_t bf_cache_used = 0;
+static size_t bf_cache_clock = 0;
+
+static size_t bf_cache_hits = 0;
+static size_t bf_cache_misses = 0;
+static size_t bf_cache_evictions = 0;
+
+static size_t bf_cache_round(size_t bytes) {
+    return (bytes + BF_CACHE_ALIGN - 1) & ~(size_t)(BF_CACHE_ALIGN - 1);
+}
+
+/* Drop entry index and slide everything after it down to close the gap.
+ * Native code is position-independent, so moving it only needs a sync. */
+static void bf_cache_remove(size_t index) {
+    size_t gap = bf_cache_entries[index].bytes;
+    size_t from = bf_cache_entries[index].offset + gap;
+
+    for (size_t i = from; i < bf_cache_used; i++) {
+        bf_cache_arena[i - gap] = bf_cache_arena[i];
+    }
+    bf_cache_used -= gap;
+
+    for (size_t i = index; i + 1 < bf_cache_count; i++) {
+        bf_cache_entry* entry = &bf_cache_entries[i];
+        *entry = bf_cache_entries[i + 1];
+        entry->offset -= gap;
+        if (!entry->from_image) {
+            entry->program.code = (bf_insn*)(void*)((uint8_t*)entry->program.code - gap);
+        }
+        if (entry->program.native) {
+            entry->program.native -= gap;
+            arch_jit_sync(entry->program.native, entry->program.native_size);
+        }
+    }
+    bf_cache_count--;
+}
+
+/* Evict least recently used entries until bytes more fit in the arena.
+ * A new entry also needs a free table slot; growing the newest entry
+ * (grow_last) must not evict that entry itself.
+ * Returns 0 on success, -1 if the request can never fit. */
+static int bf_cache_reserve(size_t bytes, int grow_last) {
+    size_t keep = grow_last ? 1 : 0;
+
+    if (bytes > BF_CACHE_BUDGET) {
+        return -1;
+    }
+
+    while (bf_cache_used + bytes > BF_CACHE_BUDGET ||
+           (!grow_last && bf_cache_count >= BF_CACHE_ENTRIES)) {
+        size_t victim = 0;
+
+        if (bf_cache_count <= keep) {
+            return -1;
+        }
+        for (size_t i = 1; i < bf_cache_count - keep; i++) {
+            if (bf_cache_entries[i].last_used < bf_cache_entries[victim].last_used) {
+                victim = i;
+            }
+        }
+        bf_cache_remove(victim);
+        bf_cache_evictions++;
+    }
+    return 0;
+}
+
+/* Attach native code to the newest entry when the JIT engine is selected.
+ * Native code is stored right after the IR, so older entries that were
+ * cached without it generate it per run instead. */
+static void bf_cache_attach_native(void) {
+    bf_cache_entry* entry = &bf_cache_entries[bf_cache_count - 1];
+    uint8_t* native;
+    uint8_t* target;
+    size_t native_size;
+    size_t bytes;
+
+    if (config_get_bf_engine() != BF_ENGINE_JIT || entry->program.native) {
+        return;
+    }
+
+    native_size = bf_jit_compile(&entry->program, &native);
+    bytes = bf_cache_round(native_size);
+    if (native_size == 0 || bf_cache_reserve(bytes, 1) != 0) {
+        return;
+    }
+
+    /* Eviction slides the newest entry down; it is still the last one */
+    entry = &bf_cache_entries[bf_cache_count - 1];
+    target = bf_cache_arena + entry->offset + entry->bytes;
+    for (size_t i = 0; i < native_size; i++) {
+        target[i] = native[i];
+    }
+    arch_jit_sync(target, native_size);
+    entry->program.native = target;
+    entry->program.native_size = native_size;
+    entry->bytes += bytes;
+    bf_cache_used += bytes;
+}
+
+/* Find or build the cached program for file.
+ * Sets *program to 0 if the file is too large to cache.
+ * Returns 0 on success, -1 if the file failed to compile (already reported). */
+static int bf_cache_load(fs_entry* file, const bf_program** program) {
+    size_t index;
+    size_t bytes;
+    bf_cache_entry* entry;
+    bf_program image_program;
+
+    *program = 0;
+    bf_cache_clock++;
+
+    for (index = 0; index < bf_cache_count; index++) {
+        if (bf_cache_entries[index].file == file) {
+            break;
+        }
+    }
+
+    if (index < bf_cache_count) {
+        if (bf_cache_entries[index].version == file->version) {
+            bf_cache_hits++;
+            bf_cache_entries[index].last_used = bf_cache_clock;
+            if (index == bf_cache_count - 1) {
+                bf_cache_attach_native();
+                index = bf_cache_count - 1;
+            }
+            *program = &bf_cache_entries[index].program;
+            return 0;
+        }
+        /* Content changed since it was compiled */
+        bf_cache_remove(index);
+    }
+
+    bf_cache_misses++;
+
+    /* A valid precompiled image needs no compiling and no IR storage */
+    if (file->image && bf_load_image(file->image, &image_program) == 0) {
+        if (bf_cache_reserve(0, 0) != 0) {
+            return 0;
+        }
+        entry = &bf_cache_entries[bf_cache_count];
+        entry->program = image_program;
+        entry->from_image = 1;
+        entry->bytes = 0;
+    } else {
+        /* IR never needs more than BF_INSNS_PER_CHAR instructions per
+         * source character (plus END) */
+        bytes = bf_cache_round((BF_INSNS_PER_CHAR * file->size + 1) * sizeof(bf_insn));
+        if (bf_cache_reserve(bytes, 0) != 0) {
+            return 0;
+        }
+
+        entry = &bf_cache_entries[bf_cache_count];
+        entry->program.code = (bf_insn*)(void*)(bf_cache_arena + bf_cache_used);
+        entry->program.capacity = BF_INSNS_PER_CHAR * file->size + 1;
+        entry->program.source = 0;
+        entry->from_image = 0;
+
+        if (bf_compile(file->data, &entry->program) != 0) {
+            return -1;
+        }
+
+        /* Keep only what the IR actually used */
+        entry->bytes = bf_cache_round(entry->program.length * sizeof(bf_insn));
+        entry->program.capacity = entry->program.length;
+    }
+
+    entry->file = file;
+    entry->version = file->version;
+    entry->offset = bf_cache_used;
+    entry->last_used = bf_cache_clock;
+    bf_cache_used += entry->bytes;
+    bf_cache_count++;
+
+    bf_cache_attach_native();
+    *program = &bf_cache_entries[bf_cache_count - 1].program;
+    return 0;
+}
+
+/* Native translation built into the kernel for file, or 0. Only used
+ * when native code is wanted and the image matches this kernel. */
+static bf_native_entry bf_cache_native(const fs_entry* file) {
+    const bf_image* image = file->image;
+
+    if (config_get_bf_engine() != BF_ENGINE_JIT || image == 0 ||
+        image->magic != BF_IMAGE_MAGIC || image->version != BF_IMAGE_VERSION) {
+        return 0;
+    }
+    return image->native;
+}
+
+/* Start of file's program evaluated at build time, or 0. Only used when
+ * the image matches this kernel and the run keeps the variant the prefix
+ * was evaluated for. */
+static const bf_prefix* bf_cache_prefix(const fs_entry* file, const bf_variant* variant) {
+    const bf_image* image = file->image;
+
+    if (image == 0 || image->magic != BF_IMAGE_MAGIC || image->version != BF_IMAGE_VERSION ||
+        image->prefix == 0 || variant->cell_bits != image->variant.cell_bits ||
+        variant->bounds != image->variant.bounds ||
+        variant->tape_cells != image->variant.tape_cells) {
+        return 0;
+    }
+    return image->prefix;
+}
+
+/* Whether the rest of a run on variant would go to native code: the JIT
+ * only takes whole runs on 8-bit clamped tapes (bf_context_step) */
+static int bf_cache_goes_native(const bf_variant* variant) {
+    return config_get_bf_engine() == BF_ENGINE_JIT && variant->cell_bits == 8 &&
+           variant->bounds == BF_BOUNDS_CLAMP;
+}
+
+/* Whether prefix leaves nothing of file's program to run */
+static int bf_cache_prefix_ends(const fs_entry* file, const bf_prefix* prefix) {
+    return file->image->code[prefix->resume].op == BF_OP_END;
+}
+
+/* Load and execute a Brainfuck file, compiling it only if it is not cached.
+ * Files with an evaluated prefix that finishes the program just print its
+ * output. Otherwise files translated ahead of time run their built-in
+ * native code, and the JIT runs the program from its start; a prefix that
+ * stops early is only resumed when the rest would be interpreted anyway,
+ * since a resumed run cannot enter native code. Settings in override
+ * (zero fields excepted) replace the engine variant the program asked
+ * for; override may be 0. */
+void bf_cache_run(fs_entry* file, const bf_variant* override) {
+    const bf_program* program;
+    bf_native_entry native = bf_cache_native(file);
+    const bf_prefix* prefix;
+    bf_variant variant;
+
+    terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
+    terminal_writestring("[BF] Executing...\n");
+    terminal_setcolor(vga_entry(COLOR_LIGHT_GREEN, COLOR_BLACK));
+
+    if (native) {
+        /* Native translations exist only for 8-bit clamped tapes */
+        variant = file->image->variant;
+        if (override) {
+            bf_variant_apply(&variant, override);
+        }
+        prefix = bf_cache_prefix(file, &variant);
+        if (variant.cell_bits == 8 && variant.bounds == BF_BOUNDS_CLAMP &&
+            bf_variant_valid(&variant) && (prefix == 0 || !bf_cache_prefix_ends(file, prefix))) {
+            bf_run_native(native, variant.tape_cells);
+            terminal_putchar('\n');
+            return;
+        }
+    }
+
+    if (bf_cache_load(file, &program) == 0) {
+        if (program) {
+            variant = program->variant;
+            if (override) {
+                bf_variant_apply(&variant, override);
+            }
+            /* The prefix belongs to the image's IR, not to a recompile */
+            prefix = bf_cache_prefix(file, &variant);
+            if (prefix && program->code == file->image->code &&
+                (bf_cache_prefix_ends(file, prefix) || !bf_cache_goes_native(&variant))) {
+                bf_run_prefix(program, prefix, &variant);
+            } else {
+                bf_run_variant(program, &variant);
+            }
+        } else {
+            bf_execute(file->data);
+        }
+    }
+
+    terminal_putchar('\n');
+}
+
+/* Drop every cached program */
+void bf_cache_clear(void) {
+    bf_cache_count = 0;
+    bf_cache_used = 0;
+}
+
+/* Report cache counters */
+void bf_cache_get_stats(bf_cache_stats* stats) {
+    stats->hits = bf_cache_hits;
+    stats->misses = bf_cache_misses;
+    stats->evictions = bf_cache_evictions;
+    stats->entries = bf_cache_count;
+    stats->bytes_used = bf_cache_used;
+    stats->bytes_budget = BF_CACHE_BUDGET;
+}
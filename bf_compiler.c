@@ -0,0 +1,1387 @@
+/* Brainfuck Compiler
+ * Translates Brainfuck source into the compact IR executed by bf_run.
+ * Runs of +/- are folded into single ADD instructions and comments are
+ * stripped. Pointer movement is deferred to the end of each basic block:
+ * in between, ADD/SET/OUT/IN address their cell at an offset from the
+ * pointer, so ">+>++<<-" is three ADDs and no MOVE. On a clamped tape a
+ * move is only deferred while it provably cannot reach an edge; the rest
+ * are real MOVEs, which clamp one at a time. Loop brackets are linked to
+ * each other.
+ * Clear, multiply and scan loops are replaced by single operations, and
+ * short loops with an iteration count known at compile time are unrolled.
+ * Canonical library loops (divmod, compare) get a native routine in front,
+ * and so do multiply loops that may stop at an edge: their MULADDs behind
+ * a check that the cells they visit are on the tape.
+ * A final pass propagates known cell values through each block, folding
+ * stores and deleting dead stores and loops that can never be entered.
+ * Common op sequences are then marked to run as one superinstruction.
+ * Precompiled images from build_sysfs.py are validated here as well.
+ */
+
+#include "kernel.h"
+#include "bf.h"
+#include "bf_super.h"
+
+/* VGA entry helper */
+static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
+    return (uint16_t) uc | (uint16_t) color << 8;
+}
+
+/* Open loops during compilation: IR index of the JZ and its source offset */
+static size_t bf_loop_insn[BF_MAX_LOOP_DEPTH];
+static size_t bf_loop_source[BF_MAX_LOOP_DEPTH];
+
+/* Source offset of the character being compiled, and of the first '<'
+ * or '>' of the pointer movement deferred so far */
+static size_t bf_source_offset;
+static size_t bf_move_source;
+
+/* Cells the pointer may be on where the deferred movement starts, on a
+ * clamped tape, and at the JZ of each open loop. A clamp in the middle
+ * of a deferred move would shift every offset after it. */
+static int bf_pointer_low;
+static int bf_pointer_high;
+static int bf_loop_low[BF_MAX_LOOP_DEPTH];
+static int bf_loop_high[BF_MAX_LOOP_DEPTH];
+static int bf_loop_stays[BF_MAX_LOOP_DEPTH];
+
+/* Pointer offset at each loop open while bf_loop_fits reads ahead */
+static int bf_span_position[BF_MAX_LOOP_DEPTH];
+
+/* Nonzero for each MOVE that may stop at a tape edge short of its arg:
+ * offsets before and after it are not relative to the same cell */
+static uint8_t bf_move_edge[BF_MAX_INSNS];
+
+/* Cells touched by a candidate multiply loop: offset and per-iteration delta */
+static int bf_idiom_offset[BF_MAX_IDIOM_CELLS];
+static int bf_idiom_delta[BF_MAX_IDIOM_CELLS];
+
+/* A cell constant propagation is tracking within a block */
+typedef struct {
+    int address;        /* Offset from the pointer where the block began */
+    int known;          /* value is the cell's value at every cell width */
+    unsigned int value;
+    size_t store;       /* Last store to the cell that nothing has read yet */
+} bf_known_cell;
+
+/* No unread store to the cell, or an instruction that is deleted */
+#define BF_NO_INSN ((size_t)-1)
+
+static bf_known_cell bf_known_cells[BF_MAX_KNOWN_CELLS];
+static size_t bf_known_count;
+static int bf_known_zero;     /* Cells not tracked are zero (program start) */
+static int bf_known_lowest;   /* Addresses touched since the table was cleared */
+static int bf_known_highest;
+
+/* New index of each instruction once deleted ones are dropped */
+static size_t bf_insn_map[BF_MAX_INSNS];
+
+/* Ops of each superinstruction, by dispatch code - BF_OP_SUPER */
+static const uint8_t bf_super_ops[BF_SUPER_COUNT][BF_SUPER_LENGTH + 1] = BF_SUPER_OPS;
+
+/* Library routines: canonical loops from the well-known brainfuck.org and
+ * esolang wiki algorithms, written for their rightward layout. Their
+ * mirror images, with every '<' and '>' swapped, work leftwards and match
+ * too. The divmod keeping n is the core of the usual print-decimal. */
+typedef struct {
+    const char* loop;  /* Commands only */
+    uint8_t op;
+    int arg;
+} bf_library_routine;
+
+static const bf_library_routine bf_library[] = {
+    { "[->-[>+>>]>[+[-<+>]>+>>]<<<<<]", BF_OP_DIVMOD, 1 },
+    { "[->+>-[>+>>]>[+[-<+>]>+>>]<<<<<<]", BF_OP_DIVMOD, 2 },
+    { "[->-[>]<<]", BF_OP_COMPARE, 1 },
+};
+
+#define BF_LIBRARY_SIZE (sizeof(bf_library) / sizeof(bf_library[0]))
+
+/* Print an unsigned decimal number */
+static void bf_write_number(size_t value) {
+    char digits[12];
+    size_t count = 0;
+    do {
+        digits[count++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) {
+        terminal_putchar(digits[--count]);
+    }
+}
+
+/* Report a compile error at a source offset */
+static void bf_compile_error(const char* message, size_t offset) {
+    terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+    terminal_writestring("[BF] Error: ");
+    terminal_writestring(message);
+    terminal_writestring(" at offset ");
+    bf_write_number(offset);
+    terminal_putchar('\n');
+}
+
+/* Record source offset position for instruction index, if the program
+ * keeps a source map */
+static void bf_set_source(bf_program* program, size_t index, size_t position) {
+    if (program->source) {
+        program->source[index] = position;
+    }
+}
+
+/* Copy instruction from over instruction to, source offset included */
+static void bf_copy_insn(bf_program* program, size_t to, size_t from) {
+    program->code[to] = program->code[from];
+    bf_move_edge[to] = bf_move_edge[from];
+    if (program->source) {
+        program->source[to] = program->source[from];
+    }
+}
+
+/* Append an instruction addressing the cell at pointer + offset, folding
+ * it into the previous ADD on the same cell when possible.
+ * Returns 0 on success, -1 if the program is full. */
+static int bf_emit_at(bf_program* program, uint8_t op, int arg, int offset) {
+    bf_insn* code = program->code;
+
+    if (op == BF_OP_ADD && program->length > 0 &&
+        code[program->length - 1].op == op && code[program->length - 1].offset == offset) {
+        code[program->length - 1].arg += arg;
+        if (code[program->length - 1].arg == 0) {
+            /* The run cancelled itself out (e.g. "+-") */
+            program->length--;
+        }
+        return 0;
+    }
+
+    /* Always keep room for the END sentinel */
+    if (program->length + 1 >= program->capacity) {
+        return -1;
+    }
+
+    code[program->length].op = op;
+    code[program->length].arg = arg;
+    code[program->length].offset = offset;
+    bf_move_edge[program->length] = 0;
+    bf_set_source(program, program->length, bf_source_offset);
+    program->length++;
+    return 0;
+}
+
+/* Append an instruction on the cell at the pointer */
+static int bf_emit(bf_program* program, uint8_t op, int arg) {
+    return bf_emit_at(program, op, arg, 0);
+}
+
+/* Nonzero if the pointer moved by distance from where the deferred
+ * movement starts cannot reach a tape edge on the way. A wrapping tape
+ * has no edge: offsets wrap exactly like moves. */
+static int bf_move_fits(const bf_program* program, int distance) {
+    return program->variant.bounds == BF_BOUNDS_WRAP ||
+           (bf_pointer_low + distance >= 0 &&
+            bf_pointer_high + distance < (int)program->variant.tape_cells);
+}
+
+/* Append a MOVE, which may stop at an edge if edge is set, folding it
+ * into the previous MOVE when both go the same way or the previous one
+ * cannot clamp. Returns 0 on success, -1 if the program is full. */
+static int bf_emit_move(bf_program* program, int arg, int edge) {
+    bf_insn* code = program->code;
+    size_t last = program->length - 1;
+
+    if (program->length > 0 && code[last].op == BF_OP_MOVE &&
+        (!bf_move_edge[last] || (code[last].arg > 0) == (arg > 0))) {
+        code[last].arg += arg;
+        bf_move_edge[last] |= (uint8_t)edge;
+        if (code[last].arg == 0) {
+            program->length--;
+        }
+        return 0;
+    }
+    if (bf_emit(program, BF_OP_MOVE, arg) != 0) {
+        return -1;
+    }
+    bf_move_edge[last + 1] = (uint8_t)edge;
+    return 0;
+}
+
+/* Apply the pointer movement deferred so far in this block */
+static int bf_flush_move(bf_program* program, int* pending) {
+    size_t current = bf_source_offset;
+    int status = 0;
+    if (*pending != 0) {
+        /* The move comes from the '<' and '>' that asked for it */
+        bf_source_offset = bf_move_source;
+        status = bf_emit_move(program, *pending, 0);
+        bf_source_offset = current;
+        bf_pointer_low += *pending;
+        bf_pointer_high += *pending;
+        *pending = 0;
+    }
+    return status;
+}
+
+/* Take one step of distance 1 or -1 for real, with the deferred movement
+ * applied first: it may reach an edge and clamp there */
+static int bf_clamp_move(bf_program* program, int* pending, int distance) {
+    int cells = (int)program->variant.tape_cells;
+    int status = bf_flush_move(program, pending);
+
+    if (status == 0) {
+        status = bf_emit_move(program, distance, 1);
+    }
+    bf_pointer_low += distance;
+    bf_pointer_high += distance;
+    if (distance < 0) {
+        bf_pointer_low = (bf_pointer_low < 0) ? 0 : bf_pointer_low;
+        bf_pointer_high = (bf_pointer_high < 0) ? 0 : bf_pointer_high;
+    } else {
+        bf_pointer_low = (bf_pointer_low > cells - 1) ? cells - 1 : bf_pointer_low;
+        bf_pointer_high = (bf_pointer_high > cells - 1) ? cells - 1 : bf_pointer_high;
+    }
+    return status;
+}
+
+/* Whether the loop whose '[' is at source[start] keeps the pointer on
+ * the tape when entered with it on cells low..high: each iteration, and
+ * each iteration of every loop inside it, ends where it started and
+ * reaches no edge in between. Its moves can then be deferred. */
+static int bf_loop_fits(const bf_program* program, const char* source, size_t start,
+                        int low, int high) {
+    int cells = (int)program->variant.tape_cells;
+    int position = 0;
+    size_t depth = 0;
+
+    if (program->variant.bounds == BF_BOUNDS_WRAP) {
+        return 1;
+    }
+    for (size_t i = start + 1; source[i] != '\0'; i++) {
+        switch (source[i]) {
+            case '>':
+                if (high + ++position >= cells) {
+                    return 0;
+                }
+                break;
+
+            case '<':
+                if (low + --position < 0) {
+                    return 0;
+                }
+                break;
+
+            case '[':
+                if (depth == BF_MAX_LOOP_DEPTH) {
+                    return 0;
+                }
+                bf_span_position[depth++] = position;
+                break;
+
+            case ']':
+                if (depth == 0) {
+                    return position == 0;
+                }
+                if (bf_span_position[--depth] != position) {
+                    return 0;
+                }
+                break;
+
+            default:
+                break;
+        }
+    }
+    return 0;
+}
+
+/* Replace the instructions from index start onwards with a single op */
+static void bf_replace(bf_program* program, size_t start, uint8_t op, int arg, int offset) {
+    program->code[start].op = op;
+    program->code[start].arg = arg;
+    program->code[start].offset = offset;
+    program->length = start + 1;
+}
+
+/* Inverse of an odd number modulo 2^32. It is also the inverse modulo
+ * 2^16 and 2^8, so one multiplier serves every cell width. */
+static unsigned int bf_inverse(unsigned int value) {
+    unsigned int inverse = value;  /* Correct in the low 3 bits */
+    for (int i = 0; i < 4; i++) {
+        inverse *= 2 - value * inverse;  /* Doubles the correct bits */
+    }
+    return inverse;
+}
+
+/* Read the loop whose JZ is at index open as a multiply loop: only ADD
+ * and MOVE, returning to where it started, with the counter changing by
+ * an odd step. Fills bf_idiom_offset and bf_idiom_delta, and sets
+ * *multiplier to the factor of each delta and *lowest and *highest to
+ * the cells the pointer visits or writes, relative to the counter. Moves
+ * that may stop at an edge are only read past if edges is set: the loop
+ * then multiplies only while none of them does.
+ * Returns the number of cells touched, or 0 if it is no multiply loop. */
+static size_t bf_read_multiply(const bf_program* program, size_t open, int edges,
+                               unsigned int* multiplier, int* lowest, int* highest) {
+    const bf_insn* body = program->code + open + 1;
+    size_t body_length = program->length - open - 1;
+    size_t cells = 0;
+    int position = 0;
+    int step = 0;
+
+    *lowest = 0;
+    *highest = 0;
+    for (size_t i = 0; i < body_length; i++) {
+        int target = position + body[i].offset;
+
+        if (body[i].op == BF_OP_MOVE) {
+            if (bf_move_edge[open + 1 + i] && !edges) {
+                return 0;
+            }
+            position += body[i].arg;
+            target = position;
+        } else if (body[i].op != BF_OP_ADD) {
+            return 0;
+        }
+        if (target > BF_TAPE_GUARD || target < -BF_TAPE_GUARD) {
+            return 0;
+        }
+        *highest = (target > *highest) ? target : *highest;
+        *lowest = (target < *lowest) ? target : *lowest;
+        if (body[i].op == BF_OP_ADD) {
+            size_t j = 0;
+            while (j < cells && bf_idiom_offset[j] != target) {
+                j++;
+            }
+            if (j == cells) {
+                if (cells == BF_MAX_IDIOM_CELLS) {
+                    return 0;
+                }
+                bf_idiom_offset[cells] = target;
+                bf_idiom_delta[cells] = 0;
+                cells++;
+            }
+            bf_idiom_delta[j] += body[i].arg;
+        }
+    }
+
+    /* Cells a whole tape apart would be one cell on a wrapping tape */
+    if (position != 0 || (size_t)(*highest - *lowest) >= program->variant.tape_cells) {
+        return 0;
+    }
+
+    /* The loop counter must change by an odd step: the loop then runs
+     * -cell / step times modulo the cell size, so each target cell gains
+     * cell * (-delta / step) */
+    for (size_t j = 0; j < cells; j++) {
+        if (bf_idiom_offset[j] == 0) {
+            step = bf_idiom_delta[j];
+        }
+    }
+    if ((step & 1) == 0) {
+        return 0;
+    }
+    *multiplier = 0u - bf_inverse((unsigned int)step);
+    return cells;
+}
+
+/* Instructions the multiply loop read by bf_read_multiply becomes: a
+ * MULADD per target cell the loop changes, then the SET of the counter */
+static size_t bf_multiply_length(size_t cells) {
+    size_t length = 1;
+
+    for (size_t j = 0; j < cells; j++) {
+        if (bf_idiom_offset[j] != 0 && bf_idiom_delta[j] != 0) {
+            length++;
+        }
+    }
+    return length;
+}
+
+/* Write those instructions from index at on, each coming from source
+ * offset origin like the loop's '['. Returns the index of the SET. */
+static size_t bf_put_multiply(bf_program* program, size_t at, size_t cells,
+                              unsigned int multiplier, size_t origin) {
+    bf_insn* code = program->code;
+
+    for (size_t j = 0; j < cells; j++) {
+        if (bf_idiom_offset[j] != 0 && bf_idiom_delta[j] != 0) {
+            code[at].op = BF_OP_MULADD;
+            code[at].arg = (int)(multiplier * (unsigned int)bf_idiom_delta[j]);
+            code[at].offset = bf_idiom_offset[j];
+            bf_move_edge[at] = 0;
+            bf_set_source(program, at++, origin);
+        }
+    }
+    code[at].op = BF_OP_SET;
+    code[at].arg = 0;
+    code[at].offset = 0;
+    bf_move_edge[at] = 0;
+    bf_set_source(program, at, origin);
+    return at;
+}
+
+/* Recognize common loop shapes and turn them into single operations.
+ * The loop body spans from the JZ at index open to the end of the program.
+ *   [-] [+]              -> SET 0 (any odd step reaches zero)
+ *   [->+<] [->++>+++<<]  -> MULADD per target cell, then SET 0
+ *   [--->+<]             -> MULADD by the counter step's modular inverse
+ *   [>] [<] [>>]         -> SCAN with the move as stride
+ *   [.>] [.<<]           -> PRINT with the move as stride
+ * Returns 1 if the loop was replaced, 0 if it must stay a loop. */
+static int bf_match_idiom(bf_program* program, size_t open) {
+    bf_insn* body = program->code + open + 1;
+    size_t body_length = program->length - open - 1;
+    size_t cells;
+    int lowest;
+    int highest;
+    unsigned int multiplier;
+
+    if (body_length == 1 && body[0].op == BF_OP_ADD && body[0].offset == 0 && (body[0].arg & 1)) {
+        bf_replace(program, open, BF_OP_SET, 0, 0);
+        return 1;
+    }
+
+    if (body_length == 1 && body[0].op == BF_OP_MOVE) {
+        bf_replace(program, open, BF_OP_SCAN, body[0].arg, 0);
+        return 1;
+    }
+
+    if (body_length == 2 && body[0].op == BF_OP_OUT && body[0].offset == 0 &&
+        body[1].op == BF_OP_MOVE) {
+        bf_replace(program, open, BF_OP_PRINT, body[1].arg, 0);
+        return 1;
+    }
+
+    /* Multiply loop, without stopping at an edge. Rewrite in place: the
+     * body is always longer than its replacement. */
+    cells = bf_read_multiply(program, open, 0, &multiplier, &lowest, &highest);
+    if (cells == 0) {
+        return 0;
+    }
+    program->length = bf_put_multiply(program, open, cells, multiplier,
+                                      program->source ? program->source[open] : 0) + 1;
+    return 1;
+}
+
+/* A multiply loop whose moves may stop at an edge still multiplies when
+ * every cell it visits is on the tape as it starts. If the loop whose JZ
+ * is at index open is one, insert its MULADDs and SET in front of the JZ
+ * behind a FITS for each side of the counter it reaches; the loop stays
+ * as the fallback, as for library routines. The program may grow to
+ * limit instructions, its JNZ included.
+ * Returns the number of instructions inserted (the JZ moves along), or 0. */
+static size_t bf_guard_multiply(bf_program* program, size_t open, size_t limit) {
+    bf_insn* code = program->code;
+    size_t cells;
+    size_t count;
+    size_t at = open;
+    int lowest;
+    int highest;
+    unsigned int multiplier;
+
+    cells = bf_read_multiply(program, open, 1, &multiplier, &lowest, &highest);
+    if (cells == 0) {
+        return 0;
+    }
+    count = bf_multiply_length(cells) + (lowest < 0) + (highest > 0);
+    if (program->length + count + 1 > limit) {
+        return 0;
+    }
+
+    /* Make room; the body holds no jumps */
+    for (size_t i = program->length; i-- > open;) {
+        bf_copy_insn(program, i + count, i);
+    }
+    program->length += count;
+
+    for (int side = -1; side <= 1; side += 2) {
+        int offset = (side < 0) ? lowest : highest;
+        if (offset != 0) {
+            code[at].op = BF_OP_FITS;
+            code[at].arg = (int)(open + count - 1);  /* The SET */
+            code[at].offset = offset;
+            bf_move_edge[at] = 0;
+            bf_set_source(program, at, program->source ? program->source[open + count] : 0);
+            at++;
+        }
+    }
+    bf_put_multiply(program, at, cells, multiplier,
+                    program->source ? program->source[open + count] : 0);
+    return count;
+}
+
+/* Value of the cell at the pointer when execution reaches index at, if
+ * the straight-line code before it fixes it: a SET, a loop or scan that
+ * stopped on the cell, or the all-zero tape at program start. It gives up
+ * at a move that may stop at an edge, and when the cells written span the
+ * whole tape and could wrap onto the cell.
+ * Returns 1 and sets *value if the value is known. */
+static int bf_known_value(const bf_program* program, size_t at, int* value) {
+    int relative = 0;  /* The cell's offset from the pointer at index i */
+    int highest = 0;   /* Cells written, relative to the cell */
+    int lowest = 0;
+    int sum = 0;
+    int anchored = 0;  /* Stopped at a SET, loop or scan, not program start */
+
+    for (size_t i = at; i-- > 0 && !anchored;) {
+        const bf_insn* insn = &program->code[i];
+
+        if (insn->op == BF_OP_ADD || insn->op == BF_OP_SET || insn->op == BF_OP_IN ||
+            insn->op == BF_OP_MULADD) {
+            if (insn->offset - relative > highest) {
+                highest = insn->offset - relative;
+            }
+            if (insn->offset - relative < lowest) {
+                lowest = insn->offset - relative;
+            }
+        }
+
+        if (insn->op == BF_OP_MOVE) {
+            if (bf_move_edge[i]) {
+                return 0;
+            }
+            relative += insn->arg;
+        } else if (insn->op == BF_OP_ADD) {
+            if (insn->offset == relative) {
+                sum += insn->arg;
+            }
+        } else if (insn->op == BF_OP_SET) {
+            if (insn->offset == relative) {
+                sum += insn->arg;
+                anchored = 1;
+            }
+        } else if (insn->op == BF_OP_IN || insn->op == BF_OP_MULADD) {
+            if (insn->offset == relative) {
+                return 0;
+            }
+        } else if (insn->op == BF_OP_JNZ || insn->op == BF_OP_SCAN || insn->op == BF_OP_PRINT) {
+            /* Execution only gets past these with the pointer on a zero
+             * cell: a scan or print stuck on a nonzero edge cell spins */
+            if (relative != 0) {
+                return 0;
+            }
+            anchored = 1;
+        } else if (insn->op != BF_OP_OUT) {
+            return 0;  /* Start of an enclosing loop's body */
+        }
+    }
+
+    /* Unanchored, the walk reached program start on an all-zero tape */
+    if ((size_t)(highest - lowest) >= program->variant.tape_cells) {
+        return 0;
+    }
+    *value = sum;
+    return 1;
+}
+
+/* Fully unroll the loop whose JZ is at index open if its iteration count
+ * is known at compile time: its counter (the cell at the pointer) has a
+ * known value on entry and the straight-line body returns to where it
+ * started, changing the counter only by an odd total of ADDs, with no
+ * move that may stop at an edge. The count must be the same for every
+ * cell width, and the unrolled program must fit in limit instructions.
+ * Loops entered on a zero cell never run and disappear whatever their
+ * body, which removes leading comment loops.
+ * Returns 1 if the loop was unrolled. */
+static int bf_unroll_loop(bf_program* program, size_t open, size_t limit) {
+    bf_insn* code = program->code;
+    size_t body_length = program->length - open - 1;
+    int position = 0;
+    int highest = 0;  /* Cells written, relative to the counter */
+    int lowest = 0;
+    int step = 0;
+    int start;
+    unsigned int count;
+
+    if (!bf_known_value(program, open, &start)) {
+        return 0;
+    }
+    if (start == 0) {
+        program->length = open;
+        return 1;
+    }
+
+    for (size_t i = 0; i < body_length; i++) {
+        const bf_insn* insn = &code[open + 1 + i];
+        int target = position + insn->offset;
+
+        if (insn->op != BF_OP_MOVE && insn->op != BF_OP_OUT) {
+            highest = (target > highest) ? target : highest;
+            lowest = (target < lowest) ? target : lowest;
+        }
+
+        switch (insn->op) {
+            case BF_OP_MOVE:
+                if (bf_move_edge[open + 1 + i]) {
+                    return 0;
+                }
+                position += insn->arg;
+                break;
+
+            case BF_OP_ADD:
+                if (target == 0) {
+                    step += insn->arg;
+                }
+                break;
+
+            case BF_OP_OUT:
+                break;
+
+            case BF_OP_SET:
+            case BF_OP_IN:
+            case BF_OP_MULADD:
+                if (target == 0) {
+                    return 0;
+                }
+                break;
+
+            default:
+                return 0;  /* Inner loop, scan or print */
+        }
+    }
+
+    /* A write a whole tape away from the counter may be the counter */
+    if (position != 0 || (step & 1) == 0 ||
+        (size_t)(highest - lowest) >= program->variant.tape_cells) {
+        return 0;
+    }
+
+    /* Iterations until start + count * step wraps to zero. A count below
+     * 256 is the same modulo 2^8, 2^16 and 2^32. */
+    count = (0u - (unsigned int)start) * bf_inverse((unsigned int)step);
+    if (count > BF_MAX_UNROLL || open + count * body_length > limit) {
+        return 0;
+    }
+
+    for (size_t i = 0; i < body_length; i++) {
+        bf_copy_insn(program, open + i, open + 1 + i);
+    }
+    for (size_t i = body_length; i < count * body_length; i++) {
+        bf_copy_insn(program, open + i, open + i - body_length);
+    }
+    program->length = open + count * body_length;
+    return 1;
+}
+
+/* Check whether the commands in source[start..end] spell loop, with '<'
+ * and '>' swapped if direction is -1 */
+static int bf_library_matches(const char* source, size_t start, size_t end,
+                              const char* loop, int direction) {
+    for (size_t i = start; i <= end; i++) {
+        char c = source[i];
+
+        if (c != '+' && c != '-' && c != '<' && c != '>' && c != '.' && c != ',' &&
+            c != '[' && c != ']') {
+            continue;
+        }
+        if (direction < 0 && (c == '<' || c == '>')) {
+            c = (c == '<') ? '>' : '<';
+        }
+        if (c != *loop++) {
+            return 0;
+        }
+    }
+    return *loop == '\0';
+}
+
+/* If the loop in source[start..end], whose JZ is at index open, is a
+ * library routine, insert the routine's instruction in front of the JZ.
+ * The loop itself stays as the fallback for when the routine's
+ * preconditions do not hold at run time.
+ * Returns 1 if the routine was inserted (the JZ is now at open + 1). */
+static int bf_match_library(bf_program* program, const char* source, size_t start,
+                            size_t end, size_t open) {
+    bf_insn* code = program->code;
+
+    if (program->length + 1 >= program->capacity) {
+        return 0;
+    }
+
+    for (size_t r = 0; r < BF_LIBRARY_SIZE; r++) {
+        for (int direction = 1; direction >= -1; direction -= 2) {
+            if (!bf_library_matches(source, start, end, bf_library[r].loop, direction)) {
+                continue;
+            }
+
+            /* Make room; jumps inside the loop move along with it */
+            for (size_t i = program->length; i > open; i--) {
+                bf_copy_insn(program, i, i - 1);
+                if ((code[i].op == BF_OP_JZ || code[i].op == BF_OP_JNZ ||
+                     code[i].op == BF_OP_FITS) && i > open + 1) {
+                    code[i].arg++;
+                }
+            }
+            code[open].op = bf_library[r].op;
+            code[open].arg = bf_library[r].arg * direction;
+            code[open].offset = 0;
+            program->length++;
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* A loop replaced by a single SET no longer needs the pointer moved to
+ * its cell first: fold a preceding MOVE that cannot clamp into the SET's
+ * offset and defer it again, so ">[-]<" becomes one offset-addressed SET. */
+static void bf_absorb_move(bf_program* program, int* pending) {
+    bf_insn* code = program->code;
+    size_t last = program->length - 1;
+
+    if (program->length >= 2 && code[last].op == BF_OP_SET && code[last - 1].op == BF_OP_MOVE &&
+        !bf_move_edge[last - 1] &&
+        code[last - 1].arg >= -BF_TAPE_GUARD && code[last - 1].arg <= BF_TAPE_GUARD) {
+        *pending = code[last - 1].arg;
+        bf_pointer_low -= *pending;
+        bf_pointer_high -= *pending;
+        if (program->source) {
+            bf_move_source = program->source[last - 1];
+        }
+        bf_copy_insn(program, last - 1, last);
+        code[last - 1].offset = *pending;
+        program->length--;
+    }
+}
+
+/* Forget every tracked cell; the next address touched is address */
+static void bf_forget_cells(int address) {
+    bf_known_count = 0;
+    bf_known_zero = 0;
+    bf_known_lowest = address;
+    bf_known_highest = address;
+}
+
+/* Tracked cell at address, added (with an unknown value unless the tape
+ * is still all zero) if create is set. Once the addresses touched span
+ * the whole tape, two of them may be the same cell on a wrapping tape,
+ * so everything is forgotten and tracking starts over.
+ * Returns 0 if the cell is not tracked. */
+static bf_known_cell* bf_cell_at(int address, size_t cells, int create) {
+    bf_known_cell* cell;
+
+    if (address < bf_known_lowest) {
+        bf_known_lowest = address;
+    }
+    if (address > bf_known_highest) {
+        bf_known_highest = address;
+    }
+    if ((size_t)(bf_known_highest - bf_known_lowest) >= cells) {
+        bf_forget_cells(address);
+    }
+
+    for (size_t i = 0; i < bf_known_count; i++) {
+        if (bf_known_cells[i].address == address) {
+            return &bf_known_cells[i];
+        }
+    }
+    if (!create) {
+        return 0;
+    }
+    if (bf_known_count == BF_MAX_KNOWN_CELLS) {
+        bf_forget_cells(address);
+    }
+
+    cell = &bf_known_cells[bf_known_count++];
+    cell->address = address;
+    cell->known = bf_known_zero;
+    cell->value = 0;
+    cell->store = BF_NO_INSN;
+    return cell;
+}
+
+/* The store at index store is overwritten before anything read it */
+static void bf_kill_store(size_t store) {
+    if (store != BF_NO_INSN) {
+        bf_insn_map[store] = BF_NO_INSN;
+    }
+}
+
+/* Apply the ADD at index to cell: on a known value it becomes a SET of
+ * the sum and makes the cell's unread store dead */
+static void bf_fold_add(bf_insn* insn, size_t index, bf_known_cell* cell) {
+    if (cell->known) {
+        cell->value += (unsigned int)insn->arg;
+        insn->op = BF_OP_SET;
+        insn->arg = (int)cell->value;
+        bf_kill_store(cell->store);
+    }
+    cell->store = index;
+}
+
+/* Constant propagation over the compiled program. Within each block it
+ * tracks the cells whose value is known - from a SET, a loop or scan that
+ * stopped on the cell, or the all-zero tape at program start - and
+ *   turns an ADD to a known cell into a SET of the sum ("[-]+++" is SET 3),
+ *   turns a MULADD from a known cell into an ADD (or nothing),
+ *   drops SETs that store the value a cell already has,
+ *   drops SETs, ADDs and MULADDs whose result is overwritten unread,
+ *   drops loops, library routines and guarded multiplies entered on a
+ *   known zero cell.
+ * A move that may stop at an edge ends the block like a loop does.
+ * Values count as known only modulo 2^32, so the result holds for every
+ * cell width. */
+static void bf_propagate_constants(bf_program* program) {
+    bf_insn* code = program->code;
+    size_t cells = program->variant.tape_cells;
+    int position = 0;
+    size_t length = 0;
+    bf_known_cell* cell;
+    bf_known_cell* source;
+
+    bf_forget_cells(0);
+    bf_known_zero = 1;
+
+    for (size_t i = 0; i < program->length; i++) {
+        bf_insn_map[i] = 0;
+    }
+
+    for (size_t i = 0; code[i].op != BF_OP_END; i++) {
+        bf_insn* insn = &code[i];
+
+        switch (insn->op) {
+            case BF_OP_MOVE:
+                if (bf_move_edge[i]) {
+                    position = 0;
+                    bf_forget_cells(0);
+                    break;
+                }
+                position += insn->arg;
+                /* From program start the pointer is exact; past an edge
+                 * the move wraps and addresses no longer hold */
+                if (bf_known_zero && (position < 0 || position >= (int)cells)) {
+                    bf_forget_cells(position);
+                }
+                break;
+
+            case BF_OP_MULADD:
+                source = bf_cell_at(position, cells, 1);
+                if (source->known) {
+                    /* A constant times a constant */
+                    if (source->value * (unsigned int)insn->arg == 0) {
+                        bf_insn_map[i] = BF_NO_INSN;
+                    } else {
+                        insn->op = BF_OP_ADD;
+                        insn->arg = (int)(source->value * (unsigned int)insn->arg);
+                        bf_fold_add(insn, i, bf_cell_at(position + insn->offset, cells, 1));
+                    }
+                    break;
+                }
+                source->store = BF_NO_INSN;
+                cell = bf_cell_at(position + insn->offset, cells, 1);
+                cell->known = 0;
+                cell->store = i;
+                break;
+
+            case BF_OP_ADD:
+                bf_fold_add(insn, i, bf_cell_at(position + insn->offset, cells, 1));
+                break;
+
+            case BF_OP_SET:
+                cell = bf_cell_at(position + insn->offset, cells, 1);
+                if (cell->known && cell->value == (unsigned int)insn->arg) {
+                    bf_insn_map[i] = BF_NO_INSN;
+                    break;
+                }
+                bf_kill_store(cell->store);
+                cell->known = 1;
+                cell->value = (unsigned int)insn->arg;
+                cell->store = i;
+                break;
+
+            case BF_OP_IN:
+                /* Input is consumed even if the value is not used */
+                cell = bf_cell_at(position + insn->offset, cells, 1);
+                bf_kill_store(cell->store);
+                cell->known = 0;
+                cell->store = BF_NO_INSN;
+                break;
+
+            case BF_OP_OUT:
+                cell = bf_cell_at(position + insn->offset, cells, 0);
+                if (cell) {
+                    cell->store = BF_NO_INSN;
+                }
+                break;
+
+            case BF_OP_JZ:
+                cell = bf_cell_at(position, cells, 1);
+                if (cell->known && cell->value == 0) {
+                    /* Never entered; nothing about the tape changes */
+                    for (size_t j = i; j <= (size_t)insn->arg; j++) {
+                        bf_insn_map[j] = BF_NO_INSN;
+                    }
+                    i = (size_t)insn->arg;
+                    break;
+                }
+                position = 0;
+                bf_forget_cells(0);
+                break;
+
+            case BF_OP_FITS:
+                /* The guarded instructions may not run, so nothing is
+                 * learnt from them, and the loop after them is entered
+                 * whenever they did not run; on a known zero cell none of
+                 * it runs */
+                cell = bf_cell_at(position, cells, 1);
+                if (cell->known && cell->value == 0) {
+                    for (size_t j = i; j <= (size_t)insn->arg; j++) {
+                        bf_insn_map[j] = BF_NO_INSN;
+                    }
+                } else {
+                    position = 0;
+                    bf_forget_cells(0);
+                }
+                i = (size_t)insn->arg;
+                break;
+
+            case BF_OP_DIVMOD:
+            case BF_OP_COMPARE:
+                /* Both leave the tape alone when the cell is zero */
+                cell = bf_cell_at(position, cells, 1);
+                if (cell->known && cell->value == 0) {
+                    bf_insn_map[i] = BF_NO_INSN;
+                    break;
+                }
+                position = 0;
+                bf_forget_cells(0);
+                break;
+
+            default:
+                /* Past a JNZ, SCAN or PRINT the cell at the pointer is
+                 * zero; on a nonzero edge cell the last two never end */
+                position = 0;
+                bf_forget_cells(0);
+                cell = bf_cell_at(0, cells, 1);
+                cell->known = 1;
+                break;
+        }
+    }
+
+    /* Drop deleted instructions and relink the loops that remain */
+    for (size_t i = 0; i < program->length; i++) {
+        if (bf_insn_map[i] != BF_NO_INSN) {
+            bf_insn_map[i] = length++;
+        }
+    }
+    for (size_t i = 0; i < program->length; i++) {
+        if (bf_insn_map[i] != BF_NO_INSN) {
+            bf_insn* insn = &code[bf_insn_map[i]];
+            bf_copy_insn(program, bf_insn_map[i], i);
+            if (insn->op == BF_OP_JZ || insn->op == BF_OP_JNZ || insn->op == BF_OP_FITS) {
+                insn->arg = (int)bf_insn_map[insn->arg];
+            }
+        }
+    }
+    program->length = length;
+}
+
+/* Number of instructions superinstruction super covers if its ops start
+ * at index i, or 0. The END at the end of code never matches. */
+static size_t bf_super_matches(const bf_insn* code, size_t i, size_t super) {
+    size_t length = 0;
+
+    while (bf_super_ops[super][length] != BF_OP_END) {
+        if (code[i + length].op != bf_super_ops[super][length]) {
+            return 0;
+        }
+        length++;
+    }
+    return length;
+}
+
+/* Pick the engine dispatch code of every instruction: the first
+ * superinstruction whose ops start there, or else its own op.
+ * Instructions inside a superinstruction keep their own op as well, so
+ * jumps can still land on them. */
+static void bf_select_dispatch(bf_program* program) {
+    bf_insn* code = program->code;
+    size_t i = 0;
+
+    while (i < program->length) {
+        size_t length = 0;
+
+        code[i].dispatch = code[i].op;
+        for (size_t super = 0; super < BF_SUPER_COUNT && length == 0; super++) {
+            length = bf_super_matches(code, i, super);
+            if (length) {
+                code[i].dispatch = (uint8_t)(BF_OP_SUPER + super);
+            }
+        }
+        for (size_t j = 1; j < length; j++) {
+            code[i + j].dispatch = code[i + j].op;
+        }
+        i += length ? length : 1;
+    }
+}
+
+/* Length of the directive word at source that matches word, or 0.
+ * A word ends at a blank, a newline or the end of the source. */
+static size_t bf_directive_word(const char* source, const char* word) {
+    size_t i = 0;
+    while (word[i] != '\0') {
+        if (source[i] != word[i]) {
+            return 0;
+        }
+        i++;
+    }
+    if (source[i] != ' ' && source[i] != '\t' && source[i] != '\n' && source[i] != '\0') {
+        return 0;
+    }
+    return i;
+}
+
+/* Parse an optional first-line engine directive such as
+ *   #bf cell=16 tape=65536 wrap
+ * into program->variant; without one the program gets 8-bit cells on a
+ * clamped tape of BF_TAPE_CELLS. The directive line is not compiled.
+ * Returns the offset of the first source character to compile, or -1 on
+ * error (already reported). */
+static int bf_parse_directive(const char* source, bf_program* program) {
+    bf_variant* variant = &program->variant;
+    size_t i = 3;
+
+    variant->cell_bits = 8;
+    variant->bounds = BF_BOUNDS_CLAMP;
+    variant->tape_cells = BF_TAPE_CELLS;
+
+    if (source[0] != '#' || source[1] != 'b' || source[2] != 'f' ||
+        (source[3] != ' ' && source[3] != '\t' && source[3] != '\n' && source[3] != '\0')) {
+        return 0;
+    }
+
+    while (source[i] != '\n' && source[i] != '\0') {
+        size_t length;
+
+        if (source[i] == ' ' || source[i] == '\t') {
+            i++;
+            continue;
+        }
+
+        if ((length = bf_directive_word(source + i, "cell=8")) != 0) {
+            variant->cell_bits = 8;
+        } else if ((length = bf_directive_word(source + i, "cell=16")) != 0) {
+            variant->cell_bits = 16;
+        } else if ((length = bf_directive_word(source + i, "cell=32")) != 0) {
+            variant->cell_bits = 32;
+        } else if ((length = bf_directive_word(source + i, "wrap")) != 0) {
+            variant->bounds = BF_BOUNDS_WRAP;
+        } else if ((length = bf_directive_word(source + i, "clamp")) != 0) {
+            variant->bounds = BF_BOUNDS_CLAMP;
+        } else if (source[i] == 't' && source[i + 1] == 'a' && source[i + 2] == 'p' &&
+                   source[i + 3] == 'e' && source[i + 4] == '=' &&
+                   source[i + 5] >= '0' && source[i + 5] <= '9') {
+            size_t cells = 0;
+            length = 5;
+            while (source[i + length] >= '0' && source[i + length] <= '9') {
+                if (cells <= BF_TAPE_MEMORY) {  /* Stop growing once too long */
+                    cells = cells * 10 + (size_t)(source[i + length] - '0');
+                }
+                length++;
+            }
+            if (source[i + length] != ' ' && source[i + length] != '\t' &&
+                source[i + length] != '\n' && source[i + length] != '\0') {
+                length = 0;  /* Junk after the number */
+            }
+            variant->tape_cells = cells;
+        } else {
+            length = 0;
+        }
+
+        if (length == 0) {
+            bf_compile_error("unknown #bf setting", i);
+            return -1;
+        }
+        i += length;
+    }
+
+    if (!bf_variant_valid(variant)) {
+        bf_compile_error("#bf tape length out of range", 0);
+        return -1;
+    }
+    return (int)i;
+}
+
+/* Compile Brainfuck source into IR.
+ * Validates bracket balance before anything runs.
+ * Returns 0 on success, -1 on error (already reported). */
+int bf_compile(const char* source, bf_program* program) {
+    size_t depth = 0;
+    size_t i;
+    int status = 0;
+    int start;
+    int pending = 0;  /* Pointer movement deferred in the current block */
+    int step;
+    int cells;
+    int matched;
+    size_t limit;
+
+    program->length = 0;
+    program->native = 0;
+    program->native_size = 0;
+
+    start = bf_parse_directive(source, program);
+    if (start < 0) {
+        return -1;
+    }
+    cells = (int)program->variant.tape_cells;
+    bf_pointer_low = 0;
+    bf_pointer_high = 0;
+
+    for (i = (size_t)start; source[i] != '\0' && status == 0; i++) {
+        bf_source_offset = i;
+        switch (source[i]) {
+            case '+':
+                status = bf_emit_at(program, BF_OP_ADD, 1, pending);
+                break;
+
+            case '-':
+                status = bf_emit_at(program, BF_OP_ADD, -1, pending);
+                break;
+
+            case '>':
+            case '<':
+                step = (source[i] == '>') ? 1 : -1;
+                if (!bf_move_fits(program, pending + step)) {
+                    status = bf_clamp_move(program, &pending, step);
+                    break;
+                }
+                if (pending == 0) {
+                    bf_move_source = i;
+                }
+                pending += step;
+                if (pending > BF_TAPE_GUARD || pending < -BF_TAPE_GUARD) {
+                    /* Offsets must stay within the guard band */
+                    status = bf_flush_move(program, &pending);
+                }
+                break;
+
+            case '.':
+                status = bf_emit_at(program, BF_OP_OUT, 0, pending);
+                break;
+
+            case ',':
+                status = bf_emit_at(program, BF_OP_IN, 0, pending);
+                break;
+
+            case '[':
+                if (depth >= BF_MAX_LOOP_DEPTH) {
+                    bf_compile_error("loops nested too deeply", i);
+                    return -1;
+                }
+                status = bf_flush_move(program, &pending);
+                bf_loop_insn[depth] = program->length;
+                bf_loop_source[depth] = i;
+                bf_loop_low[depth] = bf_pointer_low;
+                bf_loop_high[depth] = bf_pointer_high;
+                bf_loop_stays[depth] = bf_loop_fits(program, source, i, bf_pointer_low,
+                                                    bf_pointer_high);
+                if (!bf_loop_stays[depth]) {
+                    /* Later iterations may start anywhere */
+                    bf_pointer_low = 0;
+                    bf_pointer_high = cells - 1;
+                }
+                depth++;
+                if (status == 0) {
+                    status = bf_emit(program, BF_OP_JZ, 0);
+                }
+                break;
+
+            case ']':
+                if (depth == 0) {
+                    bf_compile_error("unmatched ']'", i);
+                    return -1;
+                }
+                depth--;
+                status = bf_flush_move(program, &pending);
+                if (status != 0) {
+                    break;
+                }
+                matched = bf_match_idiom(program, bf_loop_insn[depth]);
+
+                /* The loop leaves the pointer where it found it, or
+                 * anywhere - a scan or print anywhere on its side */
+                bf_pointer_low = bf_loop_low[depth];
+                bf_pointer_high = bf_loop_high[depth];
+                if (!bf_loop_stays[depth]) {
+                    const bf_insn* insn = &program->code[bf_loop_insn[depth]];
+                    int way = (matched && (insn->op == BF_OP_SCAN || insn->op == BF_OP_PRINT))
+                                  ? insn->arg : 0;
+                    if (way <= 0) {
+                        bf_pointer_low = 0;
+                    }
+                    if (way >= 0) {
+                        bf_pointer_high = cells - 1;
+                    }
+                }
+                if (matched) {
+                    bf_absorb_move(program, &pending);
+                    break;
+                }
+                /* Unrolling may use up to BF_INSNS_PER_CHAR instructions per
+                 * character read so far, keeping room for END */
+                limit = BF_INSNS_PER_CHAR * (i + 1);
+                if (limit > program->capacity - 1) {
+                    limit = program->capacity - 1;
+                }
+                if (bf_unroll_loop(program, bf_loop_insn[depth], limit)) {
+                    break;
+                }
+                if (bf_match_library(program, source, bf_loop_source[depth], i,
+                                     bf_loop_insn[depth])) {
+                    bf_loop_insn[depth]++;
+                } else {
+                    bf_loop_insn[depth] += bf_guard_multiply(program, bf_loop_insn[depth], limit);
+                }
+                status = bf_emit(program, BF_OP_JNZ, (int)bf_loop_insn[depth]);
+                if (status == 0) {
+                    program->code[bf_loop_insn[depth]].arg = (int)(program->length - 1);
+                }
+                break;
+
+            default:
+                /* Ignore non-BF characters (comments) */
+                break;
+        }
+    }
+
+    if (status == 0) {
+        status = bf_flush_move(program, &pending);
+    }
+
+    if (status != 0) {
+        bf_compile_error("program too large", i - 1);
+        return -1;
+    }
+
+    if (depth > 0) {
+        bf_compile_error("unmatched '['", bf_loop_source[depth - 1]);
+        return -1;
+    }
+
+    program->code[program->length].op = BF_OP_END;
+    program->code[program->length].arg = 0;
+    program->code[program->length].offset = 0;
+    bf_set_source(program, program->length, i);
+    program->length++;
+
+    bf_propagate_constants(program);
+    bf_select_dispatch(program);
+    return 0;
+}
+
+/* Report a precompiled image that cannot be used */
+static void bf_image_error(const char* message) {
+    terminal_setcolor(vga_entry(COLOR_YELLOW, COLOR_BLACK));
+    terminal_writestring("[BF] Ignoring precompiled image: ");
+    terminal_writestring(message);
+    terminal_putchar('\n');
+    terminal_setcolor(vga_entry(COLOR_LIGHT_GREEN, COLOR_BLACK));
+}
+
+/* Use a precompiled image in place of compiling source. The IR is
+ * checked as thoroughly as bf_compile would build it - matching loop
+ * links, known opcodes, offsets inside the tape guard - and so is its
+ * evaluated prefix, so a damaged or mismatched image is rejected rather
+ * than run. program->code points at the image afterwards and must not be
+ * written.
+ * Returns 0 on success, -1 if the image was rejected (already reported). */
+int bf_load_image(const bf_image* image, bf_program* program) {
+    const bf_insn* code = image->code;
+    size_t length = image->length;
+    const bf_prefix* prefix = image->prefix;
+    size_t cells = image->variant.tape_cells;
+
+    if (image->magic != BF_IMAGE_MAGIC || image->version != BF_IMAGE_VERSION) {
+        bf_image_error("built for a different kernel");
+        return -1;
+    }
+
+    if (length == 0 || length > BF_MAX_INSNS || code[length - 1].op != BF_OP_END ||
+        code[length - 1].dispatch != BF_OP_END) {
+        bf_image_error("bad length");
+        return -1;
+    }
+
+    for (size_t i = 0; i + 1 < length; i++) {
+        const bf_insn* insn = &code[i];
+        size_t target = (size_t)insn->arg;
+        int valid;
+
+        switch (insn->op) {
+            case BF_OP_MOVE:
+                valid = 1;
+                break;
+
+            case BF_OP_ADD:
+            case BF_OP_OUT:
+            case BF_OP_IN:
+            case BF_OP_SET:
+            case BF_OP_MULADD:
+                valid = insn->offset >= -BF_TAPE_GUARD && insn->offset <= BF_TAPE_GUARD;
+                break;
+
+            case BF_OP_JZ:
+                valid = insn->arg > 0 && target > i && target < length &&
+                        code[target].op == BF_OP_JNZ && (size_t)code[target].arg == i;
+                break;
+
+            case BF_OP_JNZ:
+                valid = insn->arg >= 0 && target < i &&
+                        code[target].op == BF_OP_JZ && (size_t)code[target].arg == i;
+                break;
+
+            case BF_OP_SCAN:
+            case BF_OP_PRINT:
+                valid = insn->arg != 0;
+                break;
+
+            case BF_OP_DIVMOD:
+                valid = insn->arg == 1 || insn->arg == -1 || insn->arg == 2 || insn->arg == -2;
+                break;
+
+            case BF_OP_COMPARE:
+                valid = insn->arg == 1 || insn->arg == -1;
+                break;
+
+            case BF_OP_FITS:
+                valid = insn->offset != 0 && insn->offset >= -BF_TAPE_GUARD &&
+                        insn->offset <= BF_TAPE_GUARD && target > i && target + 1 < length;
+                break;
+
+            default:
+                valid = 0;  /* Unknown opcode, or END before the end */
+                break;
+        }
+
+        /* The engine runs the dispatch code, so it must agree with the ops */
+        if (valid && insn->dispatch != insn->op) {
+            valid = insn->dispatch >= BF_OP_SUPER &&
+                    insn->dispatch - BF_OP_SUPER < BF_SUPER_COUNT &&
+                    bf_super_matches(code, i, insn->dispatch - BF_OP_SUPER);
+        }
+
+        if (!valid) {
+            bf_image_error("corrupt instruction");
+            return -1;
+        }
+    }
+
+    if (!bf_variant_valid(&image->variant)) {
+        bf_image_error("unsupported engine variant");
+        return -1;
+    }
+
+    /* An evaluated prefix must resume inside the program and restore
+     * cells that lie on the tape */
+    if (prefix && (prefix->resume >= length || prefix->pointer >= cells ||
+                   prefix->tape_first > cells || prefix->tape_cells > cells - prefix->tape_first)) {
+        bf_image_error("bad prefix");
+        return -1;
+    }
+
+    program->code = (bf_insn*)code;
+    program->variant = image->variant;
+    program->length = length;
+    program->capacity = length;
+    program->native = 0;
+    program->native_size = 0;
+    program->source = 0;
+    return 0;
+}
@@ -0,0 +1,385 @@
+/* Brainfuck Engine Template
+ * Instantiated by bf_interpreter.c once per engine variant. Define before
+ * including:
+ *   BF_ENGINE_NAME - name of the engine function
+ *   BF_CELL        - unsigned cell type
+ *   BF_CELL_IS_BYTE - 1 if BF_CELL is uint8_t (scans use bf_scan_tape)
+ *   BF_WRAP        - 1 if moves wrap around the tape ends, 0 to clamp
+ *   BF_THREADED    - 1 to thread the code (below), 0 to use a switch
+ *   BF_PROFILE     - 1 to count each instruction run in bf_profile_counts
+ *                    (switch engines only)
+ * Cell width and bounds policy are fixed at compile time, so the loop
+ * does no per-instruction checks for either.
+ *
+ * Instructions are dispatched on their dispatch code rather than their
+ * op, so the superinstructions chosen in bf_super.h run as one case.
+ * Threaded engines run a copy of the program in the context's
+ * bf_threaded_code, made on the first threaded step after the program
+ * was loaded, with the address of each dispatch code's handler in place
+ * of the code; every handler then ends by jumping straight to the
+ * next instruction's handler, with no bounds check and one indirect
+ * branch per handler for the CPU to predict. Profiling engines dispatch
+ * on the op instead, so every instruction is counted on its own.
+ *
+ * The engine runs program from IR index start on context's tape, whose
+ * cells start BF_TAPE_GUARD cells into its memory, and leaves the final
+ * pointer in the context. When the context has a budget, each repeat of
+ * a loop charges the loop body's length to it, and the engine pauses
+ * where the budget runs out; it also pauses on a ',' whose input is not
+ * ready and on a '.' that finds its output buffer full and the write
+ * endpoint taking no more. Returns the IR index to continue at: the END
+ * instruction once the program has finished.
+ */
+
+/* Cell at offset from the pointer */
+#if BF_WRAP
+#define BF_CELL_AT(offset) tape[bf_move_wrap(pointer, (offset), cells)]
+#else
+#define BF_CELL_AT(offset) (tape + pointer)[offset]
+#endif
+
+/* Bodies of the ops that superinstructions (bf_super.h) combine, run on
+ * the instruction at insn. Jumps leave insn on the instruction before the
+ * one to run next, so they can only end a superinstruction. */
+#define BF_DO_ADD() (BF_CELL_AT(insn->offset) += (BF_CELL)insn->arg)
+#if BF_WRAP
+#define BF_DO_MOVE() (pointer = bf_move_wrap(pointer, insn->arg, cells))
+#else
+#define BF_DO_MOVE() (pointer = bf_move(pointer, insn->arg, cells), bf_mark(dirty, pointer))
+#endif
+#define BF_DO_OUT() \
+    do { \
+        if (bf_context_full(context)) { \
+            BF_PAUSE(); \
+        } \
+        bf_context_putchar(context, (char)BF_CELL_AT(insn->offset)); \
+    } while (0)
+#define BF_DO_SET() (BF_CELL_AT(insn->offset) = (BF_CELL)insn->arg)
+#define BF_DO_MULADD() \
+    (BF_CELL_AT(insn->offset) += (BF_CELL)((unsigned int)tape[pointer] * (unsigned int)insn->arg))
+#define BF_DO_JZ() (insn = (tape[pointer] == 0) ? code + insn->arg : insn)
+#define BF_DO_JNZ() \
+    do { \
+        if (tape[pointer] != 0) { \
+            size_t body = (size_t)(insn - code) - (size_t)insn->arg; \
+            if (budget != 0) { \
+                if (budget <= body) { \
+                    context->ops += context->budget - budget; \
+                    context->pointer = pointer; \
+                    return (size_t)insn->arg + 1; \
+                } \
+                budget -= body; \
+            } \
+            insn = code + insn->arg; \
+        } \
+    } while (0)
+
+/* Stop on the instruction at insn, to run it when resumed */
+#define BF_PAUSE() \
+    do { \
+        context->ops += context->budget - budget; \
+        context->pointer = pointer; \
+        return (size_t)(insn - code); \
+    } while (0)
+
+/* Run the SCAN or PRINT at insn again, as the next repeat of a loop that
+ * stopped on a nonzero cell - for good if the cell is a tape edge the
+ * loop's moves clamp to. The repeat is charged to the budget like a
+ * one-instruction loop body; without a budget the engine keeps
+ * repeating, forever on such an edge, as the loop would. */
+#define BF_SPIN() \
+    do { \
+        if (budget != 0) { \
+            if (budget <= 1) { \
+                BF_PAUSE(); \
+            } \
+            budget -= 1; \
+        } \
+        goto BF_AGAIN; \
+    } while (0)
+
+/* Handler entry and exit (BF_SUPER_CASE likewise for bf_super.h) */
+#if BF_THREADED
+#define BF_CASE(op) bf_handler_##op:
+#define BF_SUPER_CASE(index) bf_handler_super_##index:
+#define BF_NEXT() do { insn++; goto *insn->handler; } while (0)
+#define BF_AGAIN *insn->handler
+#else
+#define BF_CASE(op) case BF_OP_##op:
+#define BF_SUPER_CASE(index) case BF_OP_SUPER + index:
+#define BF_NEXT() break
+#define BF_AGAIN bf_again
+#endif
+
+static size_t BF_ENGINE_NAME(bf_context* context, const bf_program* program, size_t start) {
+    BF_CELL* tape = (BF_CELL*)(void*)context->memory + BF_TAPE_GUARD;
+    const size_t cells = context->variant.tape_cells;
+    size_t pointer = context->pointer;
+    bf_dirty* dirty = &context->dirty;
+    unsigned long budget = context->budget;
+#if BF_THREADED
+#define BF_SUPER_LABEL(index) [BF_OP_SUPER + index] = &&bf_handler_super_##index,
+    static const void* const handlers[BF_OP_SUPER + BF_SUPER_COUNT] = {
+        [BF_OP_END] = &&bf_handler_END,
+        [BF_OP_ADD] = &&bf_handler_ADD,
+        [BF_OP_MOVE] = &&bf_handler_MOVE,
+        [BF_OP_OUT] = &&bf_handler_OUT,
+        [BF_OP_IN] = &&bf_handler_IN,
+        [BF_OP_JZ] = &&bf_handler_JZ,
+        [BF_OP_JNZ] = &&bf_handler_JNZ,
+        [BF_OP_SET] = &&bf_handler_SET,
+        [BF_OP_MULADD] = &&bf_handler_MULADD,
+        [BF_OP_SCAN] = &&bf_handler_SCAN,
+        [BF_OP_PRINT] = &&bf_handler_PRINT,
+        [BF_OP_DIVMOD] = &&bf_handler_DIVMOD,
+        [BF_OP_COMPARE] = &&bf_handler_COMPARE,
+        [BF_OP_FITS] = &&bf_handler_FITS,
+        BF_SUPER_LABELS
+    };
+#undef BF_SUPER_LABEL
+    bf_threaded_insn* threaded = bf_threaded_code[context - bf_contexts];
+    const bf_threaded_insn* code = threaded;
+    const bf_threaded_insn* insn = code + start;
+
+    /* Thread the program on the context's first threaded step since it
+     * was loaded. Programs come validated, so every dispatch code has a
+     * handler. */
+    if (context->threaded != handlers) {
+        for (size_t i = 0; i < program->length; i++) {
+            threaded[i].handler = handlers[program->code[i].dispatch];
+            threaded[i].arg = program->code[i].arg;
+            threaded[i].offset = program->code[i].offset;
+        }
+        context->threaded = handlers;
+    }
+#else
+    const bf_insn* code = program->code;
+    const bf_insn* insn = code + start;
+#endif
+
+#if BF_WRAP
+    /* Offset-addressed writes wrap too, so any cell may end up dirty */
+    bf_mark(dirty, 0);
+    bf_mark(dirty, cells - 1);
+#endif
+
+#if BF_THREADED
+    goto *insn->handler;
+#else
+    while (1) {
+bf_again:
+#if BF_PROFILE
+        bf_profile_counts[insn - code]++;
+        switch (insn->op) {
+#else
+        switch (insn->dispatch) {
+#endif
+#endif
+            BF_CASE(ADD)
+                BF_DO_ADD();
+                BF_NEXT();
+
+            BF_CASE(MOVE)
+                BF_DO_MOVE();
+                BF_NEXT();
+
+            BF_CASE(OUT)
+                BF_DO_OUT();
+                BF_NEXT();
+
+            BF_CASE(IN) {
+                int c = bf_context_getchar(context);
+                if (c == BF_READ_WAIT) {
+                    BF_PAUSE();
+                }
+                BF_CELL_AT(insn->offset) = (BF_CELL)c;
+            }
+                BF_NEXT();
+
+            BF_CASE(SET)
+                BF_DO_SET();
+                BF_NEXT();
+
+            BF_CASE(MULADD)
+                BF_DO_MULADD();
+                BF_NEXT();
+
+            BF_CASE(SCAN)
+#if BF_WRAP
+                for (size_t steps = 0; tape[pointer] != 0; steps++) {
+                    if (steps == cells) {
+                        /* Round the tape without finding a zero cell */
+                        BF_SPIN();
+                    }
+                    pointer = bf_move_wrap(pointer, insn->arg, cells);
+                }
+#elif BF_CELL_IS_BYTE
+                pointer = bf_scan_tape(tape, cells, pointer, insn->arg);
+                bf_mark(dirty, pointer);
+                if (tape[pointer] != 0) {
+                    /* Parked on a nonzero edge cell */
+                    BF_SPIN();
+                }
+#else
+                while (tape[pointer] != 0) {
+                    size_t next = bf_move(pointer, insn->arg, cells);
+                    if (next == pointer) {
+                        /* Parked on a nonzero edge cell */
+                        bf_mark(dirty, pointer);
+                        BF_SPIN();
+                    }
+                    pointer = next;
+                }
+                bf_mark(dirty, pointer);
+#endif
+                BF_NEXT();
+
+            BF_CASE(PRINT)
+#if BF_CELL_IS_BYTE && !BF_WRAP
+                pointer = bf_context_print(context, tape, cells, pointer, insn->arg);
+                bf_mark(dirty, pointer);
+                if (tape[pointer] != 0) {
+                    /* Stopped on a cell still to print: the output is
+                     * blocked, and the rest of the loop runs on resuming,
+                     * or it is a nonzero edge cell the loop prints forever */
+                    if (bf_context_full(context)) {
+                        BF_PAUSE();
+                    }
+                    bf_context_putchar(context, (char)tape[pointer]);
+                    pointer = bf_move(pointer, insn->arg, cells);
+                    bf_mark(dirty, pointer);
+                    BF_SPIN();
+                }
+#else
+                for (size_t steps = 0; tape[pointer] != 0; steps++) {
+                    size_t next;
+
+                    if (bf_context_full(context)) {
+                        bf_mark(dirty, pointer);
+                        BF_PAUSE();
+                    }
+                    bf_context_putchar(context, (char)tape[pointer]);
+#if BF_WRAP
+                    next = bf_move_wrap(pointer, insn->arg, cells);
+                    if (steps == cells) {
+                        /* Round the tape without finding a zero cell */
+                        pointer = next;
+                        BF_SPIN();
+                    }
+#else
+                    next = bf_move(pointer, insn->arg, cells);
+                    if (next == pointer) {
+                        /* Parked on a nonzero edge cell */
+                        bf_mark(dirty, pointer);
+                        BF_SPIN();
+                    }
+#endif
+                    pointer = next;
+                }
+#if !BF_WRAP
+                bf_mark(dirty, pointer);
+#endif
+#endif
+                BF_NEXT();
+
+            BF_CASE(DIVMOD) {
+                int stride = (insn->arg > 0) ? 1 : -1;
+                int end = insn->arg + 4 * stride;  /* Last of the zero cells */
+                unsigned int values[4];
+
+                if (bf_cells_fit(pointer, (end < 0) ? end : 0, (end > 0) ? end : 0, cells, BF_WRAP) &&
+                    BF_CELL_AT(end) == 0 && BF_CELL_AT(end - stride) == 0) {
+                    values[0] = BF_CELL_AT(0);
+                    values[1] = BF_CELL_AT(insn->arg);
+                    values[2] = BF_CELL_AT(insn->arg + stride);
+                    values[3] = BF_CELL_AT(insn->arg + 2 * stride);
+                    if (bf_divmod(values, (BF_CELL)~0u)) {
+                        if (insn->arg != stride) {
+                            BF_CELL_AT(stride) += (BF_CELL)BF_CELL_AT(0);
+                        }
+                        BF_CELL_AT(0) = (BF_CELL)values[0];
+                        BF_CELL_AT(insn->arg) = (BF_CELL)values[1];
+                        BF_CELL_AT(insn->arg + stride) = (BF_CELL)values[2];
+                        BF_CELL_AT(insn->arg + 2 * stride) = (BF_CELL)values[3];
+#if !BF_WRAP
+                        bf_mark(dirty, pointer + (size_t)end);
+#endif
+                    }
+                }
+                BF_NEXT();
+            }
+
+            BF_CASE(COMPARE) {
+                int stride = insn->arg;
+                BF_CELL a;
+                BF_CELL b;
+
+                if (bf_cells_fit(pointer, (stride > 0) ? -1 : -2, (stride > 0) ? 2 : 1, cells, BF_WRAP) &&
+                    BF_CELL_AT(-stride) == 0 && BF_CELL_AT(2 * stride) == 0 && BF_CELL_AT(stride) != 0) {
+                    a = BF_CELL_AT(0);
+                    b = BF_CELL_AT(stride);
+                    BF_CELL_AT(0) = (BF_CELL)(a - ((b < a) ? b : a));
+                    BF_CELL_AT(stride) = (BF_CELL)(b - ((b < a) ? b : a));
+#if BF_WRAP
+                    if (a != 0 && b <= a) {
+                        pointer = bf_move_wrap(pointer, -stride, cells);
+                    }
+#else
+                    bf_mark(dirty, pointer + (size_t)(2 * stride));
+                    bf_mark(dirty, pointer - (size_t)stride);
+                    if (a != 0 && b <= a) {
+                        pointer -= (size_t)stride;
+                    }
+#endif
+                }
+                BF_NEXT();
+            }
+
+            BF_CASE(FITS)
+                /* Skip the guarded multiply, to the loop, if it could
+                 * stop at an edge */
+                if (!bf_cells_fit(pointer, (insn->offset < 0) ? insn->offset : 0,
+                                  (insn->offset > 0) ? insn->offset : 0, cells, BF_WRAP)) {
+                    insn = code + insn->arg;
+                }
+                BF_NEXT();
+
+            BF_CASE(JZ)
+                /* Skip past matching JNZ */
+                BF_DO_JZ();
+                BF_NEXT();
+
+            BF_CASE(JNZ)
+                /* Jump back past matching JZ */
+                BF_DO_JNZ();
+                BF_NEXT();
+
+            /* Common op sequences, one case each */
+            BF_SUPER_CASES
+
+            BF_CASE(END)
+#if !BF_THREADED
+            default:
+#endif
+                BF_PAUSE();
+#if !BF_THREADED
+        }
+        insn++;
+    }
+#endif
+}
+
+#undef BF_CELL_AT
+#undef BF_DO_ADD
+#undef BF_DO_MOVE
+#undef BF_DO_OUT
+#undef BF_PAUSE
+#undef BF_SPIN
+#undef BF_AGAIN
+#undef BF_DO_SET
+#undef BF_DO_MULADD
+#undef BF_DO_JZ
+#undef BF_DO_JNZ
+#undef BF_CASE
+#undef BF_SUPER_CASE
+#undef BF_NEXT
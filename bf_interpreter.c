@@ -4,103 +4,675 @@
  */
 
 #include "kernel.h"
+#include "arch.h"
+#include "bf.h"
+#include "bf_super.h"
 
 /* VGA entry helper */
 static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
     return (uint16_t) uc | (uint16_t) color << 8;
 }
 
-#define TAPE_SIZE 30000
+/* Write program output to the terminal (the default output endpoint) */
+static size_t bf_write_terminal(bf_context* context, const char* data, size_t length) {
+    (void)context;
+    terminal_write(data, length);
+    return length;
+}
+
+/* Read one key for ',' - 0 if no key is available (the default input
+ * endpoint) */
+static int bf_read_keyboard(bf_context* context) {
+    int c;
+    
+    (void)context;
+    c = keyboard_getchar();
+    if (c == -1) {
+        keyboard_handle_interrupt();
+        c = keyboard_getchar();
+    }
+    return (c == -1) ? 0 : (uint8_t)c;
+}
 
-/* Brainfuck tape - global state */
-static uint8_t bf_tape[TAPE_SIZE];
-static size_t bf_pointer = 0;
+/* Tape memory of each context, shared by every engine variant. Guard
+ * cells on both sides absorb offset-addressed operations issued while the
+ * pointer is on an edge. With 8-bit cells, cell c is memory[c + BF_TAPE_GUARD]. */
+static uint8_t bf_context_memory[BF_MAX_CONTEXTS][BF_TAPE_MEMORY] __attribute__((aligned(4)));
 
-/* Reset Brainfuck interpreter state */
-void bf_reset(void) {
-    for (size_t i = 0; i < TAPE_SIZE; i++) {
-        bf_tape[i] = 0;
+/* Context pool. Entry 0 is the default context, always in use; the others
+ * get their memory on first allocation and keep it, dirty window
+ * included, so the next owner only clears what the last one touched. */
+static bf_context bf_contexts[BF_MAX_CONTEXTS] = {
+    [0] = {
+        .memory = bf_context_memory[0],
+        .variant = { 8, BF_BOUNDS_CLAMP, BF_TAPE_CELLS },
+        .write = bf_write_terminal,
+        .read = bf_read_keyboard,
+        .in_use = 1,
+    },
+};
+static bf_context* const bf_default = &bf_contexts[0];
+
+/* Context whose native code is running: I/O from bf_putchar, bf_getchar
+ * and bf_print_tape goes through its endpoints. Native code only runs on
+ * the boot CPU; interpreted programs do their I/O on their own context,
+ * so contexts can run on several CPUs at once. */
+static bf_context* bf_active = &bf_contexts[0];
+
+/* Program buffer used by bf_execute */
+static bf_insn bf_program_code[BF_MAX_INSNS];
+static bf_program bf_current = { bf_program_code, 0, BF_MAX_INSNS, 0, 0, { 0, 0, 0 }, 0 };
+
+/* Reset a context's tape. Only the dirty cells need clearing, so the
+ * cost follows what the last program touched, not the tape size. */
+void bf_reset(bf_context* context) {
+    /* Tape cell c is memory cell c + BF_TAPE_GUARD, so cells
+     * low - BF_TAPE_GUARD .. high + BF_TAPE_GUARD start at memory cell low */
+    size_t width = context->variant.cell_bits / 8;
+    size_t start = context->dirty.low * width;
+    size_t end = (context->dirty.high + 2 * BF_TAPE_GUARD + 1) * width;
+    for (size_t i = start; i < end; i++) {
+        context->memory[i] = 0;
     }
-    bf_pointer = 0;
+    context->pointer = 0;
+    context->dirty.low = 0;
+    context->dirty.high = 0;
 }
 
-/* Execute Brainfuck code from memory */
-void bf_execute(const char* code) {
-    const char* pc = code;  /* Program counter */
-    size_t depth;
-    
-    /* Reset tape for new execution */
-    bf_reset();
-    
-    /* Execute Brainfuck program */
-    while (*pc != '\0') {
-        switch (*pc) {
-            case '>':
-                if (bf_pointer < TAPE_SIZE - 1) bf_pointer++;
-                break;
-                
-            case '<':
-                if (bf_pointer > 0) bf_pointer--;
-                break;
-                
-            case '+':
-                bf_tape[bf_pointer]++;
-                break;
-                
-            case '-':
-                bf_tape[bf_pointer]--;
-                break;
-                
-            case '.':
-                terminal_putchar(bf_tape[bf_pointer]);
-                break;
-                
-            case ',':
-                /* Input from keyboard */
-                {
-                    int c = keyboard_getchar();
-                    if (c == -1) {
-                        keyboard_handle_interrupt();
-                        c = keyboard_getchar();
-                    }
-                    bf_tape[bf_pointer] = (c == -1) ? 0 : (uint8_t)c;
-                }
-                break;
-                
-            case '[':
-                if (bf_tape[bf_pointer] == 0) {
-                    /* Skip to matching ] */
-                    depth = 1;
-                    pc++;
-                    while (depth > 0 && *pc != '\0') {
-                        if (*pc == '[') depth++;
-                        if (*pc == ']') depth--;
-                        if (depth > 0) pc++;
-                    }
-                }
-                break;
-                
-            case ']':
-                if (bf_tape[bf_pointer] != 0) {
-                    /* Jump back to matching [ */
-                    depth = 1;
-                    pc--;
-                    while (depth > 0 && pc >= code) {
-                        if (*pc == ']') depth++;
-                        if (*pc == '[') depth--;
-                        if (depth > 0) pc--;
-                    }
-                }
-                break;
-                
-            default:
-                /* Ignore non-BF characters (comments) */
-                break;
+/* Take a context from the pool, with a clear tape, terminal I/O and no
+ * budget. Returns 0 if every context is in use. */
+bf_context* bf_context_alloc(void) {
+    for (size_t i = 1; i < BF_MAX_CONTEXTS; i++) {
+        bf_context* context = &bf_contexts[i];
+
+        if (context->in_use) {
+            continue;
+        }
+        if (context->memory == 0) {
+            context->memory = bf_context_memory[i];
+            context->variant.cell_bits = 8;
+        }
+        bf_reset(context);
+        context->write = bf_write_terminal;
+        context->read = bf_read_keyboard;
+        context->io = 0;
+        context->output_length = 0;
+        context->budget = 0;
+        context->program = 0;
+        context->resume = 0;
+        context->threaded = 0;
+        context->in_use = 1;
+        return context;
+    }
+    return 0;
+}
+
+/* Return a context to the pool. Output it still holds is dropped. */
+void bf_context_free(bf_context* context) {
+    if (context != bf_default) {
+        context->in_use = 0;
+    }
+}
+
+/* Move the tape pointer by distance, clamped to the tape */
+static inline size_t bf_move(size_t pointer, int distance, size_t cells) {
+    if (distance < 0) {
+        size_t back = (size_t)-distance;
+        return (back > pointer) ? 0 : pointer - back;
+    }
+    size_t room = cells - 1 - pointer;
+    return ((size_t)distance > room) ? cells - 1 : pointer + (size_t)distance;
+}
+
+/* Move the tape pointer by distance, wrapping around the tape ends */
+static inline size_t bf_move_wrap(size_t pointer, int distance, size_t cells) {
+    if (distance < 0) {
+        size_t back = (size_t)-distance;
+        if (back > pointer) {
+            back %= cells;
+            return (back > pointer) ? pointer + cells - back : pointer - back;
+        }
+        return pointer - back;
+    }
+    size_t ahead = (size_t)distance;
+    if (ahead >= cells - pointer) {
+        ahead %= cells;
+        return (ahead >= cells - pointer) ? pointer + ahead - cells : pointer + ahead;
+    }
+    return pointer + ahead;
+}
+
+/* Widen the dirty range to include the cell at pointer */
+static inline void bf_mark(bf_dirty* dirty, size_t pointer) {
+    if (pointer > dirty->high) {
+        dirty->high = pointer;
+    } else if (pointer < dirty->low) {
+        dirty->low = pointer;
+    }
+}
+
+/* Whether cells pointer + first .. pointer + last (first <= 0 <= last)
+ * are distinct cells of the tape: all on it for a clamped tape, fewer
+ * than it holds for a wrapping one */
+static inline int bf_cells_fit(size_t pointer, int first, int last, size_t cells, int wrap) {
+    if (wrap) {
+        return (size_t)(last - first) < cells;
+    }
+    return (size_t)-first <= pointer && (size_t)last < cells - pointer;
+}
+
+/* The divmod loop counts d down and r up once per unit of n; when d runs
+ * out it refills d from r + 1 and bumps q. So d + r is the divisor, and
+ * r is how far the count already was past the last multiple. */
+int bf_divmod(unsigned int values[4], unsigned int mask) {
+    unsigned int d = values[1];
+    unsigned int r = values[2];
+    unsigned int divisor;
+    unsigned int remainder;
+
+    if (d == 0 || r > mask - d || d + r < 2) {
+        return 0;
+    }
+    divisor = d + r;
+    remainder = values[0] % divisor;
+    values[3] += values[0] / divisor;
+    if (remainder >= d) {
+        /* r + remainder reaches another multiple */
+        remainder -= d;
+        values[3]++;
+    } else {
+        remainder += r;
+    }
+    values[0] = 0;
+    values[1] = divisor - remainder;
+    values[2] = remainder;
+    return 1;
+}
+
+/* Hand context's buffered output to its output endpoint in one write */
+static void bf_context_flush(bf_context* context) {
+    if (context->output_length > 0) {
+        size_t written = context->write(context, context->output, context->output_length);
+
+        /* Keep what the endpoint did not take for the next flush */
+        context->output_length -= written;
+        for (size_t i = 0; i < context->output_length; i++) {
+            context->output[i] = context->output[written + i];
         }
-        pc++;
     }
 }
 
+/* Nonzero if the output buffer is full and still is after a flush: the
+ * write endpoint takes no more for now, and '.' has to wait */
+static inline int bf_context_full(bf_context* context) {
+    if (context->output_length < BF_OUTPUT_SIZE) {
+        return 0;
+    }
+    bf_context_flush(context);
+    return context->output_length == BF_OUTPUT_SIZE;
+}
+
+/* Output one character for '.'. The engines wait for room first; native
+ * code cannot, and its endpoints take everything, so a character that
+ * finds no room is dropped. */
+static inline void bf_context_putchar(bf_context* context, char c) {
+    if (bf_context_full(context)) {
+        return;
+    }
+    context->output[context->output_length++] = c;
+    if (c == '\n' || context->output_length == BF_OUTPUT_SIZE) {
+        bf_context_flush(context);
+    }
+}
+
+/* Read one byte for ',' from context's input endpoint */
+static int bf_context_getchar(bf_context* context) {
+    /* Show any prompt before waiting for the answer */
+    bf_context_flush(context);
+    return context->read(context);
+}
+
+/* Output cells from pointer, moving by stride, until a zero cell ("[.>]")
+ * on a clamped 8-bit tape. Returns the zero cell, or a nonzero cell not
+ * output yet: the first one if the buffer fills and the write endpoint
+ * takes no more, or the edge cell the moves park on, which the loop
+ * would print forever. A stride-1 run is copied to the output buffer in
+ * one go. */
+static size_t bf_context_print(bf_context* context, const uint8_t* tape, size_t size, size_t pointer, int stride) {
+    size_t stop = bf_scan_tape(tape, size, pointer, stride);
+    int newline = 0;
+
+    while (pointer != stop) {
+        size_t count = 1;
+        if (bf_context_full(context)) {
+            return pointer;
+        }
+        if (stride == 1) {
+            count = stop - pointer;
+            if (count > BF_OUTPUT_SIZE - context->output_length) {
+                count = BF_OUTPUT_SIZE - context->output_length;
+            }
+        }
+        for (size_t i = 0; i < count; i++) {
+            char c = (char)tape[pointer + i];
+            context->output[context->output_length++] = c;
+            newline |= (c == '\n');
+        }
+        if (context->output_length == BF_OUTPUT_SIZE) {
+            bf_context_flush(context);
+        }
+        pointer = (stride == 1) ? pointer + count : bf_move(pointer, stride, size);
+    }
+    if (newline) {
+        bf_context_flush(context);
+    }
+    return stop;
+}
+
+/* Entry points for native code, which runs on bf_active */
+void bf_flush(void) {
+    bf_context_flush(bf_active);
+}
+
+void bf_putchar(char c) {
+    bf_context_putchar(bf_active, c);
+}
+
+int bf_getchar(void) {
+    return bf_context_getchar(bf_active);
+}
+
+/* Native code cannot pause, and its endpoints take everything: a print
+ * parked on a nonzero edge cell prints it forever, as the loop would */
+size_t bf_print_tape(const uint8_t* tape, size_t size, size_t pointer, int stride) {
+    size_t stop = bf_context_print(bf_active, tape, size, pointer, stride);
+
+    while (tape[stop] != 0) {
+        bf_context_putchar(bf_active, (char)tape[stop]);
+    }
+    return stop;
+}
+
+/* One threaded instruction: the address of the handler for its dispatch
+ * code, then the operands of the bf_insn it was copied from */
+typedef struct {
+    const void* handler;
+    int arg;
+    int offset;
+} bf_threaded_insn;
+
+/* Threaded copy of each context's program, built by the first threaded
+ * step after bf_context_load and kept for the steps after it */
+static bf_threaded_insn bf_threaded_code[BF_MAX_CONTEXTS][BF_MAX_INSNS];
+
+/* Execution counts per instruction for the profiling engines */
+static unsigned long long* bf_profile_counts;
+
+/* Engine variants, one per cell width and bounds policy (bf_engine.h),
+ * each as a switch engine and as a threaded one */
+#define BF_PROFILE 0
+#define BF_CELL_IS_BYTE 1
+#define BF_CELL uint8_t
+#define BF_ENGINE_NAME bf_engine_8_clamp
+#define BF_WRAP 0
+#define BF_THREADED 0
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#define BF_ENGINE_NAME bf_threaded_8_clamp
+#define BF_WRAP 0
+#define BF_THREADED 1
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#define BF_ENGINE_NAME bf_engine_8_wrap
+#define BF_WRAP 1
+#define BF_THREADED 0
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#define BF_ENGINE_NAME bf_threaded_8_wrap
+#define BF_WRAP 1
+#define BF_THREADED 1
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#undef BF_CELL
+#undef BF_CELL_IS_BYTE
+
+#define BF_CELL_IS_BYTE 0
+#define BF_CELL uint16_t
+#define BF_ENGINE_NAME bf_engine_16_clamp
+#define BF_WRAP 0
+#define BF_THREADED 0
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#define BF_ENGINE_NAME bf_threaded_16_clamp
+#define BF_WRAP 0
+#define BF_THREADED 1
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#define BF_ENGINE_NAME bf_engine_16_wrap
+#define BF_WRAP 1
+#define BF_THREADED 0
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#define BF_ENGINE_NAME bf_threaded_16_wrap
+#define BF_WRAP 1
+#define BF_THREADED 1
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#undef BF_CELL
+
+/* unsigned int rather than uint32_t, which is 64 bits on LP64 targets */
+#define BF_CELL unsigned int
+#define BF_ENGINE_NAME bf_engine_32_clamp
+#define BF_WRAP 0
+#define BF_THREADED 0
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#define BF_ENGINE_NAME bf_threaded_32_clamp
+#define BF_WRAP 0
+#define BF_THREADED 1
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#define BF_ENGINE_NAME bf_engine_32_wrap
+#define BF_WRAP 1
+#define BF_THREADED 0
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#define BF_ENGINE_NAME bf_threaded_32_wrap
+#define BF_WRAP 1
+#define BF_THREADED 1
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_THREADED
+#undef BF_CELL
+#undef BF_CELL_IS_BYTE
+
+#undef BF_PROFILE
+
+/* Profiling variants (bf_context_profile), separate so the engines above
+ * count nothing */
+#define BF_PROFILE 1
+#define BF_THREADED 0
+#define BF_CELL_IS_BYTE 1
+#define BF_CELL uint8_t
+#define BF_ENGINE_NAME bf_profile_8_clamp
+#define BF_WRAP 0
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#define BF_ENGINE_NAME bf_profile_8_wrap
+#define BF_WRAP 1
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_CELL
+#undef BF_CELL_IS_BYTE
+#define BF_CELL_IS_BYTE 0
+#define BF_CELL uint16_t
+#define BF_ENGINE_NAME bf_profile_16_clamp
+#define BF_WRAP 0
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#define BF_ENGINE_NAME bf_profile_16_wrap
+#define BF_WRAP 1
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_CELL
+#undef BF_CELL_IS_BYTE
+#define BF_CELL_IS_BYTE 0
+#define BF_CELL unsigned int
+#define BF_ENGINE_NAME bf_profile_32_clamp
+#define BF_WRAP 0
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#define BF_ENGINE_NAME bf_profile_32_wrap
+#define BF_WRAP 1
+#include "bf_engine.h"
+#undef BF_ENGINE_NAME
+#undef BF_WRAP
+#undef BF_CELL
+#undef BF_CELL_IS_BYTE
+#undef BF_THREADED
+#undef BF_PROFILE
+
+typedef size_t (*bf_engine)(bf_context* context, const bf_program* program, size_t start);
+
+/* Indexed by [cell_bits / 16][bounds - 1]: 8, 16 and 32 bits map to 0, 1, 2 */
+static const bf_engine bf_engines[3][2] = {
+    { bf_engine_8_clamp, bf_engine_8_wrap },
+    { bf_engine_16_clamp, bf_engine_16_wrap },
+    { bf_engine_32_clamp, bf_engine_32_wrap },
+};
+static const bf_engine bf_threaded_engines[3][2] = {
+    { bf_threaded_8_clamp, bf_threaded_8_wrap },
+    { bf_threaded_16_clamp, bf_threaded_16_wrap },
+    { bf_threaded_32_clamp, bf_threaded_32_wrap },
+};
+static const bf_engine bf_profile_engines[3][2] = {
+    { bf_profile_8_clamp, bf_profile_8_wrap },
+    { bf_profile_16_clamp, bf_profile_16_wrap },
+    { bf_profile_32_clamp, bf_profile_32_wrap },
+};
+
+/* Interpreter engine for variant: threaded if configured, else the switch */
+static bf_engine bf_select_engine(const bf_variant* variant) {
+    if (config_get_bf_engine() == BF_ENGINE_THREADED) {
+        return bf_threaded_engines[variant->cell_bits / 16][variant->bounds - 1];
+    }
+    return bf_engines[variant->cell_bits / 16][variant->bounds - 1];
+}
+
+/* Check that a variant names an engine and a tape that fits in memory */
+int bf_variant_valid(const bf_variant* variant) {
+    if (variant->cell_bits != 8 && variant->cell_bits != 16 && variant->cell_bits != 32) {
+        return 0;
+    }
+    if (variant->bounds != BF_BOUNDS_CLAMP && variant->bounds != BF_BOUNDS_WRAP) {
+        return 0;
+    }
+    return variant->tape_cells > 0 && variant->tape_cells <= BF_TAPE_MAX_CELLS(variant->cell_bits);
+}
+
+/* Overwrite the fields of variant that override sets */
+void bf_variant_apply(bf_variant* variant, const bf_variant* override) {
+    if (override->cell_bits != 0) {
+        variant->cell_bits = override->cell_bits;
+    }
+    if (override->bounds != 0) {
+        variant->bounds = override->bounds;
+    }
+    if (override->tape_cells != 0) {
+        variant->tape_cells = override->tape_cells;
+    }
+}
+
+/* Reset context's tape for a run of program on variant, from its start.
+ * Returns 0, or -1 (reported) if the variant is not supported. */
+int bf_context_load(bf_context* context, const bf_program* program, const bf_variant* variant) {
+    bf_reset(context);
+
+    if (!bf_variant_valid(variant)) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("[BF] Error: unsupported cell size or tape length\n");
+        return -1;
+    }
+    context->variant = *variant;
+    context->program = program;
+    context->resume = 0;
+    context->threaded = 0;
+    context->ops = 0;
+    return 0;
+}
+
+/* Check whether context's program is at its END, flushing the output
+ * there. Returns 1 once the endpoint took the last of the output. */
+static int bf_context_ended(bf_context* context) {
+    if (context->program->code[context->resume].op != BF_OP_END) {
+        return 0;
+    }
+    bf_context_flush(context);
+    return context->output_length == 0;
+}
+
+/* Run context's program from where it stopped, for at most its budget.
+ * A whole run without a budget goes to native code when the JIT is
+ * selected and the variant has it; anything else is interpreted, so it
+ * can pause. Only the boot CPU may run a step without a budget; steps
+ * with one may run on any CPU, one CPU per context at a time. Output is
+ * flushed when the program ends; until the write endpoint has taken all
+ * of it, further steps retry the flush.
+ * Returns 1 if the program ended, 0 if it paused. */
+int bf_context_step(bf_context* context) {
+    const bf_program* program = context->program;
+    const bf_variant* variant = &context->variant;
+    int native = 0;
+
+    /* Prefer native code for 8-bit clamped tapes; fall back to
+     * interpreting if the JIT declines */
+    if (context->resume == 0 && context->budget == 0 && variant->cell_bits == 8 &&
+        variant->bounds == BF_BOUNDS_CLAMP && config_get_bf_engine() == BF_ENGINE_JIT) {
+        bf_context* caller = bf_active;
+
+        bf_active = context;
+        native = bf_jit_run(program, context->memory + BF_TAPE_GUARD, variant->tape_cells,
+                            &context->pointer, &context->dirty) == 0;
+        bf_active = caller;
+    }
+    if (native) {
+        context->resume = program->length - 1;
+    } else {
+        context->resume = bf_select_engine(variant)(context, program, context->resume);
+    }
+    return bf_context_ended(context);
+}
+
+/* Run context's program from where it stopped, for at most its budget,
+ * like bf_context_step, but interpreted on a profiling engine that adds
+ * the number of times each instruction ran to counts (one per
+ * instruction). Returns 1 if the program ended, 0 if it paused. */
+int bf_context_profile(bf_context* context, unsigned long long* counts) {
+    const bf_variant* variant = &context->variant;
+
+    bf_profile_counts = counts;
+    context->resume = bf_profile_engines[variant->cell_bits / 16][variant->bounds - 1](
+        context, context->program, context->resume);
+    return bf_context_ended(context);
+}
+
+/* Execute a compiled program on a freshly reset tape, with the engine
+ * variant the program asked for */
+void bf_run(const bf_program* program) {
+    bf_run_variant(program, &program->variant);
+}
+
+/* Execute a compiled program to its end on the default context, with a
+ * freshly reset tape of the given variant */
+void bf_run_variant(const bf_program* program, const bf_variant* variant) {
+    if (bf_context_load(bf_default, program, variant) == 0) {
+        bf_default->budget = 0;
+        bf_context_step(bf_default);
+    }
+}
+
+/* Execute a program whose start was evaluated at build time on the
+ * default context, with a freshly reset tape of the given variant, which
+ * must be the one the prefix was evaluated for. The prefix output goes to
+ * the terminal in one write and its tape is restored; the rest of the
+ * program, if any, is interpreted. */
+void bf_run_prefix(const bf_program* program, const bf_prefix* prefix, const bf_variant* variant) {
+    bf_context* context = bf_default;
+    size_t width = variant->cell_bits / 8;
+    uint8_t* cells = context->memory + (prefix->tape_first + BF_TAPE_GUARD) * width;
+
+    if (bf_context_load(context, program, variant) != 0) {
+        return;
+    }
+
+    terminal_write(prefix->output, prefix->output_length);
+
+    for (size_t i = 0; i < prefix->tape_cells * width; i++) {
+        cells[i] = prefix->tape[i];
+    }
+    if (prefix->tape_cells > 0) {
+        bf_mark(&context->dirty, prefix->tape_first);
+        bf_mark(&context->dirty, prefix->tape_first + prefix->tape_cells - 1);
+    }
+    bf_mark(&context->dirty, prefix->pointer);
+    context->pointer = prefix->pointer;
+
+    if (program->code[prefix->resume].op != BF_OP_END) {
+        context->resume = prefix->resume;
+        context->budget = 0;
+        bf_context_step(context);
+    }
+}
+
+/* Execute a compiled program on the default context, with a freshly
+ * reset tape of the variant it asked for, adding the number of times
+ * each instruction ran to counts (one per instruction). Interpreted on a
+ * profiling engine whatever the configured engine, so the counts are
+ * exact. */
+void bf_run_profile(const bf_program* program, unsigned long long* counts) {
+    const bf_variant* variant = &program->variant;
+
+    if (bf_context_load(bf_default, program, variant) != 0) {
+        return;
+    }
+    bf_default->budget = 0;
+    bf_active = bf_default;
+    bf_context_profile(bf_default, counts);
+}
+
+/* Execute an ahead-of-time translated program on the default context,
+ * with a freshly reset 8-bit, clamped tape of cells cells */
+void bf_run_native(bf_native_entry entry, size_t cells) {
+    bf_context* context = bf_default;
+
+    bf_reset(context);
+    context->variant.cell_bits = 8;
+    context->variant.bounds = BF_BOUNDS_CLAMP;
+    context->variant.tape_cells = cells;
+    bf_active = context;
+    bf_jit_enter(entry, context->memory + BF_TAPE_GUARD, cells, &context->pointer, &context->dirty);
+    bf_flush();
+}
+
+/* Compile and execute Brainfuck code from memory.
+ * Returns 0 on success, -1 if the program failed to compile. */
+int bf_execute(const char* code) {
+    if (bf_compile(code, &bf_current) != 0) {
+        return -1;
+    }
+    
+    bf_run(&bf_current);
+    return 0;
+}
+
 /* Load and execute a Brainfuck program from memory */
 void bf_load_and_run(const char* bf_code) {
     terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
@@ -112,13 +684,13 @@ void bf_load_and_run(const char* bf_code) {
     terminal_putchar('\n');
 }
 
-/* Get current tape pointer (for debugging) */
-size_t bf_get_pointer(void) {
-    return bf_pointer;
+/* Get a context's tape pointer (for debugging) */
+size_t bf_get_pointer(const bf_context* context) {
+    return context->pointer;
 }
 
-/* Get tape value at pointer */
-uint8_t bf_get_value(void) {
-    return bf_tape[bf_pointer];
+/* Get the tape value at a context's pointer (low byte for wider cells) */
+uint8_t bf_get_value(const bf_context* context) {
+    /* Little-endian targets: the low byte comes first */
+    return context->memory[(context->pointer + BF_TAPE_GUARD) * (context->variant.cell_bits / 8)];
 }
-
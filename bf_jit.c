@@ -0,0 +1,187 @@
+/* Brainfuck JIT Driver
+ * Translates compiled IR into native code with the architecture backend
+ * (arch/<arch>/jit.c) and runs it directly on the tape.
+ */
+
+#include "kernel.h"
+#include "bf.h"
+
+/* Generated code buffer. The kernel runs without paging, so it is
+ * executable as-is. */
+#define BF_JIT_CODE_SIZE (256 * 1024)
+
+static uint8_t bf_jit_code[BF_JIT_CODE_SIZE] __attribute__((aligned(16)));
+
+/* Tape and dirty window of the running program, for runtime helpers */
+static uint8_t* bf_jit_tape;
+static size_t bf_jit_tape_size;
+static bf_dirty* bf_jit_dirty;
+
+/* Cells the dirty window grows beyond a pointer that left it, so code
+ * walking across the tape only calls back every so often */
+#define BF_JIT_WINDOW_STEP 256
+
+/* SCAN helper called from generated code: returns the cell it stops on.
+ * A scan parked on a nonzero edge cell is a loop that never ends, and
+ * native code cannot pause, so it spins there. */
+uint8_t* bf_jit_scan(uint8_t* cell, int stride) {
+    size_t pointer = (size_t)(cell - bf_jit_tape);
+
+    pointer = bf_scan_tape(bf_jit_tape, bf_jit_tape_size, pointer, stride);
+    if (bf_jit_tape[pointer] != 0) {
+        for (;;) {
+        }
+    }
+    return bf_jit_tape + pointer;
+}
+
+/* PRINT helper called from generated code: returns the cell it stops on */
+uint8_t* bf_jit_print(uint8_t* cell, int stride) {
+    size_t pointer = (size_t)(cell - bf_jit_tape);
+    return bf_jit_tape + bf_print_tape(bf_jit_tape, bf_jit_tape_size, pointer, stride);
+}
+
+/* Library routine helpers only act when the cells cell + first .. cell +
+ * last that the loop would touch lie on the tape. They widen the dirty
+ * window over those cells themselves: the generated code keeps its
+ * narrower copy, which only costs it an earlier call to the window
+ * helpers. Returns 1 if the cells are on the tape. */
+static int bf_jit_claim(uint8_t* cell, int first, int last) {
+    size_t pointer = (size_t)(cell - bf_jit_tape);
+
+    if ((size_t)-first > pointer || (size_t)last >= bf_jit_tape_size - pointer) {
+        return 0;
+    }
+    if (pointer + (size_t)last > bf_jit_dirty->high) {
+        bf_jit_dirty->high = pointer + (size_t)last;
+    }
+    if (pointer - (size_t)-first < bf_jit_dirty->low) {
+        bf_jit_dirty->low = pointer - (size_t)-first;
+    }
+    return 1;
+}
+
+/* DIVMOD helper called from generated code: returns the cell unchanged */
+uint8_t* bf_jit_divmod(uint8_t* cell, int offset) {
+    int stride = (offset > 0) ? 1 : -1;
+    int end = offset + 4 * stride;
+    unsigned int values[4];
+
+    if (!bf_jit_claim(cell, (end < 0) ? end : 0, (end > 0) ? end : 0) ||
+        cell[end] != 0 || cell[end - stride] != 0) {
+        return cell;
+    }
+    values[0] = cell[0];
+    values[1] = cell[offset];
+    values[2] = cell[offset + stride];
+    values[3] = cell[offset + 2 * stride];
+    if (bf_divmod(values, 0xFF)) {
+        if (offset != stride) {
+            cell[stride] += cell[0];
+        }
+        cell[0] = (uint8_t)values[0];
+        cell[offset] = (uint8_t)values[1];
+        cell[offset + stride] = (uint8_t)values[2];
+        cell[offset + 2 * stride] = (uint8_t)values[3];
+    }
+    return cell;
+}
+
+/* COMPARE helper called from generated code: returns the cell it stops on */
+uint8_t* bf_jit_compare(uint8_t* cell, int stride) {
+    uint8_t a;
+    uint8_t b;
+    uint8_t least;
+
+    if (!bf_jit_claim(cell, (stride > 0) ? -1 : -2, (stride > 0) ? 2 : 1) ||
+        cell[-stride] != 0 || cell[2 * stride] != 0 || cell[stride] == 0) {
+        return cell;
+    }
+    a = cell[0];
+    b = cell[stride];
+    least = (b < a) ? b : a;
+    cell[0] = (uint8_t)(a - least);
+    cell[stride] = (uint8_t)(b - least);
+    return (a != 0 && b <= a) ? cell - stride : cell;
+}
+
+/* FITS helper called from generated code: returns 1 if the guarded
+ * multiply may run, with cells cell .. cell + offset on the tape */
+int bf_jit_fits(uint8_t* cell, int offset) {
+    return bf_jit_claim(cell, (offset < 0) ? offset : 0, (offset > 0) ? offset : 0);
+}
+
+/* Helper generated code calls for a SCAN, PRINT, DIVMOD or COMPARE
+ * instruction, as uint8_t* helper(uint8_t* cell, int arg): it returns
+ * the cell the pointer ends on */
+void* bf_jit_helper(uint8_t op) {
+    switch (op) {
+        case BF_OP_SCAN:
+            return (void*)bf_jit_scan;
+        case BF_OP_PRINT:
+            return (void*)bf_jit_print;
+        case BF_OP_DIVMOD:
+            return (void*)bf_jit_divmod;
+        default:
+            return (void*)bf_jit_compare;
+    }
+}
+
+/* Window helpers called from native code when the pointer has moved past
+ * the dirty window. pointer may lie beyond the tape itself; the window
+ * never grows past the tape edges. Returns the new window edge. */
+uint8_t* bf_native_grow_last(uint8_t* pointer) {
+    unsigned long position = (unsigned long)pointer - (unsigned long)bf_jit_tape;
+    size_t last = bf_jit_tape_size - 1;
+
+    if (position > last || last - position < BF_JIT_WINDOW_STEP) {
+        bf_jit_dirty->high = last;
+    } else {
+        bf_jit_dirty->high = (size_t)position + BF_JIT_WINDOW_STEP;
+    }
+    return bf_jit_tape + bf_jit_dirty->high;
+}
+
+uint8_t* bf_native_grow_first(uint8_t* pointer) {
+    unsigned long address = (unsigned long)pointer;
+    unsigned long first = (unsigned long)bf_jit_tape;
+
+    if (address < first + BF_JIT_WINDOW_STEP) {
+        bf_jit_dirty->low = 0;
+    } else {
+        bf_jit_dirty->low = (size_t)(address - first) - BF_JIT_WINDOW_STEP;
+    }
+    return bf_jit_tape + bf_jit_dirty->low;
+}
+
+/* Compile program into the shared code buffer. Sets *native to the code
+ * and returns its size, or 0 if the backend declined (unsupported
+ * architecture or code buffer too small). The code stays valid until the
+ * next compile; callers that keep it must copy it out. */
+size_t bf_jit_compile(const bf_program* program, uint8_t** native) {
+    *native = bf_jit_code;
+    return arch_jit_compile(program, bf_jit_code, BF_JIT_CODE_SIZE);
+}
+
+/* Call native code with the pointer inside the dirty window; the window
+ * helpers widen *dirty as the code moves outside it */
+void bf_jit_enter(bf_native_entry entry, uint8_t* tape, size_t size, size_t* pointer, bf_dirty* dirty) {
+    bf_jit_tape = tape;
+    bf_jit_tape_size = size;
+    bf_jit_dirty = dirty;
+    *pointer = (size_t)(entry(tape + *pointer, tape + dirty->low, tape + dirty->high) - tape);
+}
+
+/* Run program natively on the tape, reusing its attached native code if
+ * it has any. Returns 0 when the program finished, -1 if no native code
+ * could be generated. */
+int bf_jit_run(const bf_program* program, uint8_t* tape, size_t size, size_t* pointer, bf_dirty* dirty) {
+    uint8_t* native = program->native;
+
+    if (native == 0 && bf_jit_compile(program, &native) == 0) {
+        return -1;
+    }
+
+    bf_jit_enter((bf_native_entry)(void*)native, tape, size, pointer, dirty);
+    return 0;
+}
@@ -0,0 +1,314 @@
+/* Shell Pipelines
+ * bf_pipeline runs "a | b | c": each program on its own context, the
+ * output of one stage streaming into the ',' of the next through a
+ * bounded single-producer single-consumer ring. Stages are interpreted
+ * and take turns on the boot CPU, a BF_JOB_SLICE budget at a time, so a
+ * consumer starts on the first bytes while its producer is still running.
+ *
+ * A full ring pushes back: the producer's output endpoint takes only what
+ * fits, its '.' pauses once its own buffer is full too, and it is skipped
+ * until the consumer has read some. A consumer whose ring is empty pauses
+ * on its ',' the same way, and reads 0 (end of input) once its producer
+ * has ended. When a stage ends, the stages upstream of it are stopped, as
+ * nothing would read what they write.
+ */
+
+#include "kernel.h"
+#include "bf.h"
+
+/* Bytes a pipe holds: a power of two */
+#define BF_PIPE_SIZE 512
+
+/* Stages a pipeline has at most, one context each */
+#define BF_MAX_STAGES (BF_MAX_CONTEXTS - 1)
+
+/* Keys typed for the first stage that it has not read yet */
+#define BF_PIPE_INPUT 64
+
+/* Ctrl+C, which stops a pipeline */
+#define BF_KEY_INTERRUPT 0x03
+
+/* VGA entry helper */
+static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
+    return (uint16_t) uc | (uint16_t) color << 8;
+}
+
+/* Ring between two stages. head and tail only grow: the consumer moves
+ * head, the producer tail, and byte i is in data[i % BF_PIPE_SIZE] for
+ * head <= i < tail. closed is set once the producer has ended. */
+typedef struct {
+    unsigned int head;
+    unsigned int tail;
+    int closed;
+    char data[BF_PIPE_SIZE];
+} bf_pipe;
+
+/* One program of a pipeline. input is 0 for the first stage, which reads
+ * the keyboard, and output 0 for the last, which writes to the terminal.
+ * waiting and full record why the stage last paused. */
+typedef struct {
+    bf_context* context;
+    bf_program program;
+    bf_pipe* input;
+    bf_pipe* output;
+    int waiting;
+    int full;
+    int done;
+} bf_stage;
+
+static bf_stage bf_stages[BF_MAX_STAGES];
+static bf_pipe bf_pipes[BF_MAX_STAGES - 1];
+
+/* IR of the stages compiled from source, one after the other; stages
+ * from a precompiled image run the image's IR in place */
+static bf_insn bf_pipe_code[BF_MAX_INSNS];
+
+/* Keys typed for the first stage and not read yet */
+static char bf_pipe_input[BF_PIPE_INPUT];
+static size_t bf_pipe_input_head = 0;
+static size_t bf_pipe_input_count = 0;
+
+/* Copy up to length bytes of data into pipe. Returns the number copied. */
+static size_t bf_pipe_push(bf_pipe* pipe, const char* data, size_t length) {
+    unsigned int tail = pipe->tail;
+    unsigned int head = __atomic_load_n(&pipe->head, __ATOMIC_ACQUIRE);
+    size_t room = BF_PIPE_SIZE - (tail - head);
+
+    if (length > room) {
+        length = room;
+    }
+    for (size_t i = 0; i < length; i++) {
+        pipe->data[(tail + i) % BF_PIPE_SIZE] = data[i];
+    }
+    __atomic_store_n(&pipe->tail, tail + (unsigned int)length, __ATOMIC_RELEASE);
+    return length;
+}
+
+/* Take the next byte from pipe. Returns it, or -1 if pipe is empty. */
+static int bf_pipe_pop(bf_pipe* pipe) {
+    unsigned int head = pipe->head;
+    char c;
+
+    if (head == __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE)) {
+        return -1;
+    }
+    c = pipe->data[head % BF_PIPE_SIZE];
+    __atomic_store_n(&pipe->head, head + 1, __ATOMIC_RELEASE);
+    return (uint8_t)c;
+}
+
+static size_t bf_pipe_count(const bf_pipe* pipe) {
+    return __atomic_load_n(&pipe->tail, __ATOMIC_ACQUIRE) - pipe->head;
+}
+
+/* Output endpoint of every stage but the last: takes what fits in the
+ * pipe to the next stage */
+static size_t bf_stage_write(bf_context* context, const char* data, size_t length) {
+    bf_stage* stage = (bf_stage*)context->io;
+    size_t written = bf_pipe_push(stage->output, data, length);
+
+    if (written < length) {
+        stage->full = 1;
+    }
+    return written;
+}
+
+/* Input endpoint of every stage but the first: the next byte from the
+ * previous stage, 0 once it has ended and left nothing unread, or
+ * BF_READ_WAIT while the pipe is empty */
+static int bf_stage_read(bf_context* context) {
+    bf_stage* stage = (bf_stage*)context->io;
+    int c = bf_pipe_pop(stage->input);
+
+    if (c != -1) {
+        return c;
+    }
+    if (__atomic_load_n(&stage->input->closed, __ATOMIC_ACQUIRE)) {
+        /* Bytes pushed before the pipe closed are visible by now */
+        c = bf_pipe_pop(stage->input);
+        return (c == -1) ? 0 : c;
+    }
+    stage->waiting = 1;
+    return BF_READ_WAIT;
+}
+
+/* Input endpoint of the first stage: the next key typed for it, or 0 if
+ * there is none, as with the default keyboard endpoint */
+static int bf_stage_keyboard(bf_context* context) {
+    char c;
+
+    (void)context;
+    if (bf_pipe_input_count == 0) {
+        return 0;
+    }
+    c = bf_pipe_input[bf_pipe_input_head];
+    bf_pipe_input_head = (bf_pipe_input_head + 1) % BF_PIPE_INPUT;
+    bf_pipe_input_count--;
+    return (uint8_t)c;
+}
+
+/* Take the keys typed since the last call, holding them for the first
+ * stage; keys that find its buffer full are dropped, so Ctrl+C is always
+ * seen. Returns nonzero if Ctrl+C was typed. */
+static int bf_pipe_poll(void) {
+    int c;
+
+    keyboard_handle_interrupt();
+    while ((c = keyboard_getchar()) != -1) {
+        if (c == BF_KEY_INTERRUPT) {
+            return 1;
+        }
+        if (bf_pipe_input_count < BF_PIPE_INPUT) {
+            bf_pipe_input[(bf_pipe_input_head + bf_pipe_input_count) % BF_PIPE_INPUT] = (char)c;
+            bf_pipe_input_count++;
+        }
+    }
+    return 0;
+}
+
+/* Nonzero if stage cannot get anywhere before another stage runs: it is
+ * waiting on an empty pipe that is still open, or its output filled the
+ * pipe it writes */
+static int bf_stage_blocked(const bf_stage* stage) {
+    if (stage->waiting && bf_pipe_count(stage->input) == 0 &&
+        !__atomic_load_n(&stage->input->closed, __ATOMIC_ACQUIRE)) {
+        return 1;
+    }
+    return stage->full && bf_pipe_count(stage->output) == BF_PIPE_SIZE;
+}
+
+/* Mark stage as ended and let the next stage read to the end */
+static void bf_stage_end(bf_stage* stage) {
+    stage->done = 1;
+    if (stage->output) {
+        __atomic_store_n(&stage->output->closed, 1, __ATOMIC_RELEASE);
+    }
+}
+
+/* Set up stage for file's program, compiling it to code, which has room
+ * for capacity instructions. Returns the instructions it used there, or
+ * -1 (reported) if it cannot run. */
+static int bf_stage_load(bf_stage* stage, bf_insn* code, size_t capacity,
+                         const fs_entry* file, const bf_variant* override) {
+    size_t used = 0;
+    bf_variant variant;
+
+    if (file->image == 0 || bf_load_image(file->image, &stage->program) != 0) {
+        stage->program.code = code;
+        stage->program.capacity = capacity;
+        stage->program.native = 0;
+        stage->program.native_size = 0;
+        stage->program.source = 0;
+        if (bf_compile(file->data, &stage->program) != 0) {
+            return -1;
+        }
+        used = stage->program.length;
+        stage->program.capacity = used;
+    }
+    variant = stage->program.variant;
+    if (override) {
+        bf_variant_apply(&variant, override);
+    }
+    if (bf_context_load(stage->context, &stage->program, &variant) != 0) {
+        return -1;
+    }
+    stage->context->io = stage;
+    stage->context->budget = BF_JOB_SLICE;
+    return (int)used;
+}
+
+/* Run count programs as a pipeline until the last one ends. Settings in
+ * override (zero fields excepted) replace the engine variant each asked
+ * for; override may be 0. Ctrl+C stops the pipeline. Boot CPU only. */
+void bf_pipeline(fs_entry* files[], size_t count, const bf_variant* override) {
+    size_t loaded = 0;
+    size_t used = 0;
+    int stopped = 0;
+
+    if (count > BF_MAX_STAGES) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("[BF] Error: too many programs in one pipeline\n");
+        return;
+    }
+    terminal_setcolor(vga_entry(COLOR_LIGHT_GREEN, COLOR_BLACK));
+    while (loaded < count) {
+        bf_stage* stage = &bf_stages[loaded];
+        int size;
+
+        stage->context = bf_context_alloc();
+        if (stage->context == 0) {
+            terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+            terminal_writestring("[BF] Error: no free context (stop some jobs)\n");
+            break;
+        }
+        size = bf_stage_load(stage, bf_pipe_code + used, BF_MAX_INSNS - used, files[loaded], override);
+        if (size < 0) {
+            bf_context_free(stage->context);
+            break;
+        }
+        used += (size_t)size;
+        loaded++;
+    }
+
+    if (loaded == count) {
+        for (size_t i = 0; i < count; i++) {
+            bf_stage* stage = &bf_stages[i];
+
+            stage->input = 0;
+            stage->output = 0;
+            if (i > 0) {
+                stage->input = &bf_pipes[i - 1];
+                stage->context->read = bf_stage_read;
+            } else {
+                stage->context->read = bf_stage_keyboard;
+            }
+            if (i < count - 1) {
+                stage->output = &bf_pipes[i];
+                stage->output->head = 0;
+                stage->output->tail = 0;
+                stage->output->closed = 0;
+                stage->context->write = bf_stage_write;
+            }
+            stage->waiting = 0;
+            stage->full = 0;
+            stage->done = 0;
+        }
+        bf_pipe_input_head = 0;
+        bf_pipe_input_count = 0;
+
+        while (!bf_stages[count - 1].done) {
+            if (bf_pipe_poll()) {
+                stopped = 1;
+                break;
+            }
+
+            for (size_t i = 0; i < count; i++) {
+                bf_stage* stage = &bf_stages[i];
+
+                if (stage->done || bf_stage_blocked(stage)) {
+                    continue;
+                }
+                stage->waiting = 0;
+                stage->full = 0;
+                if (!bf_context_step(stage->context)) {
+                    continue;
+                }
+                bf_stage_end(stage);
+
+                /* Nothing reads what the stages before it write */
+                for (size_t j = 0; j < i; j++) {
+                    bf_stage_end(&bf_stages[j]);
+                }
+            }
+        }
+        if (stopped) {
+            terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
+            terminal_writestring("^C");
+        }
+    }
+
+    for (size_t i = 0; i < loaded; i++) {
+        bf_context_free(bf_stages[i].context);
+    }
+    terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
+}
@@ -0,0 +1,469 @@
+/* Brainfuck Execution Profilers
+ * bf_profile runs a program on a profiling engine, which counts how often
+ * each IR instruction runs, then reports where the time went: total ops
+ * and ops per second, the hottest loops and the hottest instructions,
+ * each with the source it was compiled from. The regular engines are
+ * separate variants and carry no counting.
+ *
+ * bf_profile_sample runs the program's native code unchanged instead and
+ * samples the interrupted program counter from a timer, mapping each
+ * sample back to an IR instruction through the code addresses the JIT or
+ * build_sysfs.py recorded for it. Counts are statistical, but the run
+ * is not perturbed beyond the interrupt itself.
+ */
+
+#include "kernel.h"
+#include "arch.h"
+#include "bf.h"
+
+/* Loops and instructions listed in a report */
+#define BF_PROFILE_TOP 8
+
+/* Source commands shown per excerpt at most */
+#define BF_PROFILE_EXCERPT 32
+
+/* VGA entry helper */
+static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
+    return (uint16_t) uc | (uint16_t) color << 8;
+}
+
+/* Profiled program: its IR, the source offset of each instruction and
+ * how many times each ran */
+static bf_insn bf_profile_code[BF_MAX_INSNS];
+static size_t bf_profile_source[BF_MAX_INSNS];
+static unsigned long long bf_profile_runs[BF_MAX_INSNS];
+static bf_program bf_profile_program = {
+    bf_profile_code, 0, BF_MAX_INSNS, 0, 0, { 0, 0, 0 }, bf_profile_source
+};
+
+/* Timer samples per second while sampling */
+#define BF_SAMPLE_HZ 1000
+
+/* Samples kept at most, about half a minute at BF_SAMPLE_HZ; later
+ * samples are only counted */
+#define BF_SAMPLE_MAX 32768
+
+/* Program counters the timer interrupted while sampling */
+static unsigned long bf_sample_pcs[BF_SAMPLE_MAX];
+static volatile size_t bf_sample_count;
+
+/* Native code of the sampled program and where each block of its IR
+ * starts in it, sorted by address */
+static const uint8_t* bf_sample_first;
+static const uint8_t* bf_sample_end;
+static bf_native_mark bf_sample_map[BF_MAX_INSNS];
+static size_t bf_sample_map_length;
+
+/* Ahead-of-time translations and their map (build_sysfs.py --native).
+ * The linker defines these for the two sections; weak, so a kernel built
+ * without translations still links and sees them as 0. */
+extern const uint8_t __start_sysfs_native[] __attribute__((weak));
+extern const uint8_t __stop_sysfs_native[] __attribute__((weak));
+extern const bf_native_mark __start_sysfs_map[] __attribute__((weak));
+extern const bf_native_mark __stop_sysfs_map[] __attribute__((weak));
+
+/* Ops run inside each open loop before it was entered, while summing */
+static unsigned long long bf_profile_before[BF_MAX_LOOP_DEPTH];
+
+/* One report entry: a loop (JZ at first, JNZ at last) or an instruction
+ * (first == last) and the ops run there */
+typedef struct {
+    size_t first;
+    size_t last;
+    unsigned long long ops;
+} bf_profile_entry;
+
+static bf_profile_entry bf_profile_loops[BF_PROFILE_TOP];
+static bf_profile_entry bf_profile_insns[BF_PROFILE_TOP];
+
+static const char* const bf_profile_op_names[] = {
+    "END", "ADD", "MOVE", "OUT", "IN", "JZ", "JNZ", "SET", "MULADD", "SCAN", "PRINT",
+    "DIVMOD", "COMPARE", "FITS"
+};
+
+/* value / divisor by shift and subtract: 64-bit division would need
+ * libgcc, which the kernel does not link */
+static unsigned long long bf_profile_divide(unsigned long long value, unsigned int divisor) {
+    unsigned long long quotient = 0;
+    unsigned long long rest = 0;
+
+    for (int bit = 63; bit >= 0; bit--) {
+        rest = (rest << 1) | ((value >> bit) & 1);
+        if (rest >= divisor) {
+            rest -= divisor;
+            quotient |= 1ULL << bit;
+        }
+    }
+    return quotient;
+}
+
+/* Write value in decimal, right-aligned in width columns */
+static void bf_profile_number(unsigned long long value, size_t width) {
+    char digits[24];
+    size_t count = 0;
+
+    do {
+        unsigned long long next = bf_profile_divide(value, 10);
+        digits[count++] = (char)('0' + (value - next * 10));
+        value = next;
+    } while (value != 0);
+
+    while (width > count) {
+        terminal_putchar(' ');
+        width--;
+    }
+    while (count > 0) {
+        terminal_putchar(digits[--count]);
+    }
+}
+
+/* part as a whole percentage of total */
+static unsigned long long bf_profile_percent(unsigned long long part, unsigned long long total) {
+    /* Scale both down until total fits the 32-bit divisor */
+    while ((total >> 32) != 0) {
+        total >>= 1;
+        part >>= 1;
+    }
+    return (total == 0) ? 0 : bf_profile_divide(part * 100, (unsigned int)total);
+}
+
+/* Keep entry if it is among the BF_PROFILE_TOP with the most ops */
+static void bf_profile_rank(bf_profile_entry* top, size_t first, size_t last,
+                            unsigned long long ops) {
+    size_t i = BF_PROFILE_TOP;
+
+    if (ops == 0 || ops <= top[BF_PROFILE_TOP - 1].ops) {
+        return;
+    }
+    while (i > 0 && top[i - 1].ops < ops) {
+        if (i < BF_PROFILE_TOP) {
+            top[i] = top[i - 1];
+        }
+        i--;
+    }
+    top[i].first = first;
+    top[i].last = last;
+    top[i].ops = ops;
+}
+
+/* Write the commands of source[first..last] (comments skipped), cut off
+ * after BF_PROFILE_EXCERPT of them */
+static void bf_profile_excerpt(const char* source, size_t first, size_t last) {
+    size_t shown = 0;
+
+    for (size_t i = first; i <= last && source[i] != '\0'; i++) {
+        char c = source[i];
+
+        if (c != '+' && c != '-' && c != '<' && c != '>' && c != '.' && c != ',' &&
+            c != '[' && c != ']') {
+            continue;
+        }
+        if (shown == BF_PROFILE_EXCERPT) {
+            terminal_writestring("...");
+            break;
+        }
+        terminal_putchar(c);
+        shown++;
+    }
+    terminal_putchar('\n');
+}
+
+/* Heading of a report section */
+static void bf_profile_heading(const char* title) {
+    terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
+    terminal_writestring(title);
+    terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
+}
+
+/* Total the ops run and rank loops and instructions by the ops run in
+ * them. Returns the total. */
+static unsigned long long bf_profile_tally(const bf_program* program) {
+    unsigned long long total = 0;
+    size_t depth = 0;
+
+    for (size_t i = 0; i < BF_PROFILE_TOP; i++) {
+        bf_profile_loops[i].ops = 0;
+        bf_profile_insns[i].ops = 0;
+    }
+
+    for (size_t i = 0; i < program->length; i++) {
+        /* A loop's ops are those run between its JZ and its JNZ */
+        if (program->code[i].op == BF_OP_JZ) {
+            bf_profile_before[depth++] = total;
+        }
+        total += bf_profile_runs[i];
+        if (program->code[i].op == BF_OP_JNZ) {
+            depth--;
+            bf_profile_rank(bf_profile_loops, (size_t)program->code[i].arg, i,
+                            total - bf_profile_before[depth]);
+        }
+        bf_profile_rank(bf_profile_insns, i, i, bf_profile_runs[i]);
+    }
+    return total;
+}
+
+/* Report the hottest loops and instructions from the tally, as shares
+ * of total. Exact counts show each loop's iterations as well; samples
+ * say nothing about them. */
+static void bf_profile_report(const bf_program* program, const char* source,
+                              unsigned long long total, int exact) {
+    if (bf_profile_loops[0].ops != 0) {
+        bf_profile_heading("Hottest loops:\n");
+        terminal_writestring(exact ? "  at              ops share      iters  source\n"
+                                   : "  at          samples share  source\n");
+        for (size_t i = 0; i < BF_PROFILE_TOP && bf_profile_loops[i].ops != 0; i++) {
+            const bf_profile_entry* loop = &bf_profile_loops[i];
+            terminal_writestring("  @");
+            bf_profile_number(bf_profile_source[loop->first], 6);
+            bf_profile_number(loop->ops, 12);
+            bf_profile_number(bf_profile_percent(loop->ops, total), 5);
+            terminal_writestring("% ");
+            if (exact) {
+                bf_profile_number(bf_profile_runs[loop->last], 10);
+            }
+            terminal_writestring("  ");
+            bf_profile_excerpt(source, bf_profile_source[loop->first],
+                               bf_profile_source[loop->last]);
+        }
+    }
+
+    if (bf_profile_insns[0].ops != 0) {
+        bf_profile_heading("Hottest instructions:\n");
+        terminal_writestring(exact ? "  at             runs share  op       source\n"
+                                   : "  at          samples share  op       source\n");
+        for (size_t i = 0; i < BF_PROFILE_TOP && bf_profile_insns[i].ops != 0; i++) {
+            const bf_profile_entry* insn = &bf_profile_insns[i];
+            const char* name = bf_profile_op_names[program->code[insn->first].op];
+            size_t length = 0;
+
+            terminal_writestring("  @");
+            bf_profile_number(bf_profile_source[insn->first], 6);
+            bf_profile_number(insn->ops, 12);
+            bf_profile_number(bf_profile_percent(insn->ops, total), 5);
+            terminal_writestring("%  ");
+            terminal_writestring(name);
+            while (name[length] != '\0') {
+                length++;
+            }
+            while (length++ < 9) {
+                terminal_putchar(' ');
+            }
+            bf_profile_excerpt(source, bf_profile_source[insn->first],
+                               bf_profile_source[insn->first] + BF_PROFILE_EXCERPT);
+        }
+    }
+}
+
+/* Compile file's program afresh with a source map (cached programs and
+ * images keep none) and clear its counts. Returns 0 on success, -1 if it
+ * failed to compile (already reported). */
+static int bf_profile_load(const fs_entry* file, const char* message) {
+    terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
+    terminal_writestring(message);
+    terminal_setcolor(vga_entry(COLOR_LIGHT_GREEN, COLOR_BLACK));
+
+    if (bf_compile(file->data, &bf_profile_program) != 0) {
+        return -1;
+    }
+    for (size_t i = 0; i < bf_profile_program.length; i++) {
+        bf_profile_runs[i] = 0;
+    }
+    return 0;
+}
+
+/* Run file's program with exact per-instruction counts and report them */
+void bf_profile(const fs_entry* file) {
+    const bf_program* program = &bf_profile_program;
+    unsigned long long total;
+    unsigned int start;
+    unsigned int elapsed;
+
+    if (bf_profile_load(file, "[BF] Profiling...\n") != 0) {
+        return;
+    }
+
+    start = arch_time_us();
+    bf_run_profile(program, bf_profile_runs);
+    elapsed = arch_time_us() - start;
+    terminal_putchar('\n');
+
+    total = bf_profile_tally(program);
+
+    bf_profile_heading("Profile:\n");
+    terminal_writestring("  Ops executed: ");
+    bf_profile_number(total, 0);
+    terminal_writestring("\n  Time:         ");
+    bf_profile_number(elapsed / 1000, 0);
+    terminal_writestring(" ms\n  Ops/sec:      ");
+    bf_profile_number(bf_profile_divide(total * 1000000, elapsed ? elapsed : 1), 0);
+    terminal_putchar('\n');
+
+    bf_profile_report(program, file->data, total, 1);
+}
+
+/* Map the JIT output native of program, size bytes long: instruction i
+ * starts at native + arch_jit_offset(i), in instruction order */
+static void bf_sample_map_jit(const bf_program* program, const uint8_t* native, size_t size) {
+    bf_sample_first = native;
+    bf_sample_end = native + size;
+    for (size_t i = 0; i < program->length; i++) {
+        bf_sample_map[i].address = native + arch_jit_offset(i);
+        bf_sample_map[i].image = 0;
+        bf_sample_map[i].insn = i;
+    }
+    bf_sample_map_length = program->length;
+}
+
+/* Map image's ahead-of-time translation: collect its marks from
+ * sysfs_map and sort them by address */
+static void bf_sample_map_image(const bf_image* image) {
+    bf_sample_first = __start_sysfs_native;
+    bf_sample_end = __stop_sysfs_native;
+    bf_sample_map_length = 0;
+
+    for (const bf_native_mark* mark = __start_sysfs_map;
+         mark < __stop_sysfs_map && bf_sample_map_length < BF_MAX_INSNS; mark++) {
+        size_t i = bf_sample_map_length;
+
+        if (mark->image != image) {
+            continue;
+        }
+        bf_sample_map_length++;
+        while (i > 0 && (unsigned long)bf_sample_map[i - 1].address > (unsigned long)mark->address) {
+            bf_sample_map[i] = bf_sample_map[i - 1];
+            i--;
+        }
+        bf_sample_map[i] = *mark;
+    }
+}
+
+/* Find the IR instruction running at pc in the mapped code.
+ * Returns 0 and sets *insn, or -1 if pc lies outside it. */
+static int bf_sample_lookup(unsigned long pc, size_t* insn) {
+    size_t low = 0;
+    size_t high = bf_sample_map_length;
+
+    if (pc < (unsigned long)bf_sample_first || pc >= (unsigned long)bf_sample_end) {
+        return -1;
+    }
+    /* Last mark at or below pc */
+    while (low < high) {
+        size_t middle = low + (high - low) / 2;
+        if ((unsigned long)bf_sample_map[middle].address <= pc) {
+            low = middle + 1;
+        } else {
+            high = middle;
+        }
+    }
+    if (low == 0) {
+        return -1;
+    }
+    *insn = bf_sample_map[low - 1].insn;
+    return 0;
+}
+
+/* Timer interrupt handler while sampling */
+static void bf_sample_take(unsigned long pc) {
+    size_t count = bf_sample_count;
+
+    if (count < BF_SAMPLE_MAX) {
+        bf_sample_pcs[count] = pc;
+    }
+    bf_sample_count = count + 1;
+}
+
+/* Run file's program natively while a timer samples where it is, then
+ * map the samples back to source and report them. Native code is the
+ * built-in translation if the program has one, else the JIT's; programs
+ * neither can run are interpreted, and their samples not attributed. */
+void bf_profile_sample(const fs_entry* file) {
+    const bf_program* program = &bf_profile_program;
+    const bf_image* image = file->image;
+    bf_native_entry entry = 0;
+    const char* running = "interpreter";
+    uint8_t* native;
+    size_t native_size;
+    size_t taken;
+    size_t kept;
+    size_t mapped = 0;
+    unsigned int start;
+    unsigned int elapsed;
+
+    if (bf_profile_load(file, "[BF] Sampling...\n") != 0) {
+        return;
+    }
+
+    /* Native code exists only for 8-bit clamped tapes. The translation
+     * must come from this very IR for its marks to index it. */
+    if (program->variant.cell_bits == 8 && program->variant.bounds == BF_BOUNDS_CLAMP) {
+        if (image && image->native && image->magic == BF_IMAGE_MAGIC &&
+            image->version == BF_IMAGE_VERSION && image->length == program->length) {
+            bf_sample_map_image(image);
+            entry = image->native;
+            running = "ahead-of-time code";
+        } else if ((native_size = bf_jit_compile(program, &native)) != 0) {
+            bf_sample_map_jit(program, native, native_size);
+            entry = (bf_native_entry)(void*)native;
+            running = "JIT code";
+        }
+    }
+
+    bf_sample_count = 0;
+    if (arch_sample_start(BF_SAMPLE_HZ, bf_sample_take) != 0) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("[BF] Error: no sampling timer on this architecture\n");
+        return;
+    }
+    start = arch_time_us();
+    if (entry) {
+        bf_run_native(entry, program->variant.tape_cells);
+    } else {
+        bf_run(program);
+    }
+    elapsed = arch_time_us() - start;
+    arch_sample_stop();
+    terminal_putchar('\n');
+
+    taken = bf_sample_count;
+    kept = (taken < BF_SAMPLE_MAX) ? taken : BF_SAMPLE_MAX;
+    if (entry) {
+        for (size_t i = 0; i < kept; i++) {
+            size_t insn;
+            if (bf_sample_lookup(bf_sample_pcs[i], &insn) == 0) {
+                bf_profile_runs[insn]++;
+                mapped++;
+            }
+        }
+    }
+    bf_profile_tally(program);
+
+    bf_profile_heading("Sampled profile:\n");
+    terminal_writestring("  Samples:      ");
+    bf_profile_number(taken, 0);
+    terminal_writestring(" at ");
+    bf_profile_number(BF_SAMPLE_HZ, 0);
+    terminal_writestring(" Hz");
+    if (taken > kept) {
+        terminal_writestring(", first ");
+        bf_profile_number(kept, 0);
+        terminal_writestring(" kept");
+    }
+    terminal_writestring("\n  Time:         ");
+    bf_profile_number(elapsed / 1000, 0);
+    terminal_writestring(" ms\n  Running:      ");
+    terminal_writestring(running);
+    terminal_putchar('\n');
+
+    if (!entry) {
+        terminal_writestring("  Interpreted samples have no source position;\n"
+                             "  'profile <file>' counts them exactly\n");
+        return;
+    }
+    terminal_writestring("  In program:   ");
+    bf_profile_number(mapped, 0);
+    terminal_writestring(" (");
+    bf_profile_number(bf_profile_percent(mapped, kept), 0);
+    terminal_writestring("%, the rest in kernel helpers and output)\n");
+
+    bf_profile_report(program, file->data, kept, 0);
+}
@@ -0,0 +1,237 @@
+/* Tape Scanning
+ * Zero-cell search behind the SCAN instruction ("[>]", "[<]", "[>>>]").
+ * SSE2 on x86 and NEON on arm64 test 32 cells per step; other builds use
+ * a word-at-a-time fallback. Scans park on the tape edge like '>' and '<'.
+ */
+
+#include "kernel.h"
+#include "arch.h"
+#include "bf.h"
+
+/* Cells tested per vector step */
+#define SCAN_CHUNK 32
+
+#if defined(__i386__) || defined(__x86_64__)
+#define SCAN_HAVE_SIMD 1
+
+/* The kernel is built without SSE; only the vector scan loops use it */
+#define SCAN_SIMD_TARGET __attribute__((target("sse2")))
+
+/* Bit i set if cells[i] == 0, for 32 cells (SSE2) */
+SCAN_SIMD_TARGET static inline unsigned int scan_zero_mask(const uint8_t* cells) {
+    unsigned int low, high;
+    __asm__("movdqu (%2), %%xmm0\n\t"
+            "movdqu 16(%2), %%xmm1\n\t"
+            "pxor %%xmm2, %%xmm2\n\t"
+            "pcmpeqb %%xmm2, %%xmm0\n\t"
+            "pcmpeqb %%xmm2, %%xmm1\n\t"
+            "pmovmskb %%xmm0, %0\n\t"
+            "pmovmskb %%xmm1, %1"
+            : "=&r"(low), "=&r"(high)
+            : "r"(cells), "m"(*(const uint8_t (*)[SCAN_CHUNK])cells)
+            : "xmm0", "xmm1", "xmm2");
+    return low | (high << 16);
+}
+
+#elif defined(__aarch64__)
+#define SCAN_HAVE_SIMD 1
+#define SCAN_SIMD_TARGET
+
+/* Per-lane weights turning a byte compare result into a bitmask */
+static const uint8_t scan_lane_bits[16] __attribute__((aligned(16))) = {
+    1, 2, 4, 8, 16, 32, 64, 128, 1, 2, 4, 8, 16, 32, 64, 128
+};
+
+/* Bit i set if cells[i] == 0, for 32 cells (NEON) */
+static inline unsigned int scan_zero_mask(const uint8_t* cells) {
+    unsigned int b0, b1, b2, b3;
+    __asm__("ld1 {v0.16b, v1.16b}, [%4]\n\t"
+            "ld1 {v2.16b}, [%5]\n\t"
+            "cmeq v0.16b, v0.16b, #0\n\t"
+            "cmeq v1.16b, v1.16b, #0\n\t"
+            "and v0.16b, v0.16b, v2.16b\n\t"
+            "and v1.16b, v1.16b, v2.16b\n\t"
+            "ext v3.16b, v0.16b, v0.16b, #8\n\t"
+            "ext v4.16b, v1.16b, v1.16b, #8\n\t"
+            "addv b0, v0.8b\n\t"
+            "addv b3, v3.8b\n\t"
+            "addv b1, v1.8b\n\t"
+            "addv b4, v4.8b\n\t"
+            "umov %w0, v0.b[0]\n\t"
+            "umov %w1, v3.b[0]\n\t"
+            "umov %w2, v1.b[0]\n\t"
+            "umov %w3, v4.b[0]"
+            : "=r"(b0), "=r"(b1), "=r"(b2), "=r"(b3)
+            : "r"(cells), "r"(scan_lane_bits),
+              "m"(*(const uint8_t (*)[SCAN_CHUNK])cells)
+            : "v0", "v1", "v2", "v3", "v4");
+    return b0 | (b1 << 8) | (b2 << 16) | (b3 << 24);
+}
+
+#else
+#define SCAN_HAVE_SIMD 0
+#endif
+
+/* Nonzero if no byte of the word is zero */
+static inline int scan_word_nonzero(size_t word) {
+    const size_t ones = (size_t)0x01010101;
+    const size_t highs = (size_t)0x80808080;
+    return ((word - ones) & ~word & highs) == 0;
+}
+
+#if SCAN_HAVE_SIMD
+/* Lattice mask for a stride: bits 0, stride, 2*stride, ... below 32 */
+static unsigned int scan_lattice(size_t stride) {
+    unsigned int pattern = 0;
+    for (size_t bit = 0; bit < SCAN_CHUNK; bit += stride) {
+        pattern |= 1u << bit;
+    }
+    return pattern;
+}
+
+/* Vector part of a right scan. Returns the cell found, or sets *pointer to
+ * the first lattice position not yet tested and returns -1. */
+SCAN_SIMD_TARGET static int scan_right_simd(const uint8_t* tape, size_t last, size_t* pointer, size_t stride) {
+    unsigned int pattern = scan_lattice(stride);
+    size_t advance = (stride - (SCAN_CHUNK % stride)) % stride;
+    size_t first = 0;  /* Offset of the first lattice cell in this chunk */
+    size_t base = *pointer;
+
+    while (base + SCAN_CHUNK - 1 <= last) {
+        unsigned int hits = scan_zero_mask(tape + base) & (pattern << first);
+        if (hits) {
+            *pointer = base + __builtin_ctz(hits);
+            return 0;
+        }
+        base += SCAN_CHUNK;
+        first += advance;
+        if (first >= stride) {
+            first -= stride;
+        }
+    }
+    *pointer = base + first;
+    return -1;
+}
+
+/* Vector part of a left scan, mirroring scan_right_simd */
+SCAN_SIMD_TARGET static int scan_left_simd(const uint8_t* tape, size_t* pointer, size_t stride) {
+    unsigned int pattern = scan_lattice(stride);
+    size_t advance = (stride - (SCAN_CHUNK % stride)) % stride;
+    size_t first = 0;
+    size_t top = *pointer;  /* Highest cell of the chunk */
+    unsigned int reversed = 0;
+
+    /* Bits 31, 31 - stride, ... for chunks read from the top down */
+    for (size_t bit = 0; bit < SCAN_CHUNK; bit++) {
+        if (pattern & (1u << bit)) {
+            reversed |= 1u << (SCAN_CHUNK - 1 - bit);
+        }
+    }
+
+    while (top >= SCAN_CHUNK - 1) {
+        size_t base = top - (SCAN_CHUNK - 1);
+        unsigned int hits = scan_zero_mask(tape + base) & (reversed >> first);
+        if (hits) {
+            *pointer = base + (31 - __builtin_clz(hits));
+            return 0;
+        }
+        top -= SCAN_CHUNK;
+        first += advance;
+        if (first >= stride) {
+            first -= stride;
+        }
+        if (top + 1 == 0) {
+            break;
+        }
+    }
+    if (top + 1 == 0 || top < first) {
+        /* The next lattice cell is past the left edge */
+        *pointer = 0;
+        return -1;
+    }
+    *pointer = top - first;
+    return -1;
+}
+#endif
+
+/* Scan right from pointer by stride for a zero cell; stops at the last cell */
+static size_t scan_right(const uint8_t* tape, size_t size, size_t pointer, size_t stride) {
+    size_t last = size - 1;
+
+#if SCAN_HAVE_SIMD
+    if (stride <= SCAN_CHUNK && arch_has_simd()) {
+        if (scan_right_simd(tape, last, &pointer, stride) == 0) {
+            return pointer;
+        }
+    }
+#endif
+
+    /* Whole words for "[>]" once aligned */
+    if (stride == 1) {
+        while (pointer <= last && ((unsigned long)(tape + pointer) & (sizeof(size_t) - 1)) != 0) {
+            if (tape[pointer] == 0) {
+                return pointer;
+            }
+            pointer++;
+        }
+        while (pointer + sizeof(size_t) - 1 <= last &&
+               scan_word_nonzero(*(const size_t*)(tape + pointer))) {
+            pointer += sizeof(size_t);
+        }
+    }
+
+    while (pointer <= last) {
+        if (tape[pointer] == 0) {
+            return pointer;
+        }
+        if (last - pointer < stride) {
+            break;  /* The next step clamps to the last cell */
+        }
+        pointer += stride;
+    }
+    return last;
+}
+
+/* Scan left from pointer by stride for a zero cell; stops at cell 0 */
+static size_t scan_left(const uint8_t* tape, size_t pointer, size_t stride) {
+#if SCAN_HAVE_SIMD
+    if (stride <= SCAN_CHUNK && arch_has_simd()) {
+        if (scan_left_simd(tape, &pointer, stride) == 0 || pointer == 0) {
+            return pointer;
+        }
+    }
+#endif
+
+    /* Whole words for "[<]" once aligned */
+    if (stride == 1) {
+        while (pointer > 0 && ((unsigned long)(tape + pointer + 1) & (sizeof(size_t) - 1)) != 0) {
+            if (tape[pointer] == 0) {
+                return pointer;
+            }
+            pointer--;
+        }
+        while (pointer >= sizeof(size_t) &&
+               scan_word_nonzero(*(const size_t*)(tape + pointer + 1 - sizeof(size_t)))) {
+            pointer -= sizeof(size_t);
+        }
+    }
+
+    while (tape[pointer] != 0) {
+        if (pointer < stride) {
+            return 0;
+        }
+        pointer -= stride;
+    }
+    return pointer;
+}
+
+/* Find the zero cell a "[>]"-style loop would stop on, moving by stride
+ * (negative for left). Like '>' and '<', the pointer never leaves the
+ * tape: a scan that runs into an edge returns the edge cell, and if that
+ * is nonzero the loop never ends. */
+size_t bf_scan_tape(const uint8_t* tape, size_t size, size_t pointer, int stride) {
+    if (stride > 0) {
+        return scan_right(tape, size, pointer, (size_t)stride);
+    }
+    return scan_left(tape, pointer, (size_t)-stride);
+}
@@ -0,0 +1,260 @@
+/* Cooperative Job Scheduler
+ * Runs Brainfuck programs as background jobs ("ghost &"), each on its own
+ * execution context. Jobs are interpreted and take turns: every round
+ * steps each ready job once with a budget of BF_JOB_SLICE instructions,
+ * which the engines charge at loop back-edges only, so straight-line
+ * code runs at full speed. A job whose ',' finds no input pauses on it
+ * and is skipped until a key is typed for it.
+ *
+ * Rounds run while the shell waits for a command line and while a job
+ * is in the foreground (bf_job_foreground), which hands it the keyboard.
+ */
+
+#include "kernel.h"
+#include "bf.h"
+
+/* Keys typed for a job that it has not read yet */
+#define BF_JOB_INPUT 64
+
+/* Keys the foreground loop handles itself */
+#define BF_KEY_INTERRUPT 0x03  /* Ctrl+C: kill the job */
+#define BF_KEY_SUSPEND   0x1A  /* Ctrl+Z: back to the background */
+
+/* VGA entry helper */
+static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
+    return (uint16_t) uc | (uint16_t) color << 8;
+}
+
+/* One job; slot i has job id i + 1, and id 0 marks a free slot */
+typedef struct {
+    int id;
+    int state;
+    const fs_entry* file;
+    bf_context* context;
+    bf_program program;
+    char input[BF_JOB_INPUT];
+    size_t input_head;
+    size_t input_count;
+} bf_job;
+
+static bf_job bf_jobs[BF_MAX_JOBS];
+
+/* IR of each job compiled from source; jobs from a precompiled image run
+ * the image's IR in place */
+static bf_insn bf_job_code[BF_MAX_JOBS][BF_MAX_INSNS];
+
+/* Most recently started job still around, or 0 */
+static int bf_job_recent = 0;
+
+/* Input endpoint of a job's context: the next key typed for it, or
+ * BF_READ_WAIT to pause on the ',' until there is one */
+static int bf_job_read(bf_context* context) {
+    bf_job* job = (bf_job*)context->io;
+    char c;
+
+    if (job->input_count == 0) {
+        job->state = BF_JOB_WAITING;
+        return BF_READ_WAIT;
+    }
+    c = job->input[job->input_head];
+    job->input_head = (job->input_head + 1) % BF_JOB_INPUT;
+    job->input_count--;
+    return (uint8_t)c;
+}
+
+/* Job with id id, or 0 if there is none */
+static bf_job* bf_job_find(int id) {
+    if (id < 1 || id > BF_MAX_JOBS || bf_jobs[id - 1].id != id) {
+        return 0;
+    }
+    return &bf_jobs[id - 1];
+}
+
+/* Free job's slot and context */
+static void bf_job_remove(bf_job* job) {
+    bf_context_free(job->context);
+    if (bf_job_recent == job->id) {
+        bf_job_recent = 0;
+    }
+    job->id = 0;
+}
+
+static void bf_job_error(const char* message) {
+    terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+    terminal_writestring(message);
+}
+
+/* Start file's program as a background job. Settings in override (zero
+ * fields excepted) replace the engine variant it asked for; override
+ * may be 0. Returns the job id, or -1 (reported) if it cannot start. */
+int bf_job_start(fs_entry* file, const bf_variant* override) {
+    size_t slot;
+    bf_job* job;
+    bf_variant variant;
+
+    for (slot = 0; slot < BF_MAX_JOBS; slot++) {
+        if (bf_jobs[slot].id == 0) {
+            break;
+        }
+    }
+    job = &bf_jobs[slot];
+    if (slot == BF_MAX_JOBS || (job->context = bf_context_alloc()) == 0) {
+        bf_job_error("[BF] Error: too many jobs\n");
+        return -1;
+    }
+
+    if (file->image == 0 || bf_load_image(file->image, &job->program) != 0) {
+        job->program.code = bf_job_code[slot];
+        job->program.capacity = BF_MAX_INSNS;
+        job->program.native = 0;
+        job->program.native_size = 0;
+        job->program.source = 0;
+        if (bf_compile(file->data, &job->program) != 0) {
+            bf_context_free(job->context);
+            return -1;
+        }
+    }
+
+    variant = job->program.variant;
+    if (override) {
+        bf_variant_apply(&variant, override);
+    }
+    if (bf_context_load(job->context, &job->program, &variant) != 0) {
+        bf_context_free(job->context);
+        return -1;
+    }
+    job->context->read = bf_job_read;
+    job->context->io = job;
+    job->context->budget = BF_JOB_SLICE;
+
+    job->id = (int)slot + 1;
+    job->state = BF_JOB_READY;
+    job->file = file;
+    job->input_head = 0;
+    job->input_count = 0;
+    bf_job_recent = job->id;
+    return job->id;
+}
+
+/* Run one round: step every job that can run by one slice. A waiting
+ * job can once a key was typed for it.
+ * Returns the number of jobs that ran. */
+int bf_job_schedule(void) {
+    int ran = 0;
+
+    for (size_t i = 0; i < BF_MAX_JOBS; i++) {
+        bf_job* job = &bf_jobs[i];
+
+        if (job->id == 0 || job->state == BF_JOB_DONE) {
+            continue;
+        }
+        if (job->state == BF_JOB_WAITING) {
+            if (job->input_count == 0) {
+                continue;
+            }
+            job->state = BF_JOB_READY;
+        }
+        if (bf_context_step(job->context)) {
+            job->state = BF_JOB_DONE;
+        }
+        ran++;
+    }
+    return ran;
+}
+
+/* Bring job id to the foreground: keys typed go to it, and rounds run
+ * until it ends (Ctrl+C kills it, Ctrl+Z sends it back to the
+ * background). Returns 0, or -1 if there is no such job. */
+int bf_job_foreground(int id) {
+    bf_job* job = bf_job_find(id);
+
+    if (job == 0) {
+        return -1;
+    }
+
+    while (job->state != BF_JOB_DONE) {
+        int c;
+
+        keyboard_handle_interrupt();
+        /* Keys that find the job's buffer full are dropped, so Ctrl+C
+         * and Ctrl+Z are always seen */
+        while ((c = keyboard_getchar()) != -1) {
+            if (c == BF_KEY_INTERRUPT) {
+                bf_job_remove(job);
+                terminal_writestring("^C\n");
+                return 0;
+            }
+            if (c == BF_KEY_SUSPEND) {
+                terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
+                terminal_writestring("\n[BF] Job in background\n");
+                return 0;
+            }
+            if (job->input_count < BF_JOB_INPUT) {
+                job->input[(job->input_head + job->input_count) % BF_JOB_INPUT] = (char)c;
+                job->input_count++;
+            }
+        }
+        bf_job_schedule();
+    }
+
+    bf_job_remove(job);
+    terminal_putchar('\n');
+    return 0;
+}
+
+/* Stop job id and drop it with any output it still buffers.
+ * Returns 0, or -1 if there is no such job. */
+int bf_job_kill(int id) {
+    bf_job* job = bf_job_find(id);
+
+    if (job == 0) {
+        return -1;
+    }
+    bf_job_remove(job);
+    return 0;
+}
+
+/* Id of the most recently started job still around, or 0 */
+int bf_job_last(void) {
+    return bf_job_recent;
+}
+
+/* Describe up to max jobs in info, in id order.
+ * Returns the number described. */
+size_t bf_job_list(bf_job_info* info, size_t max) {
+    size_t count = 0;
+
+    for (size_t i = 0; i < BF_MAX_JOBS && count < max; i++) {
+        const bf_job* job = &bf_jobs[i];
+
+        if (job->id == 0) {
+            continue;
+        }
+        info[count].id = job->id;
+        info[count].state = job->state;
+        info[count].name = job->file->name;
+        info[count].ops = job->context->ops;
+        count++;
+    }
+    return count;
+}
+
+/* Report the background jobs that ended since the last call and free
+ * their slots */
+void bf_job_reap(void) {
+    for (size_t i = 0; i < BF_MAX_JOBS; i++) {
+        bf_job* job = &bf_jobs[i];
+
+        if (job->id == 0 || job->state != BF_JOB_DONE) {
+            continue;
+        }
+        terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
+        terminal_putchar('[');
+        terminal_putchar((char)('0' + job->id));
+        terminal_writestring("] Done: ");
+        terminal_writestring(job->file->name);
+        terminal_putchar('\n');
+        bf_job_remove(job);
+    }
+    terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
+}
@@ -0,0 +1,369 @@
+/* Multiprocessor Batch Runs
+ * bf_batch runs several programs at once, one context each, on every CPU
+ * arch_smp_start brought up. Each CPU keeps a deque of runnable tasks
+ * (Chase-Lev: its owner pushes and pops at the bottom, other CPUs steal
+ * from the top). A CPU runs a task for a BF_SMP_SLICE budget and pushes
+ * it back on its own deque, so a CPU that runs dry takes over work
+ * another one still has queued. A batch starts out on the boot CPU's
+ * deque and spreads from there.
+ *
+ * Interpreted programs share nothing but the terminal. Their output
+ * endpoint copies each block into a bounded multi-producer queue, and the
+ * boot CPU alone writes it out; while the queue is full, producers wait.
+ */
+
+#include "kernel.h"
+#include "arch.h"
+#include "bf.h"
+
+/* Instruction budget of one batch slice, long enough that the deques
+ * see little traffic */
+#define BF_SMP_SLICE (1UL << 20)
+
+/* Tasks a deque holds at most: a power of two no smaller than a batch */
+#define BF_SMP_DEQUE 8
+
+/* Console queue: blocks of output waiting for the boot CPU */
+#define BF_CONSOLE_SLOTS 64
+#define BF_CONSOLE_BLOCK 120
+
+/* Ctrl+C, which stops a batch */
+#define BF_KEY_INTERRUPT 0x03
+
+/* VGA entry helper */
+static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
+    return (uint16_t) uc | (uint16_t) color << 8;
+}
+
+/* One program of a batch. Only the CPU that took it from a deque
+ * touches it until it goes back on one. */
+typedef struct {
+    bf_context* context;
+    bf_program program;
+} bf_task;
+
+/* Work-stealing deque; top and bottom only grow, and slot i % BF_SMP_DEQUE
+ * holds task i for top <= i < bottom */
+typedef struct {
+    unsigned int top;
+    unsigned int bottom;
+    bf_task* tasks[BF_SMP_DEQUE];
+} __attribute__((aligned(64))) bf_deque;
+
+/* Console queue slot: free for the producer that claims position p while
+ * sequence is p, full for the consumer at position p once it is p + 1 */
+typedef struct {
+    unsigned int sequence;
+    size_t length;
+    char data[BF_CONSOLE_BLOCK];
+} bf_console_slot;
+
+static bf_deque bf_deques[ARCH_MAX_CPUS];
+static bf_task bf_tasks[BF_MAX_CONTEXTS - 1];
+static bf_insn bf_task_code[BF_MAX_CONTEXTS - 1][BF_MAX_INSNS];
+static unsigned int bf_smp_cpu_count = 1;
+
+/* Tasks of the running batch that have not ended, and whether it was
+ * stopped; workers only look for tasks while bf_smp_active is set */
+static int bf_smp_active = 0;
+static int bf_smp_left = 0;
+static int bf_smp_stop = 0;
+
+static bf_console_slot bf_console[BF_CONSOLE_SLOTS];
+static unsigned int bf_console_tail = 0;  /* Next position to claim */
+static unsigned int bf_console_head = 0;  /* Next position to write out (boot CPU) */
+
+/* Owner: add task at the bottom */
+static void bf_deque_push(bf_deque* deque, bf_task* task) {
+    unsigned int bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED);
+
+    deque->tasks[bottom % BF_SMP_DEQUE] = task;
+    __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELEASE);
+}
+
+/* Owner: take the newest task, or 0. Claims the bottom slot first, then
+ * races thieves for it only when it is the last one. */
+static bf_task* bf_deque_pop(bf_deque* deque) {
+    unsigned int bottom = __atomic_load_n(&deque->bottom, __ATOMIC_RELAXED) - 1;
+    unsigned int top;
+    bf_task* task;
+
+    __atomic_store_n(&deque->bottom, bottom, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    top = __atomic_load_n(&deque->top, __ATOMIC_RELAXED);
+
+    if ((int)(bottom - top) < 0) {
+        /* Empty */
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+        return 0;
+    }
+    task = deque->tasks[bottom % BF_SMP_DEQUE];
+    if (bottom == top) {
+        if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                         __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+            task = 0;  /* A thief got it */
+        }
+        __atomic_store_n(&deque->bottom, bottom + 1, __ATOMIC_RELAXED);
+    }
+    return task;
+}
+
+/* Any CPU: take the oldest task, or 0 if there is none or another CPU
+ * took it first */
+static bf_task* bf_deque_steal(bf_deque* deque) {
+    unsigned int top = __atomic_load_n(&deque->top, __ATOMIC_ACQUIRE);
+    unsigned int bottom;
+    bf_task* task;
+
+    __atomic_thread_fence(__ATOMIC_SEQ_CST);
+    bottom = __atomic_load_n(&deque->bottom, __ATOMIC_ACQUIRE);
+    if ((int)(bottom - top) <= 0) {
+        return 0;
+    }
+    task = deque->tasks[top % BF_SMP_DEQUE];
+    if (!__atomic_compare_exchange_n(&deque->top, &top, top + 1, 0,
+                                     __ATOMIC_SEQ_CST, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    return task;
+}
+
+/* Write queued output to the terminal. Boot CPU only. */
+static void bf_console_drain(void) {
+    while (1) {
+        bf_console_slot* slot = &bf_console[bf_console_head % BF_CONSOLE_SLOTS];
+
+        if (__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) != bf_console_head + 1) {
+            return;
+        }
+        terminal_write(slot->data, slot->length);
+        __atomic_store_n(&slot->sequence, bf_console_head + BF_CONSOLE_SLOTS, __ATOMIC_RELEASE);
+        bf_console_head++;
+    }
+}
+
+/* Queue one block of at most BF_CONSOLE_BLOCK bytes */
+static void bf_console_push(const char* data, size_t length) {
+    unsigned int position = __atomic_load_n(&bf_console_tail, __ATOMIC_RELAXED);
+    bf_console_slot* slot;
+
+    while (1) {
+        int lag;
+
+        slot = &bf_console[position % BF_CONSOLE_SLOTS];
+        lag = (int)(__atomic_load_n(&slot->sequence, __ATOMIC_ACQUIRE) - position);
+        if (lag == 0) {
+            /* Free: claim it, unless another producer just did */
+            if (__atomic_compare_exchange_n(&bf_console_tail, &position, position + 1, 1,
+                                            __ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+                break;
+            }
+        } else if (lag < 0) {
+            /* Full: the boot CPU makes room itself, the others wait for it */
+            if (arch_cpu_index() == 0) {
+                bf_console_drain();
+            } else {
+                arch_cpu_relax();
+            }
+            position = __atomic_load_n(&bf_console_tail, __ATOMIC_RELAXED);
+        } else {
+            position = __atomic_load_n(&bf_console_tail, __ATOMIC_RELAXED);
+        }
+    }
+
+    for (size_t i = 0; i < length; i++) {
+        slot->data[i] = data[i];
+    }
+    slot->length = length;
+    __atomic_store_n(&slot->sequence, position + 1, __ATOMIC_RELEASE);
+}
+
+/* Output endpoint of batch contexts */
+static size_t bf_console_write(bf_context* context, const char* data, size_t length) {
+    size_t total = length;
+
+    (void)context;
+    while (length > 0) {
+        size_t count = (length < BF_CONSOLE_BLOCK) ? length : BF_CONSOLE_BLOCK;
+        bf_console_push(data, count);
+        data += count;
+        length -= count;
+    }
+    return total;
+}
+
+/* Input endpoint of batch contexts: batches get no input, and ',' reads 0
+ * as it does when no key is waiting */
+static int bf_batch_read(bf_context* context) {
+    (void)context;
+    return 0;
+}
+
+/* A task for cpu: its own newest, else one stolen from another CPU */
+static bf_task* bf_smp_find(unsigned int cpu) {
+    bf_task* task = bf_deque_pop(&bf_deques[cpu]);
+
+    for (unsigned int i = 1; task == 0 && i < bf_smp_cpu_count; i++) {
+        task = bf_deque_steal(&bf_deques[(cpu + i) % bf_smp_cpu_count]);
+    }
+    return task;
+}
+
+/* Run a slice of task on cpu; requeue it there unless it ended */
+static void bf_smp_run(unsigned int cpu, bf_task* task) {
+    if (!__atomic_load_n(&bf_smp_stop, __ATOMIC_RELAXED) && !bf_context_step(task->context)) {
+        bf_deque_push(&bf_deques[cpu], task);
+        return;
+    }
+    /* Last touch of the task: the boot CPU may free it from here on */
+    __atomic_sub_fetch(&bf_smp_left, 1, __ATOMIC_RELEASE);
+}
+
+/* Main loop of every CPU but the boot one */
+static void bf_smp_worker(unsigned int cpu) {
+    while (1) {
+        bf_task* task = 0;
+
+        if (__atomic_load_n(&bf_smp_active, __ATOMIC_ACQUIRE)) {
+            task = bf_smp_find(cpu);
+        }
+        if (task) {
+            bf_smp_run(cpu, task);
+        } else {
+            arch_cpu_relax();
+        }
+    }
+}
+
+/* Start the other CPUs as batch workers and report how many run */
+void bf_smp_initialize(void) {
+    for (unsigned int i = 0; i < BF_CONSOLE_SLOTS; i++) {
+        bf_console[i].sequence = i;
+    }
+    bf_smp_cpu_count = (unsigned int)arch_smp_start(bf_smp_worker);
+    if (bf_smp_cpu_count > ARCH_MAX_CPUS) {
+        bf_smp_cpu_count = ARCH_MAX_CPUS;
+    }
+}
+
+unsigned int bf_smp_cpus(void) {
+    return bf_smp_cpu_count;
+}
+
+/* Set up task for file's program. Returns 0, or -1 (reported). */
+static int bf_task_load(bf_task* task, bf_insn* code, const fs_entry* file, const bf_variant* override) {
+    bf_variant variant;
+
+    if (file->image == 0 || bf_load_image(file->image, &task->program) != 0) {
+        task->program.code = code;
+        task->program.capacity = BF_MAX_INSNS;
+        task->program.native = 0;
+        task->program.native_size = 0;
+        task->program.source = 0;
+        if (bf_compile(file->data, &task->program) != 0) {
+            return -1;
+        }
+    }
+    variant = task->program.variant;
+    if (override) {
+        bf_variant_apply(&variant, override);
+    }
+    if (bf_context_load(task->context, &task->program, &variant) != 0) {
+        return -1;
+    }
+    task->context->write = bf_console_write;
+    task->context->read = bf_batch_read;
+    task->context->budget = BF_SMP_SLICE;
+    return 0;
+}
+
+static void bf_smp_number(unsigned int value) {
+    char digits[12];
+    size_t count = 0;
+
+    do {
+        digits[count++] = (char)('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) {
+        terminal_putchar(digits[--count]);
+    }
+}
+
+/* Run count programs to their end at once, interpreted on every CPU,
+ * then report the time taken. Settings in override (zero fields
+ * excepted) replace the engine variant each asked for; override may be
+ * 0. Ctrl+C stops the batch. Boot CPU only. */
+void bf_batch(fs_entry* files[], size_t count, const bf_variant* override) {
+    size_t loaded = 0;
+    unsigned int start;
+    unsigned int elapsed;
+
+    terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
+    terminal_writestring("[BF] Running batch...\n");
+    terminal_setcolor(vga_entry(COLOR_LIGHT_GREEN, COLOR_BLACK));
+
+    if (count > BF_MAX_CONTEXTS - 1) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("[BF] Error: too many programs in one batch\n");
+        return;
+    }
+    while (loaded < count) {
+        bf_task* task = &bf_tasks[loaded];
+
+        task->context = bf_context_alloc();
+        if (task->context == 0) {
+            terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+            terminal_writestring("[BF] Error: no free context (stop some jobs)\n");
+            break;
+        }
+        if (bf_task_load(task, bf_task_code[loaded], files[loaded], override) != 0) {
+            bf_context_free(task->context);
+            break;
+        }
+        loaded++;
+    }
+
+    if (loaded == count) {
+        start = arch_time_us();
+        bf_smp_left = (int)count;
+        bf_smp_stop = 0;
+        for (size_t i = 0; i < count; i++) {
+            bf_deque_push(&bf_deques[0], &bf_tasks[i]);
+        }
+        __atomic_store_n(&bf_smp_active, 1, __ATOMIC_RELEASE);
+
+        /* The boot CPU works too, between writing output and watching
+         * for Ctrl+C */
+        while (__atomic_load_n(&bf_smp_left, __ATOMIC_ACQUIRE) > 0) {
+            bf_task* task;
+
+            bf_console_drain();
+            keyboard_handle_interrupt();
+            if (keyboard_getchar() == BF_KEY_INTERRUPT) {
+                __atomic_store_n(&bf_smp_stop, 1, __ATOMIC_RELAXED);
+            }
+            task = bf_smp_find(0);
+            if (task) {
+                bf_smp_run(0, task);
+            }
+        }
+        __atomic_store_n(&bf_smp_active, 0, __ATOMIC_RELAXED);
+        bf_console_drain();
+        elapsed = arch_time_us() - start;
+
+        terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
+        terminal_writestring(bf_smp_stop ? "\n[BF] Batch stopped: " : "\n[BF] Batch done: ");
+        bf_smp_number((unsigned int)count);
+        terminal_writestring(count == 1 ? " program, " : " programs, ");
+        bf_smp_number(elapsed / 1000);
+        terminal_writestring(" ms on ");
+        bf_smp_number(bf_smp_cpu_count);
+        terminal_writestring(bf_smp_cpu_count == 1 ? " CPU\n" : " CPUs\n");
+    }
+
+    for (size_t i = 0; i < loaded; i++) {
+        bf_context_free(bf_tasks[i].context);
+    }
+    terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
+}
@@ -0,0 +1,60 @@
+/* Brainfuck Superinstructions
+ * DO NOT EDIT - Generated by build_super.py from a profile of the
+ * sys/components programs:
+ *   alphabet.bf box.bf calculator.bf ghost.bf hello.bf help.bf
+ *   numbers.bf sierpinski.bf squares.bf
+ * Each op sequence below runs as one engine case, best first; the
+ * compiler gives an instruction the first superinstruction whose ops
+ * start there. Dispatches saved in the profile:
+ *   MOVE MULADD SET  46460
+ *   MOVE JZ          23300
+ *   MULADD SET JZ    22022
+ *   MOVE ADD JNZ     21132
+ *   MOVE JNZ         14505
+ *   MOVE SET         11538
+ *   ADD OUT SET      3040
+ *   ADD MULADD SET   3040
+ */
+
+#ifndef BF_SUPER_H
+#define BF_SUPER_H
+
+/* Number of superinstructions and most ops in one */
+#define BF_SUPER_COUNT 8
+#define BF_SUPER_LENGTH 3
+
+/* Ops of each superinstruction, END-terminated */
+#define BF_SUPER_OPS { \
+    { BF_OP_MOVE, BF_OP_MULADD, BF_OP_SET, BF_OP_END }, \
+    { BF_OP_MOVE, BF_OP_JZ, BF_OP_END }, \
+    { BF_OP_MULADD, BF_OP_SET, BF_OP_JZ, BF_OP_END }, \
+    { BF_OP_MOVE, BF_OP_ADD, BF_OP_JNZ, BF_OP_END }, \
+    { BF_OP_MOVE, BF_OP_JNZ, BF_OP_END }, \
+    { BF_OP_MOVE, BF_OP_SET, BF_OP_END }, \
+    { BF_OP_ADD, BF_OP_OUT, BF_OP_SET, BF_OP_END }, \
+    { BF_OP_ADD, BF_OP_MULADD, BF_OP_SET, BF_OP_END }, \
+}
+
+/* Engine handlers, expanded into the dispatch of bf_engine.h */
+#define BF_SUPER_CASES \
+    BF_SUPER_CASE(0) BF_DO_MOVE(); insn++; BF_DO_MULADD(); insn++; BF_DO_SET(); BF_NEXT(); \
+    BF_SUPER_CASE(1) BF_DO_MOVE(); insn++; BF_DO_JZ(); BF_NEXT(); \
+    BF_SUPER_CASE(2) BF_DO_MULADD(); insn++; BF_DO_SET(); insn++; BF_DO_JZ(); BF_NEXT(); \
+    BF_SUPER_CASE(3) BF_DO_MOVE(); insn++; BF_DO_ADD(); insn++; BF_DO_JNZ(); BF_NEXT(); \
+    BF_SUPER_CASE(4) BF_DO_MOVE(); insn++; BF_DO_JNZ(); BF_NEXT(); \
+    BF_SUPER_CASE(5) BF_DO_MOVE(); insn++; BF_DO_SET(); BF_NEXT(); \
+    BF_SUPER_CASE(6) BF_DO_ADD(); insn++; BF_DO_OUT(); insn++; BF_DO_SET(); BF_NEXT(); \
+    BF_SUPER_CASE(7) BF_DO_ADD(); insn++; BF_DO_MULADD(); insn++; BF_DO_SET(); BF_NEXT(); \
+
+/* Handler table entries for the threaded engines */
+#define BF_SUPER_LABELS \
+    BF_SUPER_LABEL(0) \
+    BF_SUPER_LABEL(1) \
+    BF_SUPER_LABEL(2) \
+    BF_SUPER_LABEL(3) \
+    BF_SUPER_LABEL(4) \
+    BF_SUPER_LABEL(5) \
+    BF_SUPER_LABEL(6) \
+    BF_SUPER_LABEL(7) \
+
+#endif
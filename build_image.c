@@ -0,0 +1,314 @@
+/* Build-Time Compiler
+ * The kernel's own compiler and interpreter (bf_compiler.c,
+ * bf_interpreter.c, bf_scan.c) built for the build machine, so the
+ * images build_sysfs.py embeds and the profile build_super.py takes come
+ * from the code the kernel runs. Reads one program on standard input
+ * and writes, one item per line:
+ *   image <magic> <version>
+ *   variant <cell bits> <bounds> <tape cells>
+ *   insn <op> <dispatch> <arg> <offset>     (every instruction, END included)
+ * then the program's evaluated start, if it has one:
+ *   prefix <resume> <pointer> <first cell>
+ *   output <bytes in hex>
+ *   tape <cell value>...                    (from the first cell on)
+ * The start is run on an interpreter engine until the first ',', the
+ * end, BF_PREFIX_BUDGET instructions or BF_PREFIX_MAX_OUTPUT bytes of
+ * output. With "--profile <budget>" the program is run on a profiling
+ * engine instead, up to its first ',' or budget instructions, and each
+ * instruction's count follows the instructions:
+ *   count <times run>
+ * Compile errors go to standard error and the exit status is 1.
+ *
+ * Only libc's read, write and exit are used, declared here: its headers
+ * would clash with kernel.h's types.
+ */
+
+#include "kernel.h"
+#include "arch.h"
+#include "bf.h"
+
+long read(int fd, void* buffer, unsigned long length);
+long write(int fd, const void* buffer, unsigned long length);
+void exit(int status);
+
+/* Instructions evaluated at most, and output bytes kept at most */
+#define BF_PREFIX_BUDGET 1000000
+#define BF_PREFIX_MAX_OUTPUT 16384
+
+/* Longest program read; the kernel's files are shorter */
+#define BUILD_MAX_SOURCE 65536
+
+static char build_source[BUILD_MAX_SOURCE + 1];
+static bf_insn build_code[BF_MAX_INSNS];
+static unsigned long long build_counts[BF_MAX_INSNS];
+
+/* Program output the prefix keeps */
+static char build_output[BF_PREFIX_MAX_OUTPUT];
+static size_t build_output_length;
+static int build_waiting;
+static int build_profiling;
+
+/* Standard output, buffered */
+static char build_line[4096];
+static size_t build_line_length;
+
+static void build_flush(int fd) {
+    size_t done = 0;
+    while (done < build_line_length) {
+        long written = write(fd, build_line + done, build_line_length - done);
+        if (written <= 0) {
+            exit(2);
+        }
+        done += (size_t)written;
+    }
+    build_line_length = 0;
+}
+
+static void build_putc(char c) {
+    if (build_line_length == sizeof(build_line)) {
+        build_flush(1);
+    }
+    build_line[build_line_length++] = c;
+}
+
+static void build_puts(const char* text) {
+    while (*text) {
+        build_putc(*text++);
+    }
+}
+
+/* Print a signed decimal number, preceded by a blank */
+static void build_number(long long value) {
+    char digits[24];
+    size_t count = 0;
+    unsigned long long magnitude = (value < 0) ? 0ull - (unsigned long long)value : (unsigned long long)value;
+
+    build_putc(' ');
+    if (value < 0) {
+        build_putc('-');
+    }
+    do {
+        digits[count++] = (char)('0' + magnitude % 10);
+        magnitude /= 10;
+    } while (magnitude > 0);
+    while (count > 0) {
+        build_putc(digits[--count]);
+    }
+}
+
+/* Kernel services the compiler and interpreter call. Terminal output is
+ * only ever an error report here, so it goes to standard error. */
+void terminal_write(const char* data, size_t size) {
+    (void)!write(2, data, size);
+}
+
+void terminal_writestring(const char* data) {
+    size_t length = 0;
+    while (data[length] != '\0') {
+        length++;
+    }
+    terminal_write(data, length);
+}
+
+void terminal_putchar(char c) {
+    terminal_write(&c, 1);
+}
+
+void terminal_setcolor(uint8_t color) {
+    (void)color;
+}
+
+int keyboard_getchar(void) {
+    return -1;
+}
+
+void keyboard_handle_interrupt(void) {
+}
+
+int config_get_bf_engine(void) {
+    return BF_ENGINE_INTERP;
+}
+
+unsigned int arch_cpu_index(void) {
+    return 0;
+}
+
+/* Every x86 and arm64 build machine has SSE2 or NEON */
+int arch_has_simd(void) {
+    return 1;
+}
+
+int bf_jit_run(const bf_program* program, uint8_t* tape, size_t size, size_t* pointer, bf_dirty* dirty) {
+    (void)program;
+    (void)tape;
+    (void)size;
+    (void)pointer;
+    (void)dirty;
+    return -1;
+}
+
+void bf_jit_enter(bf_native_entry entry, uint8_t* tape, size_t size, size_t* pointer, bf_dirty* dirty) {
+    (void)entry;
+    (void)tape;
+    (void)size;
+    (void)pointer;
+    (void)dirty;
+}
+
+/* Output endpoint: keeps up to BF_PREFIX_MAX_OUTPUT bytes, and nothing
+ * when profiling */
+static size_t build_write(bf_context* context, const char* data, size_t length) {
+    size_t room = BF_PREFIX_MAX_OUTPUT - build_output_length;
+
+    (void)context;
+    if (build_profiling) {
+        return length;
+    }
+    if (length > room) {
+        length = room;
+    }
+    for (size_t i = 0; i < length; i++) {
+        build_output[build_output_length++] = data[i];
+    }
+    return length;
+}
+
+/* Input endpoint: input is only known at run time, so ',' pauses */
+static int build_read(bf_context* context) {
+    (void)context;
+    build_waiting = 1;
+    return BF_READ_WAIT;
+}
+
+/* Run program from its start until its first ',' or its end, or until
+ * budget instructions or the output limit stop it; counts, if not 0,
+ * gets each instruction's count. Returns the context left behind. */
+static bf_context* build_run(const bf_program* program, unsigned long long budget,
+                             unsigned long long* counts) {
+    bf_context* context = bf_context_alloc();
+
+    if (context == 0 || bf_context_load(context, program, &program->variant) != 0) {
+        exit(2);
+    }
+    build_profiling = (counts != 0);
+    context->write = build_write;
+    context->read = build_read;
+    context->budget = BF_JOB_SLICE;
+
+    while (context->ops < budget) {
+        if (counts) {
+            bf_context_profile(context, counts);
+        } else {
+            bf_context_step(context);
+        }
+        if (program->code[context->resume].op == BF_OP_END || build_waiting ||
+            build_output_length == BF_PREFIX_MAX_OUTPUT) {
+            break;
+        }
+    }
+    return context;
+}
+
+/* Write the evaluated start of program, if anything was evaluated and
+ * the tape it left can be restored: nothing past either edge */
+static void build_prefix(const bf_program* program) {
+    bf_context* context = build_run(program, BF_PREFIX_BUDGET, 0);
+    size_t width = program->variant.cell_bits / 8;
+    size_t cells = program->variant.tape_cells;
+    size_t first = cells;
+    size_t last = 0;
+
+    if (context->resume == 0) {
+        return;
+    }
+    for (size_t i = 0; i < (cells + 2 * BF_TAPE_GUARD) * width; i++) {
+        if (context->memory[i] != 0) {
+            size_t cell = i / width;
+            if (cell < BF_TAPE_GUARD || cell >= cells + BF_TAPE_GUARD) {
+                return;
+            }
+            if (first == cells) {
+                first = cell - BF_TAPE_GUARD;
+            }
+            last = cell - BF_TAPE_GUARD;
+        }
+    }
+
+    build_puts("prefix");
+    build_number((long long)context->resume);
+    build_number((long long)context->pointer);
+    build_number((first == cells) ? 0 : (long long)first);
+    build_puts("\noutput ");
+    for (size_t i = 0; i < build_output_length + context->output_length; i++) {
+        uint8_t byte = (uint8_t)((i < build_output_length) ? build_output[i]
+                                                             : context->output[i - build_output_length]);
+        build_putc("0123456789abcdef"[byte >> 4]);
+        build_putc("0123456789abcdef"[byte & 15]);
+    }
+    build_puts("\ntape");
+    for (size_t cell = first; first != cells && cell <= last; cell++) {
+        const uint8_t* bytes = context->memory + (cell + BF_TAPE_GUARD) * width;
+        unsigned long long value = 0;
+        for (size_t i = width; i-- > 0;) {
+            value = value << 8 | bytes[i];
+        }
+        build_number((long long)value);
+    }
+    build_putc('\n');
+}
+
+int main(int argc, char** argv) {
+    bf_program program = { build_code, 0, BF_MAX_INSNS, 0, 0, { 0, 0, 0 }, 0 };
+    unsigned long long profile = 0;
+    size_t length = 0;
+    long got;
+
+    if (argc == 3 && argv[1][0] == '-' && argv[1][1] == '-' && argv[1][2] == 'p') {
+        for (const char* digit = argv[2]; *digit >= '0' && *digit <= '9'; digit++) {
+            profile = profile * 10 + (unsigned long long)(*digit - '0');
+        }
+    } else if (argc != 1) {
+        terminal_writestring("usage: build_image [--profile budget] < program.bf\n");
+        return 2;
+    }
+
+    while (length < BUILD_MAX_SOURCE &&
+           (got = read(0, build_source + length, BUILD_MAX_SOURCE - length)) > 0) {
+        length += (size_t)got;
+    }
+    build_source[length] = '\0';
+
+    if (bf_compile(build_source, &program) != 0) {
+        return 1;
+    }
+
+    build_puts("image");
+    build_number(BF_IMAGE_MAGIC);
+    build_number(BF_IMAGE_VERSION);
+    build_puts("\nvariant");
+    build_number(program.variant.cell_bits);
+    build_number(program.variant.bounds);
+    build_number((long long)program.variant.tape_cells);
+    build_putc('\n');
+    for (size_t i = 0; i < program.length; i++) {
+        build_puts("insn");
+        build_number(build_code[i].op);
+        build_number(build_code[i].dispatch);
+        build_number(build_code[i].arg);
+        build_number(build_code[i].offset);
+        build_putc('\n');
+    }
+
+    if (profile) {
+        build_run(&program, profile, build_counts);
+        for (size_t i = 0; i < program.length; i++) {
+            build_puts("count");
+            build_number((long long)build_counts[i]);
+            build_putc('\n');
+        }
+    } else {
+        build_prefix(&program);
+    }
+    build_flush(1);
+    return 0;
+}
@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+"""
+Superinstruction generator for the Brainfuck interpreter.
+Profiles the programs in sys/components and writes bf_super.h: the op
+sequences they run most often, each of which the interpreter engines then
+dispatch as one case instead of one case per op (see bf_engine.h).
+Programs are compiled and run with build_image, the kernel's compiler
+and profiling engines built for the build machine, up to their first
+input or BF_PROFILE_BUDGET instructions. Run it again (make super) when the programs or the
+optimizer change; the selection is kept in the tree so builds do not
+depend on a profile. With --ngrams it only lists how often each op
+sequence ran.
+"""
+
+import os
+import sys
+import textwrap
+
+import build_sysfs as bf
+
+# Superinstructions generated at most, and ops in one at most. Must fit
+# the dispatch codes above BF_OP_SUPER in a uint8_t.
+BF_SUPER_MAX = 8
+BF_SUPER_LENGTH = 3
+
+# IR instructions profiled per program at most
+BF_PROFILE_BUDGET = 10000000
+
+# Ops a superinstruction may combine, with the names bf.h gives them;
+# bf_engine.h has a BF_DO_ body for each. Jumps change the instruction
+# that runs next, so they may only end a superinstruction.
+SUPER_OPS = {
+    bf.BF_OP_ADD: 'ADD',
+    bf.BF_OP_MOVE: 'MOVE',
+    bf.BF_OP_OUT: 'OUT',
+    bf.BF_OP_SET: 'SET',
+    bf.BF_OP_MULADD: 'MULADD',
+    bf.BF_OP_JZ: 'JZ',
+    bf.BF_OP_JNZ: 'JNZ',
+}
+SUPER_JUMPS = (bf.BF_OP_JZ, bf.BF_OP_JNZ)
+
+def candidates(code):
+    """Op sequences that could start a superinstruction somewhere in code"""
+    found = set()
+    for i in range(len(code)):
+        for length in range(2, BF_SUPER_LENGTH + 1):
+            ops = tuple(op for op, *_ in code[i:i + length])
+            if (len(ops) == length and all(op in SUPER_OPS for op in ops) and
+                    not any(op in SUPER_JUMPS for op in ops[:-1])):
+                found.add(ops)
+    return found
+
+def fuse(code, table):
+    """Indexes where the compiler would start each superinstruction of
+    table, picking the first that matches like bf_select_dispatch"""
+    starts = []
+    i = 0
+    while i < len(code):
+        for super_index, ops in enumerate(table):
+            if tuple(op for op, *_ in code[i:i + len(ops)]) == ops:
+                starts.append((i, super_index))
+                i += len(ops)
+                break
+        else:
+            i += 1
+    return starts
+
+def saved(workload, table):
+    """Dispatches the superinstructions of table save in the profile, each"""
+    totals = [0] * len(table)
+    for code, counts in workload:
+        for i, super_index in fuse(code, table):
+            totals[super_index] += counts[i] * (len(table[super_index]) - 1)
+    return totals
+
+def select(workload):
+    """Pick superinstructions one at a time, each time the sequence that
+    saves the most dispatches on top of those already picked"""
+    table = []
+    pool = set()
+    for code, _ in workload:
+        pool |= candidates(code)
+    while len(table) < BF_SUPER_MAX and pool:
+        best = max(sorted(pool), key=lambda ops: sum(saved(workload, table + [ops])))
+        if sum(saved(workload, table + [best])) <= sum(saved(workload, table)):
+            break
+        table.append(best)
+        pool.discard(best)
+    return list(zip(table, saved(workload, table)))
+
+def ngrams(workload):
+    """How often each candidate op sequence ran. Ops other than jumps always
+    continue with the next instruction, so a sequence runs whenever its
+    first instruction does."""
+    totals = {}
+    for code, counts in workload:
+        for ops in candidates(code):
+            for i in range(len(code)):
+                if tuple(op for op, *_ in code[i:i + len(ops)]) == ops:
+                    totals[ops] = totals.get(ops, 0) + counts[i]
+    return sorted(totals.items(), key=lambda item: (-item[1], item[0]))
+
+def write_header(f, chosen, programs):
+    names = [' '.join(SUPER_OPS[op] for op in ops) for ops, _ in chosen]
+    width = max(len(name) for name in names)
+
+    f.write("/* Brainfuck Superinstructions\n")
+    f.write(" * DO NOT EDIT - Generated by build_super.py from a profile of the\n")
+    f.write(" * sys/components programs:\n")
+    for line in textwrap.wrap(' '.join(programs), 66):
+        f.write(f" *   {line}\n")
+    f.write(" * Each op sequence below runs as one engine case, best first; the\n")
+    f.write(" * compiler gives an instruction the first superinstruction whose ops\n")
+    f.write(" * start there. Dispatches saved in the profile:\n")
+    for name, (_, count) in zip(names, chosen):
+        f.write(f" *   {name.ljust(width)}  {count}\n")
+    f.write(" */\n\n")
+    f.write("#ifndef BF_SUPER_H\n#define BF_SUPER_H\n\n")
+
+    f.write("/* Number of superinstructions and most ops in one */\n")
+    f.write(f"#define BF_SUPER_COUNT {len(chosen)}\n")
+    f.write(f"#define BF_SUPER_LENGTH {BF_SUPER_LENGTH}\n\n")
+
+    f.write("/* Ops of each superinstruction, END-terminated */\n")
+    f.write("#define BF_SUPER_OPS { \\\n")
+    for ops, _ in chosen:
+        row = ', '.join(f"BF_OP_{SUPER_OPS[op]}" for op in ops)
+        f.write(f"    {{ {row}, BF_OP_END }}, \\\n")
+    f.write("}\n\n")
+
+    f.write("/* Engine handlers, expanded into the dispatch of bf_engine.h */\n")
+    f.write("#define BF_SUPER_CASES \\\n")
+    for index, (ops, _) in enumerate(chosen):
+        steps = ' insn++; '.join(f"BF_DO_{SUPER_OPS[op]}();" for op in ops)
+        f.write(f"    BF_SUPER_CASE({index}) {steps} BF_NEXT(); \\\n")
+    f.write("\n")
+
+    f.write("/* Handler table entries for the threaded engines */\n")
+    f.write("#define BF_SUPER_LABELS \\\n")
+    for index in range(len(chosen)):
+        f.write(f"    BF_SUPER_LABEL({index}) \\\n")
+    f.write("\n")
+    f.write("#endif\n")
+
+def main():
+    base_dir = os.path.join("sys", "components")
+    output_file = "bf_super.h"
+    workload = []
+    programs = []
+
+    for name in sorted(os.listdir(base_dir)):
+        if not name.endswith('.bf'):
+            continue
+        with open(os.path.join(base_dir, name), 'rb') as infile:
+            image = bf.compile_image(infile.read(), BF_PROFILE_BUDGET)
+        if image is None:
+            print(f"Warning: {name} does not compile, not profiled")
+            continue
+        workload.append((image.code, image.counts))
+        programs.append(name)
+
+    if "--ngrams" in sys.argv[1:]:
+        for ops, count in ngrams(workload):
+            print(f"{count:10}  {' '.join(SUPER_OPS[op] for op in ops)}")
+        return 0
+
+    chosen = select(workload)
+    if not chosen:
+        print("Error: no op sequence worth a superinstruction")
+        return 1
+    with open(output_file, 'w') as f:
+        write_header(f, chosen, programs)
+    print(f"Generated {output_file} with {len(chosen)} superinstruction(s)")
+    return 0
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -2,11 +2,44 @@
 """
 Build script to embed sys/ directory into the kernel filesystem.
 Generates sysfs_data.c which contains all files from sys/ directory.
+Brainfuck programs are also compiled ahead of time into bytecode images
+(the bf_insn IR from bf.h) so the kernel can run them without parsing.
+Compiling, and evaluating each program's input-independent start, is
+done by build_image: the kernel's compiler and interpreter built for the
+build machine (make build_image), so images match what the kernel would
+compile. With --native, the command programs in sys/components are
+additionally translated into C functions that the kernel runs as native
+code.
 """
 
 import os
+import subprocess
 import sys
 
+# Host build of the kernel compiler (build_image.c)
+BUILD_IMAGE = os.path.join(os.path.dirname(os.path.abspath(__file__)), "build_image")
+
+# Limits mirrored from the kernel
+MAX_FILE_SIZE = 8192        # filesystem.c
+BF_BOUNDS_CLAMP = 1         # bf.h
+
+# IR opcodes (bf.h)
+BF_OP_END = 0
+BF_OP_ADD = 1
+BF_OP_MOVE = 2
+BF_OP_OUT = 3
+BF_OP_IN = 4
+BF_OP_JZ = 5
+BF_OP_JNZ = 6
+BF_OP_SET = 7
+BF_OP_MULADD = 8
+BF_OP_SCAN = 9
+BF_OP_PRINT = 10
+BF_OP_DIVMOD = 11
+BF_OP_COMPARE = 12
+BF_OP_FITS = 13
+BF_OP_SUPER = 16  # First superinstruction dispatch code (bf_super.h)
+
 def escape_c_string(s):
     """Escape a string for use in C source code."""
     result = []
@@ -27,6 +60,171 @@ def escape_c_string(s):
             result.append(f'\\x{ord(c):02x}')
     return ''.join(result)
 
+def c_string_literal(data):
+    """C string literal for bytes, one source line per output line. Octal
+    escapes cannot swallow the characters that follow them."""
+    lines = []
+    literal = ''
+    for byte in data:
+        if byte == ord('\\'):
+            literal += '\\\\'
+        elif byte == ord('"'):
+            literal += '\\"'
+        elif byte == ord('\n'):
+            literal += '\\n'
+        elif 32 <= byte < 127:
+            literal += chr(byte)
+        else:
+            literal += f'\\{byte:03o}'
+        if byte == ord('\n'):
+            lines.append(f'"{literal}"')
+            literal = ''
+    if literal or not lines:
+        lines.append(f'"{literal}"')
+    return '\n    '.join(lines)
+
+class Image:
+    """A program as build_image compiled it: magic and version of the
+    image format, variant (cell bits, bounds, tape cells), code as
+    (op, dispatch, arg, offset) per instruction, the evaluated start as
+    (output, first cell, cell values, pointer, resume index) or None, and
+    with a profile, how often each instruction ran."""
+
+    def __init__(self, text):
+        self.code = []
+        self.prefix = None
+        self.counts = []
+        for line in text.splitlines():
+            word, *fields = line.split(' ')
+            if word == 'image':
+                self.magic, self.version = (int(field) for field in fields)
+            elif word == 'variant':
+                self.variant = tuple(int(field) for field in fields)
+            elif word == 'insn':
+                self.code.append(tuple(int(field) for field in fields))
+            elif word == 'prefix':
+                resume, pointer, first = (int(field) for field in fields)
+                self.prefix = [b'', first, [], pointer, resume]
+            elif word == 'output':
+                self.prefix[0] = bytes.fromhex(fields[0])
+            elif word == 'tape':
+                self.prefix[2] = [int(field) for field in fields]
+            elif word == 'count':
+                self.counts.append(int(fields[0]))
+        if self.prefix:
+            self.prefix = tuple(self.prefix)
+
+def compile_image(content, profile=None):
+    """Compile file content as the kernel will see it: truncated to the
+    file size limit and ending at the first NUL byte. With profile set,
+    the program is also run for at most that many instructions and the
+    image gets its counts. Returns an Image, or None if the program does
+    not compile."""
+    source = content[:MAX_FILE_SIZE - 1].split(b'\0')[0]
+    command = [BUILD_IMAGE]
+    if profile is not None:
+        command += ['--profile', str(profile)]
+    if not os.path.exists(BUILD_IMAGE):
+        sys.exit(f"Error: {BUILD_IMAGE} not found (make build_image)")
+    result = subprocess.run(command, input=source, stdout=subprocess.PIPE)
+    if result.returncode == 1:
+        return None
+    if result.returncode != 0:
+        sys.exit(f"Error: build_image failed with status {result.returncode}")
+    return Image(result.stdout.decode('ascii'))
+
+# Helpers shared by the translated programs. first and last bound the
+# dirty window (see bf_native_entry in bf.h): leaving it calls back into
+# the kernel to widen it, and the pointer is clamped to the new edge.
+NATIVE_HELPERS = """\
+static inline uint8_t* sysfs_move(uint8_t* p, uint8_t** first, uint8_t** last, int distance) {
+    if (distance > 0 && *last - p < distance) {
+        *last = bf_native_grow_last((uint8_t*)((unsigned long)p + (unsigned long)distance));
+        return (*last - p < distance) ? *last : p + distance;
+    }
+    if (distance < 0 && p - *first < -distance) {
+        *first = bf_native_grow_first((uint8_t*)((unsigned long)p - (unsigned long)-distance));
+        return (p - *first < -distance) ? *first : p + distance;
+    }
+    return p + distance;
+}
+
+/* Widen the window to cover p after a scan or print helper moved it */
+static inline uint8_t* sysfs_widen(uint8_t* p, uint8_t** first, uint8_t** last) {
+    if (p > *last) {
+        *last = bf_native_grow_last(p);
+    } else if (p < *first) {
+        *first = bf_native_grow_first(p);
+    }
+    return p;
+}
+
+/* Note in section sysfs_map that the code from here on runs IR
+ * instruction insn of image (bf_native_mark in bf.h), for the sampling
+ * profiler. Emits no instructions. */
+#if __SIZEOF_POINTER__ == 8
+#define SYSFS_MARK_ENTRY ".balign 8\\n\\t.quad"
+#else
+#define SYSFS_MARK_ENTRY ".balign 4\\n\\t.long"
+#endif
+#define SYSFS_MARK(image, insn) \\
+    __asm__ volatile("1:\\n\\t.pushsection sysfs_map, \\"a\\"\\n\\t" SYSFS_MARK_ENTRY \\
+                     " 1b, " #image ", " #insn "\\n\\t.popsection")
+
+"""
+
+def write_native_function(f, name, image, code):
+    """Translate IR into a C function with the bf_native_entry signature.
+    The compiler only emits properly nested loops, so JZ/JNZ map to while,
+    and a FITS guards the instructions up to its arg, so it maps to if.
+    Functions share section sysfs_native and mark where each block of
+    image's IR starts (SYSFS_MARK)."""
+    f.write("static uint8_t* __attribute__((section(\"sysfs_native\")))\n")
+    f.write(f"{name}(uint8_t* p, uint8_t* first, uint8_t* last) {{\n")
+    f.write("    (void)first;\n")
+    f.write("    (void)last;\n")
+    f.write(f"    SYSFS_MARK({image}, 0);\n")
+    indent = "    "
+    guarded = {}  # Index of the last guarded instruction: FITS ending there
+    for i, (op, _, arg, offset) in enumerate(code):
+        if op == BF_OP_FITS:
+            f.write(f"{indent}if (bf_jit_fits(p, {offset})) {{\n")
+            indent += "    "
+            guarded[arg] = guarded.get(arg, 0) + 1
+        elif op == BF_OP_ADD:
+            f.write(f"{indent}p[{offset}] += {arg & 0xff};\n")
+        elif op == BF_OP_SET:
+            f.write(f"{indent}p[{offset}] = {arg & 0xff};\n")
+        elif op == BF_OP_MOVE:
+            f.write(f"{indent}p = sysfs_move(p, &first, &last, {arg});\n")
+        elif op == BF_OP_MULADD:
+            f.write(f"{indent}p[{offset}] += (uint8_t)(p[0] * {arg & 0xff});\n")
+        elif op == BF_OP_SCAN:
+            f.write(f"{indent}p = sysfs_widen(bf_jit_scan(p, {arg}), &first, &last);\n")
+        elif op == BF_OP_PRINT:
+            f.write(f"{indent}p = sysfs_widen(bf_jit_print(p, {arg}), &first, &last);\n")
+        elif op == BF_OP_DIVMOD:
+            f.write(f"{indent}bf_jit_divmod(p, {arg});\n")
+        elif op == BF_OP_COMPARE:
+            f.write(f"{indent}p = bf_jit_compare(p, {arg});\n")
+        elif op == BF_OP_OUT:
+            f.write(f"{indent}bf_putchar((char)p[{offset}]);\n")
+        elif op == BF_OP_IN:
+            f.write(f"{indent}p[{offset}] = (uint8_t)bf_getchar();\n")
+        elif op == BF_OP_JZ:
+            f.write(f"{indent}while (p[0]) {{\n")
+            indent += "    "
+            f.write(f"{indent}SYSFS_MARK({image}, {i + 1});\n")
+        elif op == BF_OP_JNZ:
+            indent = indent[:-4]
+            f.write(f"{indent}}}\n")
+            f.write(f"{indent}SYSFS_MARK({image}, {i + 1});\n")
+        for _ in range(guarded.pop(i, 0)):
+            indent = indent[:-4]
+            f.write(f"{indent}}}\n")
+    f.write("    return p;\n")
+    f.write("}\n")
+
 def collect_files(base_dir):
     """Collect all files from sys/ directory, preserving structure."""
     files = []
@@ -44,12 +242,34 @@ def collect_files(base_dir):
     
     return files
 
-def generate_c_file(files, output_file):
-    """Generate C source file with embedded file data."""
+def write_prefix(f, name, prefix, bits):
+    """Write the evaluated start of a program as a bf_prefix (see bf.h)."""
+    output, first, values, pointer, resume = prefix
+    f.write(f"static const char {name}_output[] =\n    {c_string_literal(output)};\n")
+    tape_var = "0"
+    if values:
+        tape_var = f"{name}_tape"
+        data = b''.join(value.to_bytes(bits // 8, 'little') for value in values)
+        f.write(f"static const uint8_t {tape_var}[] = {{")
+        for j, byte in enumerate(data):
+            if j % 16 == 0:
+                f.write("\n    ")
+            f.write(f"0x{byte:02x},")
+        f.write("\n};\n")
+    f.write(f"static const bf_prefix {name} = {{\n")
+    f.write(f"    {name}_output, {len(output)}, {tape_var}, {first}, {len(values)}, {pointer}, {resume}\n")
+    f.write("};\n")
+
+def generate_c_file(files, output_file, native):
+    """Generate C source file with embedded file data. With native set,
+    programs in components/ also get an ahead-of-time C translation."""
     with open(output_file, 'w') as f:
         f.write("/* Auto-generated file system data from sys/ directory */\n")
         f.write("/* DO NOT EDIT - Generated by build_sysfs.py */\n\n")
-        f.write("#include \"kernel.h\"\n\n")
+        f.write("#include \"kernel.h\"\n")
+        f.write("#include \"bf.h\"\n\n")
+        if native:
+            f.write(NATIVE_HELPERS)
         
         # Generate file data arrays
         file_vars = []
@@ -61,7 +281,13 @@ def generate_c_file(files, output_file):
             with open(filepath, 'rb') as infile:
                 content = infile.read()
             
-            file_vars.append((var_name, size_var, rel_path, len(content), is_binary))
+            image_var = None
+            if rel_path.endswith('.bf'):
+                image = compile_image(content)
+                if image is not None:
+                    image_var = f"sysfs_image_{i}"
+            
+            file_vars.append((var_name, size_var, rel_path, len(content), is_binary, image_var))
             
             f.write(f"/* {rel_path} */\n")
             if is_binary:
@@ -96,16 +322,44 @@ def generate_c_file(files, output_file):
                     else:
                         f.write(f'\\x{byte:02x}')
                 f.write("\";\n\n")
+            
+            if image_var:
+                # Precompiled IR, validated by the kernel before use
+                f.write(f"static const bf_insn {image_var}_code[] = {{\n")
+                for op, dispatch, arg, offset in image.code:
+                    f.write(f"    {{{op}, {dispatch}, {arg}, {offset}}},\n")
+                f.write("};\n")
+                native_var = "0"
+                # Native code only exists for 8-bit cells on a clamped tape
+                if (native and rel_path.startswith('components/') and
+                        image.variant[0] == 8 and image.variant[1] == BF_BOUNDS_CLAMP):
+                    native_var = f"{image_var}_native"
+                    write_native_function(f, native_var, image_var, image.code)
+                bits, bounds, cells = image.variant
+                prefix_var = "0"
+                # A start that neither finishes the program nor prints
+                # saves next to nothing, and would keep the rest of the
+                # run off native code (bf_cache_run)
+                if image.prefix is not None and (
+                        image.prefix[0] or image.code[image.prefix[4]][0] == BF_OP_END):
+                    prefix_var = f"&{image_var}_prefix"
+                    write_prefix(f, f"{image_var}_prefix", image.prefix, bits)
+                f.write(f"static const bf_image {image_var} = {{\n")
+                f.write(f"    0x{image.magic:08x}, {image.version}, {len(image.code)}, {image_var}_code,\n")
+                f.write(f"    {{{bits}, {bounds}, {cells}}}, {native_var}, {prefix_var}\n")
+                f.write("};\n\n")
         
         # Generate initialization function
         f.write("/* Initialize filesystem with files from sys/ directory */\n")
         f.write("void sysfs_initialize(void) {\n")
         f.write("    /* Start in /sys directory (already created by kernel) */\n")
+        if any(image_var for *_, image_var in file_vars):
+            f.write("    fs_entry* file;\n")
         
         # Track current directory to avoid redundant chdirs
         current_path = ["sys"]
         
-        for var_name, size_var, rel_path, file_size, is_binary in file_vars:
+        for var_name, size_var, rel_path, file_size, is_binary, image_var in file_vars:
             # Parse path and create directories/files
             parts = rel_path.split('/')
             filename = parts[-1]
@@ -141,6 +395,11 @@ def generate_c_file(files, output_file):
             # Create file (use binary function for binary files, regular for text files)
             if is_binary:
                 f.write(f"    fs_create_file_binary(\"{filename}\", {var_name}, {size_var});\n")
+            elif image_var:
+                f.write(f"    file = fs_create_file(\"{filename}\", {var_name});\n")
+                f.write("    if (file) {\n")
+                f.write(f"        file->image = &{image_var};\n")
+                f.write("    }\n")
             else:
                 f.write(f"    fs_create_file(\"{filename}\", {var_name});\n")
         
@@ -149,6 +408,7 @@ def generate_c_file(files, output_file):
 def main():
     base_dir = "sys"
     output_file = "sysfs_data.c"
+    native = "--native" in sys.argv[1:]
     
     if not os.path.exists(base_dir):
         print(f"Warning: {base_dir} directory does not exist. Creating empty sysfs_data.c")
@@ -178,7 +438,7 @@ def main():
     for rel_path, _ in files:
         print(f"  - {rel_path}")
     
-    generate_c_file(files, output_file)
+    generate_c_file(files, output_file, native)
     print(f"Generated {output_file}")
     return 0
 
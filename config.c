@@ -8,12 +8,14 @@
 typedef struct {
     size_t vga_width;
     size_t vga_height;
+    int bf_engine;
 } config_t;
 
 /* Default configuration */
 static config_t system_config = {
     .vga_width = 80,
-    .vga_height = 25
+    .vga_height = 25,
+    .bf_engine = BF_ENGINE_JIT
 };
 
 /* Initialize configuration */
@@ -21,6 +23,7 @@ void config_initialize(void) {
     /* Use defaults for now */
     system_config.vga_width = 80;
     system_config.vga_height = 25;
+    system_config.bf_engine = BF_ENGINE_JIT;
 }
 
 /* Get current VGA width */
@@ -80,3 +83,14 @@ void config_get_resolution_string(char* buffer, size_t max_len __attribute__((un
     buffer[i] = '\0';
 }
 
+
+/* Get the engine used to run Brainfuck programs */
+int config_get_bf_engine(void) {
+    return system_config.bf_engine;
+}
+
+/* Select the Brainfuck engine (BF_ENGINE_INTERP, BF_ENGINE_JIT or
+ * BF_ENGINE_THREADED) */
+void config_set_bf_engine(int engine) {
+    system_config.bf_engine = engine;
+}
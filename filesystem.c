@@ -15,6 +15,9 @@ static size_t fs_entry_count = 0;
 static char fs_file_data[MAX_FILES][MAX_FILE_SIZE];
 static size_t fs_file_data_used = 0;
 
+/* Source of fs_entry version numbers - never reused, even across fs_initialize */
+static size_t fs_next_version = 1;
+
 /* Current working directory */
 static fs_entry* fs_cwd = 0;
 
@@ -30,6 +33,8 @@ void fs_initialize(void) {
     fs_root->type = FS_TYPE_DIR;
     fs_root->size = 0;
     fs_root->data = 0;
+    fs_root->version = 0;
+    fs_root->image = 0;
     fs_root->parent = 0;
     fs_root->next = 0;
     
@@ -89,6 +94,8 @@ fs_entry* fs_mkdir(const char* name) {
     dir->type = FS_TYPE_DIR;
     dir->size = 0;
     dir->data = 0;
+    dir->version = 0;
+    dir->image = 0;
     dir->next = 0;
     
     fs_add_entry(fs_cwd, dir);
@@ -147,6 +154,8 @@ fs_entry* fs_create_file(const char* name, const char* content) {
     file_data[len] = '\0';
     file->size = len;
     file->data = file_data;
+    file->version = fs_next_version++;
+    file->image = 0;
     file->next = 0;
     
     fs_add_entry(fs_cwd, file);
@@ -191,6 +200,8 @@ fs_entry* fs_create_file_binary(const char* name, const uint8_t* content, size_t
     }
     file->size = len;
     file->data = file_data;
+    file->version = fs_next_version++;
+    file->image = 0;
     file->next = 0;
     
     fs_add_entry(fs_cwd, file);
@@ -4,6 +4,7 @@
  */
 
 #include "kernel.h"
+#include "bf.h"
 
 /* VGA entry helper */
 static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
@@ -54,6 +55,13 @@ void kernel_main(void) {
     fs_create_file("hello.bf", hello_bf);
     fs_chdir("/"); 
     
+    /* Start the other processors as batch workers */
+    terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
+    terminal_writestring("Starting processors...\n");
+    bf_smp_initialize();
+    terminal_putchar((char)('0' + bf_smp_cpus()));
+    terminal_writestring(bf_smp_cpus() == 1 ? " CPU online\n" : " CPUs online\n");
+    
     terminal_setcolor(vga_entry(COLOR_LIGHT_GREEN, COLOR_BLACK));
     terminal_writestring("System ready!\n\n");
     terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
@@ -38,6 +38,7 @@ typedef unsigned long uint32_t;
 void terminal_initialize(void);
 void terminal_setcolor(uint8_t color);
 void terminal_putchar(char c);
+void terminal_write(const char* data, size_t size);
 void terminal_writestring(const char* data);
 size_t terminal_get_row(void);
 size_t terminal_get_column(void);
@@ -48,12 +49,12 @@ void terminal_show_cursor(void);
 void terminal_clear(void);
 void terminal_set_resolution(size_t width, size_t height);
 
-/* Brainfuck interpreter functions */
-void bf_reset(void);
-void bf_execute(const char* code);
-void bf_load_and_run(const char* bf_code);
-size_t bf_get_pointer(void);
-uint8_t bf_get_value(void);
+/* Brainfuck interpreter functions (contexts are defined in bf.h) */
+struct bf_context;
+void bf_reset(struct bf_context* context);
+int bf_execute(const char* code);
+size_t bf_get_pointer(const struct bf_context* context);
+uint8_t bf_get_value(const struct bf_context* context);
 
 /* Keyboard functions */
 void keyboard_initialize(void);
@@ -73,6 +74,8 @@ typedef struct fs_entry {
     uint8_t type;
     size_t size;
     char* data;  /* For files: content; For dirs: child entries */
+    size_t version;  /* New value whenever the content changes */
+    const struct bf_image* image;  /* Precompiled program (build_sysfs.py), or 0 */
     struct fs_entry* parent;
     struct fs_entry* next;  /* Sibling linked list */
 } fs_entry;
@@ -100,6 +103,13 @@ size_t config_get_vga_width(void);
 size_t config_get_vga_height(void);
 int config_set_resolution(size_t width, size_t height);
 void config_get_resolution_string(char* buffer, size_t max_len);
+int config_get_bf_engine(void);
+void config_set_bf_engine(int engine);
+
+/* Brainfuck execution engines */
+#define BF_ENGINE_INTERP   0
+#define BF_ENGINE_JIT      1
+#define BF_ENGINE_THREADED 2
 
 /* Framebuffer functions (for ARM/RISC-V) */
 void framebuffer_putchar(char c, uint8_t color, size_t x, size_t y, size_t char_width, size_t char_height);
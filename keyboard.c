@@ -183,8 +183,11 @@ void keyboard_handle_interrupt(void) {
             /* Handle Ctrl+Q (quit) - send special code 0x11 (Ctrl+Q) */
             if (ctrl_pressed && ascii == 'q') {
                 ascii = 0x11; /* Ctrl+Q */
+            } else if (ctrl_pressed && (ascii == 'c' || ascii == 'z')) {
+                /* Job control: Ctrl+C (0x03) and Ctrl+Z (0x1A) */
+                ascii = ascii - 'a' + 1;
             } else if (ctrl_pressed && ascii != 0) {
-                /* Suppress other Ctrl+key combinations (except Ctrl+Q) */
+                /* Suppress other Ctrl+key combinations */
                 continue;
             }
             
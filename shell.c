@@ -3,6 +3,7 @@
  */
 
 #include "kernel.h"
+#include "bf.h"
 
 #define MAX_LINE_LENGTH 256
 #define MAX_ARGS 16
@@ -16,6 +17,10 @@ static inline uint16_t vga_entry(unsigned char uc, uint8_t color) {
 static char command_buffer[MAX_LINE_LENGTH];
 static size_t command_pos = 0;
 
+/* Compiled play session line (BF_INSNS_PER_CHAR instructions per character at most) */
+static bf_insn play_code[BF_INSNS_PER_CHAR * MAX_LINE_LENGTH + 1];
+static bf_program play_program = { play_code, 0, BF_INSNS_PER_CHAR * MAX_LINE_LENGTH + 1, 0, 0, { 0, 0, 0 }, 0 };
+
 /* Parse command line into arguments */
 static size_t parse_args(char* line, char* args[], size_t max_args) {
     size_t arg_count = 0;
@@ -114,15 +119,34 @@ static fs_entry* find_command(const char* cmd_name) {
     return 0;
 }
 
-/* Execute brainfuck command with arguments */
-static void execute_bf_command(fs_entry* file, char* args[] __attribute__((unused)), size_t arg_count __attribute__((unused))) {
+/* Whether the command line ends in "&": run it as a background job */
+static int background = 0;
+
+/* Execute brainfuck command with arguments. override (may be 0) replaces
+ * the cell size, tape length or bounds the program asked for. */
+static void execute_bf_command(fs_entry* file, char* args[] __attribute__((unused)), size_t arg_count __attribute__((unused)),
+                               const bf_variant* override) {
     if (!file || file->type != FS_TYPE_FILE) {
         return;
     }
     
+    if (background) {
+        int id = bf_job_start(file, override);
+        if (id > 0) {
+            terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
+            terminal_putchar('[');
+            terminal_putchar((char)('0' + id));
+            terminal_writestring("] ");
+            terminal_writestring(file->name);
+            terminal_putchar('\n');
+            terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
+        }
+        return;
+    }
+    
     /* For now, just execute the brainfuck file */
     /* TODO: Pass arguments to brainfuck program via system calls */
-    bf_load_and_run(file->data);
+    bf_cache_run(file, override);
 }
 
 /* Forward declarations */
@@ -179,15 +203,56 @@ static void ls_callback(const char* name, uint8_t type) {
     terminal_writestring("  ");
 }
 
-/* Handle run command */
+/* Parse an unsigned decimal number, or return 0 if text is not one */
+static size_t parse_size(const char* text) {
+    size_t value = 0;
+    if (*text == '\0') {
+        return 0;
+    }
+    for (; *text != '\0'; text++) {
+        if (*text < '0' || *text > '9' || value > 0xFFFFFFF) {
+            return 0;
+        }
+        value = value * 10 + (size_t)(*text - '0');
+    }
+    return value;
+}
+
+/* Handle run command: run [-c8|-c16|-c32] [-t<cells>] [-w] <file> */
 static void handle_run(char* args[], size_t arg_count) {
-    if (arg_count < 2) {
+    bf_variant override = { 0, 0, 0 };
+    size_t first = 1;
+    
+    /* Engine options come before the file name */
+    while (first < arg_count && args[first][0] == '-') {
+        char* option = args[first];
+        if (option[1] == 'c' && option[2] == '8' && option[3] == '\0') {
+            override.cell_bits = 8;
+        } else if (option[1] == 'c' && option[2] == '1' && option[3] == '6' && option[4] == '\0') {
+            override.cell_bits = 16;
+        } else if (option[1] == 'c' && option[2] == '3' && option[3] == '2' && option[4] == '\0') {
+            override.cell_bits = 32;
+        } else if (option[1] == 'w' && option[2] == '\0') {
+            override.bounds = BF_BOUNDS_WRAP;
+        } else if (option[1] == 't' && parse_size(option + 2) != 0) {
+            override.tape_cells = parse_size(option + 2);
+        } else {
+            terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+            terminal_writestring("run: unknown option ");
+            terminal_writestring(option);
+            terminal_writestring("\nUsage: run [-c8|-c16|-c32] [-t<cells>] [-w] <file>\n");
+            return;
+        }
+        first++;
+    }
+    
+    if (first >= arg_count) {
         terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
         terminal_writestring("run: missing argument\n");
         return;
     }
     
-    fs_entry* file = fs_find_file(args[1]);
+    fs_entry* file = fs_find_file(args[first]);
     if (!file || file->type != FS_TYPE_FILE) {
         terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
         terminal_writestring("run: file not found\n");
@@ -195,12 +260,134 @@ static void handle_run(char* args[], size_t arg_count) {
     }
     
     char* bf_args[MAX_ARGS];
-    size_t bf_arg_count = arg_count - 1;
+    size_t bf_arg_count = arg_count - first;
     for (size_t i = 0; i < bf_arg_count; i++) {
-        bf_args[i] = args[i + 1];
+        bf_args[i] = args[i + first];
     }
     
-    execute_bf_command(file, bf_args, bf_arg_count);
+    execute_bf_command(file, bf_args, bf_arg_count, &override);
+    if (!background) {
+        terminal_putchar('\n');
+    }
+}
+
+/* Handle profile command: profile [-s] <file>. -s samples the native
+ * code with a timer instead of counting every op in the interpreter. */
+static void handle_profile(char* args[], size_t arg_count) {
+    size_t first = 1;
+    int sample = 0;
+    
+    if (first < arg_count && args[first][0] == '-') {
+        if (args[first][1] != 's' || args[first][2] != '\0') {
+            terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+            terminal_writestring("profile: unknown option ");
+            terminal_writestring(args[first]);
+            terminal_writestring("\nUsage: profile [-s] <file>\n");
+            return;
+        }
+        sample = 1;
+        first++;
+    }
+    
+    if (first >= arg_count) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("profile: missing argument\n");
+        return;
+    }
+    
+    fs_entry* file = fs_find_file(args[first]);
+    if (!file || file->type != FS_TYPE_FILE) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("profile: file not found\n");
+        return;
+    }
+    
+    if (sample) {
+        bf_profile_sample(file);
+    } else {
+        bf_profile(file);
+    }
+    terminal_putchar('\n');
+}
+
+/* Handle batch command - run several programs at once on every CPU.
+ * Each argument is a file or a command name. */
+static void handle_batch(char* args[], size_t arg_count) {
+    fs_entry* files[MAX_ARGS];
+    size_t count = 0;
+    
+    if (arg_count < 2) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("batch: missing argument\n");
+        terminal_writestring("Usage: batch <file>...\n");
+        return;
+    }
+    
+    for (size_t i = 1; i < arg_count; i++) {
+        fs_entry* file = fs_find_file(args[i]);
+        if (!file || file->type != FS_TYPE_FILE) {
+            file = find_command(args[i]);
+        }
+        if (!file) {
+            terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+            terminal_writestring("batch: file not found: ");
+            terminal_writestring(args[i]);
+            terminal_putchar('\n');
+            return;
+        }
+        files[count++] = file;
+    }
+    
+    bf_batch(files, count, 0);
+}
+
+/* Handle a pipeline - "a | b | c" streams the output of each program
+ * into the input of the next. Each stage is a file or a command name. */
+static void handle_pipeline(char* args[], size_t arg_count) {
+    fs_entry* files[MAX_ARGS];
+    size_t count = 0;
+    size_t start = 0;
+    
+    if (background) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("pipeline: cannot run in the background\n");
+        return;
+    }
+    
+    for (size_t i = 0; i <= arg_count; i++) {
+        if (i < arg_count && !(args[i][0] == '|' && args[i][1] == '\0')) {
+            continue;
+        }
+        if (i == start) {
+            terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+            terminal_writestring("pipeline: missing command\n");
+            terminal_writestring("Usage: <file> | <file>...\n");
+            return;
+        }
+        if (i - start > 1) {
+            terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+            terminal_writestring("pipeline: arguments not supported: ");
+            terminal_writestring(args[start + 1]);
+            terminal_putchar('\n');
+            return;
+        }
+        
+        fs_entry* file = fs_find_file(args[start]);
+        if (!file || file->type != FS_TYPE_FILE) {
+            file = find_command(args[start]);
+        }
+        if (!file) {
+            terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+            terminal_writestring("pipeline: file not found: ");
+            terminal_writestring(args[start]);
+            terminal_putchar('\n');
+            return;
+        }
+        files[count++] = file;
+        start = i + 1;
+    }
+    
+    bf_pipeline(files, count, 0);
     terminal_putchar('\n');
 }
 
@@ -257,6 +444,10 @@ static void handle_config(char* args[], size_t arg_count) {
         terminal_writestring("  Resolution: ");
         terminal_writestring(res_str);
         terminal_putchar('\n');
+        terminal_writestring("  BF engine:  ");
+        terminal_writestring(config_get_bf_engine() == BF_ENGINE_JIT ? "jit" :
+                             config_get_bf_engine() == BF_ENGINE_THREADED ? "threaded" : "interp");
+        terminal_putchar('\n');
         terminal_putchar('\n');
         
         terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
@@ -265,6 +456,7 @@ static void handle_config(char* args[], size_t arg_count) {
         terminal_writestring("  config                    - Show current configuration\n");
         terminal_writestring("  config resolution <WxH>  - Set resolution (e.g., 80x50)\n");
         terminal_writestring("  config resolutions       - List available resolutions\n");
+        terminal_writestring("  config engine <jit|interp|threaded> - Select the Brainfuck engine\n");
         return;
     }
     
@@ -362,11 +554,177 @@ static void handle_config(char* args[], size_t arg_count) {
         return;
     }
     
+    if (subcmd_len == 6 &&
+        args[1][0] == 'e' && args[1][1] == 'n' && args[1][2] == 'g' && args[1][3] == 'i' &&
+        args[1][4] == 'n' && args[1][5] == 'e') {
+        /* Select the Brainfuck engine */
+        char* engine = (arg_count >= 3) ? args[2] : "";
+        if (engine[0] == 'j' && engine[1] == 'i' && engine[2] == 't' && engine[3] == '\0') {
+            config_set_bf_engine(BF_ENGINE_JIT);
+        } else if (engine[0] == 'i' && engine[1] == 'n' && engine[2] == 't' && engine[3] == 'e' &&
+                   engine[4] == 'r' && engine[5] == 'p' && engine[6] == '\0') {
+            config_set_bf_engine(BF_ENGINE_INTERP);
+        } else if (engine[0] == 't' && engine[1] == 'h' && engine[2] == 'r' && engine[3] == 'e' &&
+                   engine[4] == 'a' && engine[5] == 'd' && engine[6] == 'e' && engine[7] == 'd' &&
+                   engine[8] == '\0') {
+            config_set_bf_engine(BF_ENGINE_THREADED);
+        } else {
+            terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+            terminal_writestring("config engine: expected 'jit', 'interp' or 'threaded'\n");
+            return;
+        }
+        terminal_setcolor(vga_entry(COLOR_LIGHT_GREEN, COLOR_BLACK));
+        terminal_writestring("BF engine set to ");
+        terminal_writestring(engine);
+        terminal_putchar('\n');
+        terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
+        return;
+    }
+    
     terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
     terminal_writestring("config: unknown subcommand\n");
     terminal_writestring("Use 'config' to see usage\n");
 }
 
+/* Print an unsigned decimal number */
+static void write_number(size_t value) {
+    char digits[12];
+    size_t count = 0;
+    do {
+        digits[count++] = '0' + (value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) {
+        terminal_putchar(digits[--count]);
+    }
+}
+
+/* Handle cache command - compiled-program cache statistics */
+static void handle_cache(char* args[], size_t arg_count) {
+    if (arg_count >= 2) {
+        if (args[1][0] == 'c' && args[1][1] == 'l' && args[1][2] == 'e' && args[1][3] == 'a' &&
+            args[1][4] == 'r' && args[1][5] == '\0') {
+            bf_cache_clear();
+            terminal_setcolor(vga_entry(COLOR_LIGHT_GREEN, COLOR_BLACK));
+            terminal_writestring("Program cache cleared\n");
+            terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
+            return;
+        }
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("cache: unknown subcommand\n");
+        terminal_writestring("Usage: cache [clear]\n");
+        return;
+    }
+    
+    bf_cache_stats stats;
+    bf_cache_get_stats(&stats);
+    
+    terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
+    terminal_writestring("Program Cache:\n");
+    terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
+    terminal_writestring("  Hits:      ");
+    write_number(stats.hits);
+    terminal_writestring("\n  Misses:    ");
+    write_number(stats.misses);
+    terminal_writestring("\n  Evictions: ");
+    write_number(stats.evictions);
+    terminal_writestring("\n  Programs:  ");
+    write_number(stats.entries);
+    terminal_writestring("\n  Memory:    ");
+    write_number(stats.bytes_used);
+    terminal_writestring(" / ");
+    write_number(stats.bytes_budget);
+    terminal_writestring(" bytes\n");
+}
+
+/* Print a 64-bit count in decimal. Subtracts powers of ten rather than
+ * dividing, which would need libgcc on 32-bit targets. */
+static void write_count(unsigned long long value) {
+    unsigned long long power = 1;
+    unsigned long long powers[20];
+    size_t count = 0;
+    
+    /* Powers of ten up to value (10^19 at most) */
+    do {
+        powers[count++] = power;
+        power *= 10;
+    } while (count < 20 && power <= value);
+    
+    while (count > 0) {
+        char digit = '0';
+        power = powers[--count];
+        while (value >= power) {
+            value -= power;
+            digit++;
+        }
+        terminal_putchar(digit);
+    }
+}
+
+/* Job number from a jobs/fg/kill argument ("2" or "%2"), or 0 */
+static int parse_job(const char* arg) {
+    if (arg[0] == '%') {
+        arg++;
+    }
+    if (arg[0] < '1' || arg[0] > '9' || arg[1] != '\0') {
+        return 0;
+    }
+    return arg[0] - '0';
+}
+
+/* Handle jobs command - list background jobs */
+static void handle_jobs(char* args[] __attribute__((unused)), size_t arg_count __attribute__((unused))) {
+    bf_job_info jobs[BF_MAX_JOBS];
+    size_t count = bf_job_list(jobs, BF_MAX_JOBS);
+    
+    if (count == 0) {
+        terminal_writestring("No jobs\n");
+        return;
+    }
+    for (size_t i = 0; i < count; i++) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
+        terminal_putchar('[');
+        terminal_putchar((char)('0' + jobs[i].id));
+        terminal_writestring("] ");
+        terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
+        if (jobs[i].state == BF_JOB_WAITING) {
+            terminal_writestring("Waiting  ");
+        } else if (jobs[i].state == BF_JOB_DONE) {
+            terminal_writestring("Done     ");
+        } else {
+            terminal_writestring("Running  ");
+        }
+        terminal_writestring(jobs[i].name);
+        terminal_writestring("  (");
+        write_count(jobs[i].ops);
+        terminal_writestring(" ops)\n");
+    }
+}
+
+/* Handle fg command - bring a job to the foreground, the newest by default */
+static void handle_fg(char* args[], size_t arg_count) {
+    int id = (arg_count >= 2) ? parse_job(args[1]) : bf_job_last();
+    
+    if (bf_job_foreground(id) != 0) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("fg: no such job\n");
+    }
+}
+
+/* Handle kill command - stop a job */
+static void handle_kill(char* args[], size_t arg_count) {
+    if (arg_count < 2) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("kill: missing argument\n");
+        terminal_writestring("Usage: kill <job>\n");
+        return;
+    }
+    if (bf_job_kill(parse_job(args[1])) != 0) {
+        terminal_setcolor(vga_entry(COLOR_LIGHT_RED, COLOR_BLACK));
+        terminal_writestring("kill: no such job\n");
+    }
+}
+
 /* Handle play command - interactive brainfuck session */
 static void handle_play(char* args[] __attribute__((unused)), size_t arg_count __attribute__((unused))) {
     terminal_setcolor(vga_entry(COLOR_LIGHT_CYAN, COLOR_BLACK));
@@ -424,9 +782,10 @@ static void handle_play(char* args[] __attribute__((unused)), size_t arg_count _
                 /* Execute brainfuck code if not empty */
                 if (pos > 0) {
                     terminal_setcolor(vga_entry(COLOR_LIGHT_GREY, COLOR_BLACK));
-                    bf_reset();
-                    bf_execute(bf_code);
-                    terminal_putchar('\n');
+                    if (bf_compile(bf_code, &play_program) == 0) {
+                        bf_run(&play_program);
+                        terminal_putchar('\n');
+                    }
                 }
                 
                 break;
@@ -456,10 +815,25 @@ static void execute_command(const char* line) {
     char* args[MAX_ARGS];
     size_t arg_count = parse_args(line_copy, args, MAX_ARGS);
     
+    /* A trailing "&" runs the command in the background */
+    background = 0;
+    if (arg_count > 0 && args[arg_count - 1][0] == '&' && args[arg_count - 1][1] == '\0') {
+        background = 1;
+        arg_count--;
+    }
+    
     if (arg_count == 0) {
         return;
     }
     
+    /* A "|" between commands makes a pipeline */
+    for (size_t j = 0; j < arg_count; j++) {
+        if (args[j][0] == '|' && args[j][1] == '\0') {
+            handle_pipeline(args, arg_count);
+            return;
+        }
+    }
+    
     /* Built-in commands */
     size_t cmd_len = 0;
     while (args[0][cmd_len] != '\0') {
@@ -504,11 +878,48 @@ static void execute_command(const char* line) {
         return;
     }
     
+    if (cmd_len == 5 && args[0][0] == 'c' && args[0][1] == 'a' && args[0][2] == 'c' &&
+        args[0][3] == 'h' && args[0][4] == 'e') {
+        handle_cache(args, arg_count);
+        return;
+    }
+    
+    if (cmd_len == 7 && args[0][0] == 'p' && args[0][1] == 'r' && args[0][2] == 'o' &&
+        args[0][3] == 'f' && args[0][4] == 'i' && args[0][5] == 'l' && args[0][6] == 'e') {
+        handle_profile(args, arg_count);
+        return;
+    }
+    
+    if (cmd_len == 4 && args[0][0] == 'j' && args[0][1] == 'o' && args[0][2] == 'b' &&
+        args[0][3] == 's') {
+        handle_jobs(args, arg_count);
+        return;
+    }
+    
+    if (cmd_len == 5 && args[0][0] == 'b' && args[0][1] == 'a' && args[0][2] == 't' &&
+        args[0][3] == 'c' && args[0][4] == 'h') {
+        handle_batch(args, arg_count);
+        return;
+    }
+    
+    if (cmd_len == 2 && args[0][0] == 'f' && args[0][1] == 'g') {
+        handle_fg(args, arg_count);
+        return;
+    }
+    
+    if (cmd_len == 4 && args[0][0] == 'k' && args[0][1] == 'i' && args[0][2] == 'l' &&
+        args[0][3] == 'l') {
+        handle_kill(args, arg_count);
+        return;
+    }
+    
     /* Try to find as brainfuck command */
     fs_entry* cmd_file = find_command(args[0]);
     if (cmd_file) {
-        execute_bf_command(cmd_file, args, arg_count);
-        terminal_putchar('\n');
+        execute_bf_command(cmd_file, args, arg_count, 0);
+        if (!background) {
+            terminal_putchar('\n');
+        }
         return;
     }
     
@@ -534,8 +945,11 @@ static void read_line(char* buffer, size_t max_len) {
         if (c == -1) {
             /* Update cursor while waiting */
             terminal_update_cursor();
-            /* Small delay to give CPU time */
-            for (volatile int i = 0; i < 5000; i++);
+            /* Background jobs get the time while waiting; with none
+             * to run, a small delay gives CPU time */
+            if (bf_job_schedule() == 0) {
+                for (volatile int i = 0; i < 5000; i++);
+            }
             /* Don't use HLT - it might prevent keyboard polling on some systems */
             continue;
         }
@@ -596,6 +1010,7 @@ static void print_prompt(void) {
 /* Shell main loop */
 void shell_main(void) {
     while (1) {
+        bf_job_reap();
         print_prompt();
         read_line(command_buffer, MAX_LINE_LENGTH);
         
@@ -129,21 +129,21 @@ static void terminal_scroll(void) {
     }
 }
 
-/* Handle newline */
-void terminal_putchar(char c) {
-    size_t width = get_vga_width();
-    size_t height = get_vga_height();
-    
-    /* Clear cursor at old position before writing */
+/* Erase the cursor drawn at the current position, before it moves */
+static void terminal_erase_cursor(void) {
     if (cursor_visible && !use_framebuffer) {
-        const size_t old_index = terminal_row * width + terminal_column;
+        const size_t old_index = terminal_row * get_vga_width() + terminal_column;
         uint16_t old = terminal_buffer[old_index];
         if ((old & 0xFF) == cursor_char) {
             /* Restore the character that was under the cursor, or space */
             terminal_buffer[old_index] = vga_entry(' ', (old >> 8) & 0xFF);
         }
     }
-    
+}
+
+/* Write one character and advance, handling newline and scrolling.
+ * Leaves the cursor to the caller. */
+static void terminal_emit(char c, size_t width, size_t height) {
     if (c == '\n') {
         terminal_column = 0;
         if (++terminal_row >= height) {
@@ -157,9 +157,17 @@ void terminal_putchar(char c) {
             if (++terminal_row >= height) {
                 terminal_scroll();
                 terminal_row = height - 1;
-        }
+            }
         }
     }
+}
+
+/* Handle newline */
+void terminal_putchar(char c) {
+    /* Clear cursor at old position before writing */
+    terminal_erase_cursor();
+    
+    terminal_emit(c, get_vga_width(), get_vga_height());
     
     /* Show cursor at new position */
     if (cursor_visible) {
@@ -167,14 +175,28 @@ void terminal_putchar(char c) {
     }
 }
 
+/* Write size characters at once. The cursor is erased and redrawn once
+ * for the whole block rather than once per character. */
+void terminal_write(const char* data, size_t size) {
+    size_t width = get_vga_width();
+    size_t height = get_vga_height();
+    
+    terminal_erase_cursor();
+    for (size_t i = 0; i < size; i++) {
+        terminal_emit(data[i], width, height);
+    }
+    if (cursor_visible) {
+        terminal_update_cursor();
+    }
+}
+
 /* Write string */
 void terminal_writestring(const char* data) {
     size_t datalen = 0;
     while (data[datalen] != '\0') {
         datalen++;
     }
-    for (size_t i = 0; i < datalen; i++)
-        terminal_putchar(data[i]);
+    terminal_write(data, datalen);
 }
 
 /* Get terminal row */
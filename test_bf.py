@@ -0,0 +1,189 @@
+#!/usr/bin/env python3
+"""
+Regression tests for the Brainfuck compiler and interpreter.
+Each program is compiled and run with build_image (make build_image) up
+to its first input, its end, or the instruction budget build_image
+evaluates a program's start with, and its output compared with what the
+unoptimized semantics give: an 8-bit cell and a pointer that stops at
+either edge of the tape, unless a #bf directive asks for another engine.
+A program that never ends runs until the budget stops it, so only the
+start of its output is compared.
+
+The library routine cases (BF_OP_DIVMOD, BF_OP_COMPARE) and the guarded
+multiply cases (BF_OP_FITS) run at every cell width and in both
+directions, and are checked against a plain interpreter of the source
+instead, since a routine or multiply that does not apply falls back to
+its loop. Run with make check.
+"""
+
+import sys
+
+import build_sysfs as bf
+
+# (name, program, output, whether it ends)
+CASES = [
+    # A deferred move must not skip the clamp at the left edge
+    ('clamp before offsets', b'>-<<<--->..', b'\xff\xff', True),
+    ('clamp before a print', b'<>' + b'+' * 15 + b'[.<]', b'\x0f', True),
+    # A scan or print that ends on a nonzero edge cell goes on forever,
+    # so the cell after it is zero whenever anything runs
+    ('scan onto a nonzero edge', b'+[<]+.', b'', False),
+    ('print onto a nonzero edge', b'+[.<]+.', b'\x01\x01\x01', False),
+    ('wide scan onto a nonzero edge', b'#bf cell=16\n+[<]+.', b'', False),
+    # Offsets a whole wrapping tape apart are the same cell
+    ('wrapped multiply', b'#bf wrap tape=3\n++[->>>+++<<<>+<]>.', b'\x7f', True),
+    ('wrapped unroll', b'#bf wrap tape=3\n++[->>>+<<<]', b'', False),
+]
+
+# Library routine loops, written rightwards; mirrored copies run leftwards
+DIVMOD = b'[->-[>+>>]>[+[-<+>]>+>>]<<<<<]'
+DIVMOD_KEEP = b'[->+>-[>+>>]>[+[-<+>]>+>>]<<<<<<]'
+COMPARE = b'[->-[>]<<]'
+
+def cells(*values):
+    """Commands that set the cells from the pointer on to values and come
+    back to the first"""
+    return b'>'.join(b'+' * value for value in values) + b'<' * (len(values) - 1)
+
+# (name, tape settings, program): each prints the cells the routine works
+# on, and compares print a marker past them too, so a fallback that does
+# not match the loop or a compare that stops on the wrong cell shows
+LIBRARY_CASES = [
+    ('divmod', b'', cells(17, 5) + DIVMOD + b'.>.>.>.'),
+    ('divmod with a remainder counted', b'', cells(23, 4, 3) + DIVMOD + b'.>.>.>.'),
+    ('divmod counting past a multiple', b'', cells(23, 2, 3) + DIVMOD + b'.>.>.>.'),
+    ('divmod by one', b'', cells(9, 1) + DIVMOD + b'.>.>.>.'),
+    ('divmod by zero', b'', cells(7) + DIVMOD + b'.>.>.>.'),
+    ('divmod past the largest cell', b'', cells(30, 200, 100) + DIVMOD + b'.>.>.>.'),
+    ('divmod onto nonzero scratch', b'', cells(13, 3, 0, 0, 0, 2) + DIVMOD + b'.>.>.>.>.>.'),
+    ('divmod off a clamped tape', b' tape=9', b'>>>>' + cells(11, 3) + DIVMOD + b'.>.>.>.'),
+    ('divmod round a wrapping tape', b' tape=5 wrap', cells(11, 3) + DIVMOD + b'.>.>.>.>.'),
+    ('divmod keeping n', b'', cells(47, 0, 10) + DIVMOD_KEEP + b'.>.>.>.>.'),
+    ('divmod keeping n by zero', b'', cells(5, 1) + DIVMOD_KEEP + b'.>.>.>.>.'),
+    ('divmod keeping n onto nonzero scratch', b'',
+     cells(19, 0, 4, 0, 0, 0, 1) + DIVMOD_KEEP + b'.>.>.>.>.>.>.'),
+    ('divmod keeping n off a clamped tape', b' tape=10',
+     b'>>>>' + cells(19, 0, 4) + DIVMOD_KEEP + b'.>.>.>.>.'),
+    ('compare a below b', b'', b'>' + cells(3, 8, 0, 9) + COMPARE + b'.>.>.>.>.'),
+    ('compare b below a', b'', b'>' + cells(8, 3, 0, 9) + COMPARE + b'.>.>.>.>.'),
+    ('compare equal', b'', b'>' + cells(6, 6, 0, 9) + COMPARE + b'.>.>.>.>.'),
+    ('compare onto nonzero scratch', b'', b'+>' + cells(5, 2, 0, 9) + COMPARE + b'.>.>.>.>.'),
+    ('compare past nonzero scratch', b'', b'>' + cells(5, 2, 0, 0) + b'>>+<<' + COMPARE + b'.>.>.>.'),
+    ('compare off a clamped tape', b' tape=3', b'>' + cells(4, 1) + COMPARE + b'.>.>.>.'),
+]
+
+# Multiply loops after a scan that may leave the pointer anywhere, so
+# their moves may stop at an edge: the MULADDs run behind a FITS when the
+# cells are on the tape, and the loop itself when they are not
+GUARD_CASES = [
+    ('guarded multiply', b'', b'[>]+++[->++<]>.'),
+    ('guarded multiply at the edge', b' tape=4', b'>>>[>]+++[->++<]>.<.'),
+    ('guarded multiply both ways', b'', b'>[>]+++[-<<+>>>+<]>.<.<.<.'),
+    ('guarded multiply past the far edge', b' tape=4', b'>>[>]+++[-<<+>>>+<]>.<.<.<.'),
+    ('guarded multiply past the near edge', b' tape=4', b'>[>]+++[-<<+>>>+<]>.<.<.<.'),
+    ('guarded multiply by an inverse', b'', b'[>]++++++[--->+<]>.'),
+    ('guarded multiply in a loop', b' tape=6',
+     b'+[>]<+[>+++[->++<]>[-<+>]<<-]>.>.'),
+]
+
+REFERENCE_WIDTHS = (8, 16, 32)
+
+def mirror(program):
+    """program with '<' and '>' swapped"""
+    return program.translate(bytes.maketrans(b'<>', b'><'))
+
+def interpret(source, limit=1000000):
+    """Run source on the unoptimized semantics of its #bf directive.
+    Returns its output, or None if it did not end within limit commands."""
+    bits, size, wrap = 8, 30000, False
+    if source.startswith(b'#bf'):
+        directive, source = source.split(b'\n', 1)
+        for word in directive.split()[1:]:
+            if word.startswith(b'cell='):
+                bits = int(word[5:])
+            elif word.startswith(b'tape='):
+                size = int(word[5:])
+            else:
+                wrap = word == b'wrap'
+    mask = (1 << bits) - 1
+    code = [c for c in source if c in b'+-<>.,[]']
+    jumps, stack = {}, []
+    for i, c in enumerate(code):
+        if c == ord('['):
+            stack.append(i)
+        elif c == ord(']'):
+            jumps[i] = stack[-1]
+            jumps[stack.pop()] = i
+    tape, pointer, output, i = [0] * size, 0, bytearray(), 0
+    while i < len(code) and limit > 0:
+        c = code[i]
+        limit -= 1
+        if c == ord('+') or c == ord('-'):
+            tape[pointer] = (tape[pointer] + (1 if c == ord('+') else -1)) & mask
+        elif c == ord('<') or c == ord('>'):
+            pointer += 1 if c == ord('>') else -1
+            pointer = pointer % size if wrap else min(max(pointer, 0), size - 1)
+        elif c == ord('.'):
+            output.append(tape[pointer] & 0xff)
+        elif c == ord('[') and tape[pointer] == 0 or c == ord(']') and tape[pointer] != 0:
+            i = jumps[i]
+        i += 1
+    return bytes(output) if i == len(code) else None
+
+def run(name, program, output, ends):
+    """Check one case. Returns an error message, or None if it passed."""
+    image = bf.compile_image(program)
+    if image is None:
+        return 'does not compile'
+    if image.prefix is None:
+        return 'was not evaluated'
+    got, _, _, _, resume = image.prefix
+    ended = image.code[resume][0] == bf.BF_OP_END
+    if ended != ends:
+        return 'ended' if ended else 'did not end'
+    if (got != output) if ends else not got.startswith(output):
+        return f'printed {got[:32]!r}, expected {output!r}'
+    return None
+
+def run_reference(program, ops, what):
+    """Check one case against the plain interpreter, and that its code
+    uses one of ops, what the case is named for.
+    Returns an error message, or None if it passed."""
+    output = interpret(program)
+    if output is None:
+        return 'does not end on the plain interpreter'
+    image = bf.compile_image(program)
+    if image is None:
+        return 'does not compile'
+    if not any(op in ops for op, _, _, _ in image.code):
+        return f'has no {what}'
+    return run(None, program, output, True)
+
+def main():
+    failed = 0
+    total = len(CASES)
+    for name, program, output, ends in CASES:
+        error = run(name, program, output, ends)
+        if error:
+            print(f'FAIL {name}: {error}')
+            failed += 1
+    reference_cases = (
+        [(case, (bf.BF_OP_DIVMOD, bf.BF_OP_COMPARE), 'library routine') for case in LIBRARY_CASES] +
+        [(case, (bf.BF_OP_FITS,), 'guard') for case in GUARD_CASES])
+    for (name, settings, program), ops, what in reference_cases:
+        for bits in REFERENCE_WIDTHS:
+            for direction, code in (('rightwards', program), ('leftwards', mirror(program))):
+                # Leftward copies start far enough in to have room
+                if direction == 'leftwards':
+                    code = b'>' * 12 + code
+                source = b'#bf cell=%d' % bits + settings + b'\n' + code
+                error = run_reference(source, ops, what)
+                total += 1
+                if error:
+                    print(f'FAIL {name}, {bits}-bit, {direction}: {error}')
+                    failed += 1
+    print(f'{total - failed} of {total} passed')
+    return 1 if failed else 0
+
+if __name__ == '__main__':
+    sys.exit(main())